@@ -107,15 +107,21 @@
 extern "C" {
 #endif
 
+/**
+ * @def AVR_VERSION
+ * @brief Version of avr-pi
+ */
+#define AVR_VERSION "0.0.0"
+
 /**
  * @def AVR_MCU_CLK_SPEED
- * @brief Clock speed of 16MHz
+ * @brief Clock source frequency of 16MHz the MCU is initialized with, see avr_set_clock
  */
 #define AVR_MCU_CLK_SPEED 16000000L
 
 /**
  * @def AVR_MCU_CLK_PERIOD
- * @brief Clock period in nanoseconds
+ * @brief Clock period in nanoseconds at AVR_MCU_CLK_SPEED
  */
 #define AVR_MCU_CLK_PERIOD (1000000000L / AVR_MCU_CLK_SPEED)
 
@@ -173,12 +179,48 @@ extern "C" {
  */
 #define AVR_MCU_EEPROM_SIZE 0x0400
 
+/**
+ * @def AVR_IDLE_HEADS
+ * @brief Loop heads avr_run checks for idling at once, a power of two.
+ */
+#define AVR_IDLE_HEADS 8
+
+/**
+ * @def AVR_IDLE_NONE
+ * @brief Program counter no loop head has.
+ */
+#define AVR_IDLE_NONE 0xFFFF
+
+/**
+ * @def AVR_JIT_HOT
+ * @brief Times avr_run interprets a block before it counts as hot, see AVR_MCU::hot_blocks.
+ */
+#define AVR_JIT_HOT 64
+
 /**
  * @def AVR_MCU_RAMEND
  * @brief End of all SRAM (registers, io, and internal).
  */
 #define AVR_MCU_RAMEND (AVR_MCU_DATA_SIZE - 1)
 
+/**
+ * @def AVR_TIMING_SUB_BITS
+ * @brief Bits of a value AVR_Timing keeps below its highest set bit, buckets are within 1/16 of the values in them.
+ */
+#define AVR_TIMING_SUB_BITS 4
+
+/**
+ * @def AVR_TIMING_BITS
+ * @brief Bits of the largest value AVR_Timing tells apart, larger values are counted in the last bucket.
+ */
+#define AVR_TIMING_BITS 40
+
+/**
+ * @def AVR_TIMING_BUCKETS
+ * @brief Buckets of an AVR_Timing histogram.
+ */
+#define AVR_TIMING_BUCKETS ((AVR_TIMING_BITS - AVR_TIMING_SUB_BITS + 1) << AVR_TIMING_SUB_BITS)
+
 /**
  * @brief Result type for avr_* functions.
  *
@@ -192,6 +234,263 @@ typedef enum AVR_Result {
     AVR_ERROR = 1,
 } AVR_Result;
 
+/**
+ * @brief Reason avr_run returned.
+ */
+typedef enum AVR_Exit {
+    /** @brief Cycle budget was used up. */
+    AVR_EXIT_BUDGET = 0,
+
+    /** @brief A break instruction was executed. */
+    AVR_EXIT_BREAK = 1,
+
+    /** @brief A sleep instruction was executed. */
+    AVR_EXIT_SLEEP = 2,
+
+    /** @brief USART TXC0 went from clear to set or a PINx, DDRx, PORTx, or CLKPR register changed. */
+    AVR_EXIT_IO = 3,
+} AVR_Exit;
+
+/**
+ * @brief Predecoded instruction, one for every word of flash.
+ *
+ * Operands are unpacked once when flash is written so execution is a single indexed load and dispatch.
+ */
+typedef struct AVR_Instr {
+    /** @brief Handler id. */
+    uint8_t op;
+
+    /** @brief Instruction length in words. */
+    uint8_t len;
+
+    /** @brief First operand of the handler (Rd, A, s, or q). */
+    uint8_t d;
+
+    /** @brief Second operand of the handler (Rr, K, A, b, or k of a conditional branch). */
+    uint8_t r;
+
+    /** @brief 16 bit constant address of jumps, calls, lds, and sts. */
+    uint16_t k;
+
+    /** @brief Fused sequence starting at this instruction, zero if none. */
+    uint8_t fused;
+
+    /** @brief Number of instructions in the fused sequence. */
+    uint8_t run;
+} AVR_Instr;
+
+/**
+ * @brief Straight-line run of instructions that never touch peripherals.
+ *
+ * A block runs back to back when no timer tick or interrupt can land inside it, peripherals are then clocked once for
+ * its summed cycles. A branch, jump, call, return, or skip ending the block runs with it, and the block it lands on
+ * is chained to directly.
+ */
+typedef struct AVR_Block {
+    /** @brief Number of instructions, zero if the instruction at this address must be stepped. */
+    uint8_t count;
+
+    /** @brief Summed cycle cost of the instructions. */
+    uint8_t cycles;
+
+    /** @brief Cycles plus the worst case of the control flow instruction ending the block, if it has one. */
+    uint8_t span;
+
+    /** @brief Runtime routine entered at this address that avr_run runs natively, zero if none. */
+    uint8_t hle;
+
+    /** @brief Countdown loop starting at this address that avr_run runs in closed form, zero if none. */
+    uint8_t delay;
+
+    /** @brief Target of a backward branch, avr_run checks whether the loop starting here idles. */
+    uint8_t head;
+
+    /** @brief Times avr_run interpreted the block, stops counting at AVR_JIT_HOT. */
+    uint8_t heat;
+} AVR_Block;
+
+/**
+ * @brief Arithmetic flags of the last flag setting instruction, not yet written to the status register.
+ *
+ * ALU instructions record their operands and result here instead of computing H, S, V, N, Z, and C, the flags are
+ * written to sreg only when something reads it: branches, carry or zero consuming instructions, data space accesses of
+ * SREG, and returning to the host. T and I are always up to date in sreg.
+ */
+typedef struct AVR_Flags {
+    /** @brief Kind of instruction that set the flags, zero if sreg is up to date. */
+    uint8_t kind;
+
+    /** @brief First operand, or carry out of a multiply. */
+    uint8_t rd;
+
+    /** @brief Second operand. */
+    uint8_t rr;
+
+    /** @brief Result. */
+    uint8_t r;
+
+    /** @brief Zero flag carried into sbc, sbci, and cpc, one for every other instruction. */
+    uint8_t z;
+
+    /** @brief Word operand of adiw and sbiw. */
+    uint16_t wd;
+
+    /** @brief Word result of adiw, sbiw, and multiplies. */
+    uint16_t w;
+} AVR_Flags;
+
+/**
+ * @brief Loops avr_run is checking for idling.
+ *
+ * A loop idles when two passes through its head leave registers and data memory as they were, without touching a
+ * register timers update or taking an interrupt. Every further pass then only advances the clock. Registers are
+ * recorded per head so nested loops do not evict each other, data memory only for the last head whose pass left
+ * registers unchanged.
+ */
+typedef struct AVR_Idle {
+    /** @brief Loop head recorded in each slot, a head uses slot pc % AVR_IDLE_HEADS, AVR_IDLE_NONE if empty. */
+    uint16_t pc[AVR_IDLE_HEADS];
+
+    /** @brief AVR_MCU observed when each head was last passed. */
+    uint32_t observed[AVR_IDLE_HEADS];
+
+    /** @brief Cycles into the avr_run call when each head was last passed. */
+    uint64_t at[AVR_IDLE_HEADS];
+
+    /** @brief Registers when each head was last passed. */
+    uint8_t reg[AVR_IDLE_HEADS][AVR_MCU_IO_REG_OFFSET];
+
+    /** @brief Head data is recorded for, AVR_IDLE_NONE if none. */
+    uint16_t recorded;
+
+    /** @brief Data memory when the recorded head was last passed. */
+    uint8_t data[AVR_MCU_DATA_SIZE];
+} AVR_Idle;
+
+/**
+ * @brief Peripheral events, one of each kind can be pending.
+ */
+typedef enum AVR_Event {
+    /** @brief A timer sets a flag, drives a pin, or turns around. */
+    AVR_EVENT_TIMER = 0,
+
+#ifdef AVR_TEST_EVENTS
+    /** @brief Kinds only the tests schedule, so the heap holds more than one event. */
+    AVR_EVENT_TEST_A,
+    AVR_EVENT_TEST_B,
+    AVR_EVENT_TEST_C,
+    AVR_EVENT_TEST_D,
+#endif
+
+    /** @brief Number of event kinds. */
+    AVR_EVENT_COUNT,
+} AVR_Event;
+
+/**
+ * @brief Pending peripheral events, a binary min-heap keyed on the cycle each is due.
+ *
+ * Peripherals schedule the cycle they next do more than count instead of being clocked every cycle, avr_run runs
+ * between events without clocking them and brings them up to each event in closed form.
+ */
+typedef struct AVR_Schedule {
+    /** @brief Clock on AVR_MCU clk each event is due, by AVR_Event. */
+    uint64_t at[AVR_EVENT_COUNT];
+
+    /** @brief Pending events, heap[0] is due first. */
+    uint8_t heap[AVR_EVENT_COUNT];
+
+    /** @brief Index of each event in heap, AVR_EVENT_COUNT if not pending. */
+    uint8_t pos[AVR_EVENT_COUNT];
+
+    /** @brief Number of pending events. */
+    uint8_t count;
+} AVR_Schedule;
+
+/**
+ * @brief General purpose IO port.
+ */
+typedef enum AVR_Port {
+    /** @brief PB0 - PB7. */
+    AVR_PORT_B = 0,
+
+    /** @brief PC0 - PC6. */
+    AVR_PORT_C = 1,
+
+    /** @brief PD0 - PD7. */
+    AVR_PORT_D = 2,
+} AVR_Port;
+
+/**
+ * @brief Mode of a pin set by its DDRx and PORTx bits.
+ */
+typedef enum AVR_PinMode {
+    /** @brief DDRx and PORTx bits clear. */
+    AVR_PIN_INPUT = 0,
+
+    /** @brief DDRx bit clear, PORTx bit set. */
+    AVR_PIN_INPUT_PULLUP = 1,
+
+    /** @brief DDRx bit set. */
+    AVR_PIN_OUTPUT = 2,
+} AVR_PinMode;
+
+/**
+ * @brief Host callbacks, fired from inside avr_run and friends only when the program or a peripheral changes the state
+ * they report, NULL members are skipped.
+ *
+ * Hosts that mirror pins or the USART can rely on these instead of comparing registers after every instruction.
+ */
+typedef struct AVR_Callbacks {
+    /** @brief A PORTx register changed, by a store or a timer driving a compare output pin. */
+    void (*port)(void *user, AVR_Port port, uint8_t old, uint8_t val);
+
+    /** @brief A DDRx register changed. */
+    void (*ddr)(void *user, AVR_Port port, uint8_t old, uint8_t val);
+
+    /** @brief A pin changed mode, bit is its bit in the port. */
+    void (*pin_mode)(void *user, AVR_Port port, uint8_t bit, AVR_PinMode mode);
+
+    /** @brief The program wrote a byte to UDR0 for the USART to send. */
+    void (*uart_tx)(void *user, uint8_t byte);
+
+    /** @brief Passed to every callback. */
+    void *user;
+} AVR_Callbacks;
+
+/**
+ * @brief Pacing accuracy of a host running the MCU against wall time, recorded once per quantum of cycles.
+ *
+ * Errors are kept in a log linear histogram, exact below 2^AVR_TIMING_SUB_BITS and within 1/16 above, so recording
+ * costs a bit scan and an increment however long the run. Zero initialize before the first avr_timing_record.
+ */
+typedef struct AVR_Timing {
+    /** @brief Quanta recorded. */
+    uint64_t quanta;
+
+    /** @brief Quanta whose cycles finished running after their deadline. */
+    uint64_t missed;
+
+    /** @brief Longest a quantum's cycles finished running after its deadline in ns. */
+    int64_t overrun;
+
+    /** @brief Emulated time behind wall time in ns, negative when ahead, set by the host. */
+    int64_t drift;
+
+    /** @brief Counts of the absolute difference between the end of each quantum and its deadline in ns. */
+    uint64_t error[AVR_TIMING_BUCKETS];
+} AVR_Timing;
+
+/**
+ * @brief Natively compiled block, runs the block starting at pc, then the compiled blocks it leads to that end by clk
+ * end.
+ *
+ * Generated by avr-pi-aot, see AVR_Block. Advances clk after every instruction so timers read in the block are current.
+ * Blocks it leads to are called directly and only when avr_run would have run them next, never a loop head, runtime
+ * routine, or delay loop.
+ */
+struct AVR_MCU;
+typedef void (*AVR_Native)(struct AVR_MCU *restrict mcu, uint64_t end);
+
 /**
  * @brief AVR Microcontroller.
  */
@@ -199,15 +498,60 @@ typedef struct AVR_MCU {
     /** @brief PMW invert. */
     bool pwm_invert;
 
-    /** @brief System clock. */
-    uint16_t clk;
+    /** @brief System clock, cycles clocked since initialization, see avr_ns. */
+    uint64_t clk;
+
+    /** @brief Frequency of the clock source in Hz, divided by the CLKPR prescaler into the system clock. */
+    uint32_t osc_hz;
+
+    /** @brief Clock the system clock last changed at. */
+    uint64_t ns_clk;
+
+    /** @brief Emulated time at ns_clk in ns. */
+    uint64_t ns;
+
+    /** @brief Clock up to which CLKPR takes a new prescaler, set by writing CLKPCE. */
+    uint64_t clkpce;
+
+    /** @brief Clock peripherals were last brought up to, TCNT registers are only current at this clock. */
+    uint64_t sched_clk;
+
+    /** @brief Cycles after sched_clk until the first pending event, zero if the timers' next event is unknown. */
+    uint16_t sched_due;
+
+    /** @brief Clock the prescaler shared by timers 0 and 1 was last reset at through GTCCR PSRSYNC. */
+    uint64_t psr_sync;
+
+    /** @brief Clock the prescaler of timer 2 was last reset at through GTCCR PSRASY. */
+    uint64_t psr_async;
+
+    /** @brief Pending peripheral events. */
+    AVR_Schedule schedule;
 
     /** @brief Program counter. */
     uint16_t pc;
 
+    /** @brief Cycles avr_run has yet to clock for the last executed instruction. */
+    uint8_t stall;
+
+    /** @brief SMCR sleep mode and enable bits while the mcu sleeps, zero while awake. */
+    uint8_t sleep;
+
     /** @brief Status Register. */
     uint8_t *sreg;
 
+    /** @brief Flags not yet written to sreg. */
+    AVR_Flags flags;
+
+    /** @brief Vectors with both their flag and enable bits set, bit n for vector n, bit 31 if not worked out yet. */
+    uint32_t irq;
+
+    /** @brief Interrupts taken plus loads and stores of registers timers update, see AVR_Idle. */
+    uint32_t observed;
+
+    /** @brief Loops avr_run is checking for idling, reset on every call. */
+    AVR_Idle idle;
+
     /** @brief Stack pointer. */
     uint16_t *sp;
 
@@ -229,10 +573,52 @@ typedef struct AVR_MCU {
     /** @brief Flash memory. */
     uint16_t flash[AVR_MCU_FLASH_SIZE / sizeof(uint16_t)];
 
+    /** @brief Predecoded flash, kept in sync with flash by avr_program and spm. */
+    AVR_Instr decoded[AVR_MCU_FLASH_SIZE / sizeof(uint16_t)];
+
+    /** @brief Block starting at every word of flash, relinked whenever decoded changes. */
+    AVR_Block blocks[AVR_MCU_FLASH_SIZE / sizeof(uint16_t)];
+
+    /** @brief Number of fused sequences found in the program. */
+    uint16_t fused_sites;
+
+    /** @brief Number of runtime routines found in the program. */
+    uint16_t hle_sites;
+
+    /** @brief Number of delay loops found in the program. */
+    uint16_t delay_sites;
+
+    /** @brief Number of blocks that reached AVR_JIT_HOT, a host compiles them with avr-pi-aot as this grows. */
+    uint16_t hot_blocks;
+
+    /** @brief Natively compiled blocks by address, NULL entries are interpreted, cleared when flash changes. */
+    const AVR_Native *native;
+
     /** @brief EEPROM memory. */
     uint8_t eeprom[AVR_MCU_EEPROM_SIZE];
+
+    /** @brief Host callbacks, see avr_set_callbacks. */
+    AVR_Callbacks callbacks;
 } AVR_MCU;
 
+/**
+ * @brief Build an avr-pi-aot shared object was compiled against, exported as avr_aot_stamp.
+ *
+ * Blocks in the shared object hold offsets into AVR_MCU and AVR_Instr of that build, so it is only attached when its
+ * stamp matches AVR_AOT_STAMP. The version comes first so stamps of any other layout mismatch on it.
+ */
+typedef struct AVR_AotStamp {
+    char version[16];
+    uint32_t mcu;
+    uint32_t instr;
+} AVR_AotStamp;
+
+/**
+ * @def AVR_AOT_STAMP
+ * @brief Initializer of the AVR_AotStamp of this build.
+ */
+#define AVR_AOT_STAMP {AVR_VERSION, sizeof(AVR_MCU), sizeof(AVR_Instr)}
+
 /**
  * @brief Initialize the memory inside of MCU, MUST be called on creatation.
  *
@@ -244,6 +630,77 @@ typedef struct AVR_MCU {
  */
 void avr_mcu_init(AVR_MCU *restrict mcu);
 
+/**
+ * @brief Cycles a sleeping MCU stays asleep at least.
+ *
+ * The MCU wakes no sooner than the next peripheral event, a real time host can block for this many cycles before
+ * running them with avr_run, or for less if it raises an interrupt itself.
+ *
+ * @param mcu Microcontroller Emulator
+ * @return Cycles until the next event that may wake the MCU, zero if it is awake or wakes on the next cycle
+ */
+uint64_t avr_sleep_cycles(AVR_MCU *restrict mcu);
+
+/**
+ * @brief Set the frequency of the clock source, AVR_MCU_CLK_SPEED after avr_mcu_init.
+ *
+ * Emulated time up to now is kept, the cycles from now on take the time of the new frequency divided by the CLKPR
+ * prescaler. Frequencies below 256 Hz are raised to 256 Hz, so the system clock is at least 1 Hz at every prescaler.
+ *
+ * @param mcu Microcontroller Emulator
+ * @param hz Clock source frequency in Hz, at least 256
+ */
+void avr_set_clock(AVR_MCU *restrict mcu, uint32_t hz);
+
+/**
+ * @brief System clock the MCU runs at, the clock source divided by the prescaler the program sets in CLKPR.
+ *
+ * Timers count cycles of the system clock, so they follow a change of it without being told.
+ *
+ * @param mcu Microcontroller Emulator
+ * @return System clock in Hz
+ */
+uint32_t avr_clock(const AVR_MCU *restrict mcu);
+
+/**
+ * @brief Emulated time since initialization, each cycle counted at the system clock it ran at.
+ *
+ * @param mcu Microcontroller Emulator
+ * @return Emulated time in ns, rounded down
+ */
+uint64_t avr_ns(const AVR_MCU *restrict mcu);
+
+/**
+ * @brief Emulated time cycles take at the current system clock.
+ *
+ * @param mcu Microcontroller Emulator
+ * @param cycles Cycles of the system clock
+ * @return Emulated time in ns, rounded down
+ */
+uint64_t avr_cycles_to_ns(const AVR_MCU *restrict mcu, uint64_t cycles);
+
+/**
+ * @brief Cycles clocked in an emulated time at the current system clock, the inverse of avr_cycles_to_ns.
+ *
+ * @param mcu Microcontroller Emulator
+ * @param ns Emulated time in ns
+ * @return Cycles of the system clock, rounded down
+ */
+uint64_t avr_ns_to_cycles(const AVR_MCU *restrict mcu, uint64_t ns);
+
+/**
+ * @brief Set the callbacks fired when the MCU changes state the host mirrors.
+ *
+ * Replaces any callbacks set before, pass NULL to clear them. Callbacks run inside avr_run, avr_execute, and
+ * avr_cycle, they may read the MCU but must not run or modify it. SREG and the timer counters are brought up to date
+ * before a callback runs, a timer driving a compare output pin calls back from its tick, before the timers after it
+ * have ticked that cycle.
+ *
+ * @param mcu Microcontroller Emulator
+ * @param callbacks Callbacks to copy, may be NULL
+ */
+void avr_set_callbacks(AVR_MCU *restrict mcu, const AVR_Callbacks *restrict callbacks);
+
 /**
  * @brief Program the MCU with a AVR hex file compiled using arduino-cli.
  *
@@ -280,10 +737,61 @@ int avr_interrupt(AVR_MCU *restrict mcu);
 /**
  * @brief Cycle the CPU clock one time.
  *
+ * Timers are brought up to date, TCNT registers included.
+ *
  * @param mcu Microcontroller Emulator
  */
 void avr_cycle(AVR_MCU *restrict mcu);
 
+/**
+ * @brief Run instructions, peripherals, and interrupts for up to budget cycles.
+ *
+ * Equivalent to calling avr_execute followed by avr_cycle and avr_interrupt for every cycle the instruction takes,
+ * without the per cycle calls. Returns early right after executing an instruction that needs the host, before its
+ * cycles are clocked, the remaining cycles are clocked by the next call.
+ *
+ * Peripherals are advanced in closed form from one scheduled event to the next, see AVR_Schedule, TCNT registers are
+ * brought up to date when the program accesses them and before returning.
+ *
+ * A sleep instruction with SE set in SMCR puts the MCU to sleep, instructions stop and the timers whose clocks the
+ * mode keeps running are advanced from one event to the next until an interrupt the mode wakes on is pending.
+ *
+ * Once a loop idles, see AVR_Idle, its passes are skipped up to the budget or the pass before a timer raises an
+ * interrupt flag.
+ *
+ * @param mcu Microcontroller Emulator
+ * @param budget Maximum number of cycles to run
+ * @param cycles Number of cycles run, may be NULL
+ * @return Reason for returning
+ */
+AVR_Exit avr_run(AVR_MCU *restrict mcu, uint64_t budget, uint64_t *restrict cycles);
+
+/**
+ * @brief Record the pacing of one quantum.
+ *
+ * @param timing Pacing accuracy
+ * @param overrun Wall time the quantum's cycles finished running at minus its deadline in ns
+ * @param error Wall time the quantum ended at, once the host waited for its deadline, minus the deadline in ns
+ */
+void avr_timing_record(AVR_Timing *restrict timing, int64_t overrun, int64_t error);
+
+/**
+ * @brief Largest error counted in a bucket of AVR_Timing.
+ *
+ * @param bucket Bucket of AVR_Timing::error
+ * @return Upper bound of the bucket in ns
+ */
+uint64_t avr_timing_value(uint32_t bucket);
+
+/**
+ * @brief Error no more than a percentile of the recorded quanta exceed.
+ *
+ * @param timing Pacing accuracy
+ * @param percentile Percentile from 0 to 100
+ * @return Upper bound in ns of the bucket the percentile falls in, zero if nothing was recorded
+ */
+uint64_t avr_timing_percentile(const AVR_Timing *restrict timing, double percentile);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,543 @@
+/**
+ * avr-pi
+ * Copyright (C) 2024 Jonathan Forhan <jonathan.forhan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// avr-pi-aot, ahead of time compiler of AVR hex programs.
+//
+// Control flow is walked from the interrupt vectors and every block that can be entered (see AVR_Block) is emitted
+// as a C function calling the same handlers as avr.c with constant operands. A block calls the blocks its control flow
+// leads to directly, see AVR_Native. The source is compiled into a shared object exporting avr_aot_attach, which the
+// avr-pi cli loads to run those blocks natively. Anything not reached, indirect jump targets, and return addresses of
+// interrupts are still interpreted.
+//
+// Given block addresses only those blocks are compiled, avr-pi --jit passes the blocks that became hot.
+//
+// usage: avr-pi-aot {file}.hex {file}.so [{pc}...]
+//
+// The generated source includes avr.c, so it is compiled against the source and build tree avr-pi-aot was built from,
+// at the absolute paths CMake baked in. Those must still exist, and the shared object is only attached by an avr-pi
+// built from the same tree, see AVR_AotStamp.
+
+#define _POSIX_C_SOURCE 200809L // fork, waitpid
+
+#include <avr.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define sleep posix_sleep // avr.c has a handler of that name
+#include <unistd.h>
+#undef sleep
+
+#include "avr.c" // NOLINT(bugprone-suspicious-include)
+
+#define MAX_PATH 260
+#define WORDS    (AVR_MCU_FLASH_SIZE / 2)
+
+#ifndef AVR_AOT_CC
+#define AVR_AOT_CC "cc"
+#endif
+
+// public, private, and generated include directories of the tree the generated source is compiled against
+#ifndef AVR_AOT_PUB_INC
+#define AVR_AOT_PUB_INC "include"
+#endif
+
+#ifndef AVR_AOT_PRIV_INC
+#define AVR_AOT_PRIV_INC "src"
+#endif
+
+#ifndef AVR_AOT_GEN_INC
+#define AVR_AOT_GEN_INC "build/gen"
+#endif
+
+static AVR_MCU mcu;
+static bool reached[WORDS]; // instruction is reachable from a vector
+static bool entry[WORDS];   // a block can start here at runtime
+static u16 pending[WORDS];  // addresses left to walk
+
+// read a whole file into a NULL terminated buffer
+static char *read_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        LOG_ERROR("could not read file %s", path);
+        return NULL;
+    }
+
+    (void)fseek(f, 0, SEEK_END);
+    const long size = ftell(f);
+    (void)fseek(f, 0, SEEK_SET);
+
+    char *buf = size > 0 ? malloc(size + 1) : NULL; // +1 NULL byte
+    if (buf == NULL || fread(buf, 1, size, f) != (size_t)size) {
+        LOG_ERROR("could not read file %s", path);
+        free(buf);
+        (void)fclose(f);
+        return NULL;
+    }
+    buf[size] = '\0';
+
+    (void)fclose(f);
+    return buf;
+}
+
+// mark pc as a block entry and queue it to be walked
+static void branch_to(u32 pc, u32 *n) {
+    pc %= WORDS;
+    entry[pc] = true;
+
+    if (!reached[pc]) {
+        pending[(*n)++] = pc;
+    }
+}
+
+// walk every instruction reachable from the interrupt vectors
+static void walk(void) {
+    u32 n = 0;
+
+    for (u16 iv = IV_RESET; iv <= IV_SPM_READY; iv += 2) {
+        branch_to(iv, &n);
+    }
+
+    while (n) {
+        u32 pc = pending[--n];
+
+        while (!reached[pc]) {
+            const AVR_Instr *const instr = &mcu.decoded[pc];
+            const u32 next               = (pc + instr->len) % WORDS;
+
+            reached[pc] = true;
+
+            // a block starts after every instruction that is stepped
+            if (block_cycles(instr) == 0) {
+                entry[next] = true;
+            }
+
+            switch (instr->op) {
+            case OP_ID_RJMP:
+                branch_to(pc + 1 + (i16)instr->k, &n);
+                break;
+            case OP_ID_JMP:
+                branch_to(instr->k, &n);
+                break;
+            case OP_ID_RCALL:
+                branch_to(pc + 1 + (i16)instr->k, &n);
+                pc = next;
+                continue;
+            case OP_ID_CALL:
+                branch_to(instr->k, &n);
+                pc = next;
+                continue;
+            case OP_ID_BRBC:
+            case OP_ID_BRBS:
+                branch_to(pc + 1 + (i8)instr->r, &n);
+                pc = next;
+                continue;
+            case OP_ID_CPSE:
+            case OP_ID_SBRC:
+            case OP_ID_SBRS:
+            case OP_ID_SBIC:
+            case OP_ID_SBIS:
+                branch_to(next + mcu.decoded[next].len, &n);
+                pc = next;
+                continue;
+            case OP_ID_RET:
+            case OP_ID_RETI:
+            case OP_ID_IJMP:
+            case OP_ID_UNKNOWN:
+                break;
+            default:
+                pc = next;
+                continue;
+            }
+
+            break;
+        }
+    }
+}
+
+// emit a handler call for an instruction that can be part of a block
+static bool emit_call(FILE *f, const AVR_Instr *instr) {
+    switch (instr->op) {
+    case OP_ID_SUBI:
+        return fprintf(f, "subi(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_SBCI:
+        return fprintf(f, "sbci(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_ANDI:
+        return fprintf(f, "andi(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_ORI:
+        return fprintf(f, "ori(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_CPI:
+        return fprintf(f, "cpi(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_LDI:
+        return fprintf(f, "ldi(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_ADD:
+        return fprintf(f, "add(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_ADC:
+        return fprintf(f, "adc(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_SUB:
+        return fprintf(f, "sub(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_SBC:
+        return fprintf(f, "sbc(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_AND:
+        return fprintf(f, "and(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_OR:
+        return fprintf(f, "or(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_EOR:
+        return fprintf(f, "eor(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_CP:
+        return fprintf(f, "cp(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_CPC:
+        return fprintf(f, "cpc(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_MOV:
+        return fprintf(f, "mov(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_MOVW:
+        return fprintf(f, "movw(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_MUL:
+        return fprintf(f, "mul(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_MULS:
+        return fprintf(f, "muls(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_MULSU:
+        return fprintf(f, "mulsu(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_FMUL:
+        return fprintf(f, "fmul(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_FMULS:
+        return fprintf(f, "fmuls(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_FMULSU:
+        return fprintf(f, "fmulsu(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_ADIW:
+        return fprintf(f, "adiw(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_SBIW:
+        return fprintf(f, "sbiw(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_BST:
+        return fprintf(f, "bst(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_BLD:
+        return fprintf(f, "bld(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_IN:
+        return fprintf(f, "in(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_OUT:
+        return fprintf(f, "out(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_COM:
+        return fprintf(f, "com(mcu, %u)", instr->d) > 0;
+    case OP_ID_NEG:
+        return fprintf(f, "neg(mcu, %u)", instr->d) > 0;
+    case OP_ID_INC:
+        return fprintf(f, "inc(mcu, %u)", instr->d) > 0;
+    case OP_ID_DEC:
+        return fprintf(f, "dec(mcu, %u)", instr->d) > 0;
+    case OP_ID_LSR:
+        return fprintf(f, "lsr(mcu, %u)", instr->d) > 0;
+    case OP_ID_ROR:
+        return fprintf(f, "ror(mcu, %u)", instr->d) > 0;
+    case OP_ID_ASR:
+        return fprintf(f, "asr(mcu, %u)", instr->d) > 0;
+    case OP_ID_SWAP:
+        return fprintf(f, "swap(mcu, %u)", instr->d) > 0;
+    case OP_ID_SER:
+        return fprintf(f, "ser(mcu, %u)", instr->d) > 0;
+    case OP_ID_BSET:
+        return fprintf(f, "bset(mcu, %u)", instr->d) > 0;
+    case OP_ID_BCLR:
+        return fprintf(f, "bclr(mcu, %u)", instr->d) > 0;
+    case OP_ID_PUSH:
+        return fprintf(f, "push(mcu, %u)", instr->d) > 0;
+    case OP_ID_POP:
+        return fprintf(f, "pop(mcu, %u)", instr->d) > 0;
+    case OP_ID_LPM:
+        return fprintf(f, "lpm(mcu, %u)", instr->d) > 0;
+    case OP_ID_LPM_POSTINC:
+        return fprintf(f, "lpm_postinc(mcu, %u)", instr->d) > 0;
+    case OP_ID_LPM_R0:
+        return fprintf(f, "lpm(mcu, 0)") > 0;
+    case OP_ID_LDS:
+        return fprintf(f, "lds(mcu, %u, %#x)", instr->d, instr->k) > 0;
+    case OP_ID_STS:
+        return fprintf(f, "sts(mcu, %#x, %u)", instr->k, instr->d) > 0;
+    case OP_ID_NOP:
+        return fprintf(f, "nop(mcu)") > 0;
+    case OP_ID_WDR:
+        return fprintf(f, "wdr(mcu)") > 0;
+    case OP_ID_RJMP:
+        return fprintf(f, "rjmp(mcu, %d)", (i16)instr->k) > 0;
+    case OP_ID_JMP:
+        return fprintf(f, "jmp(mcu, %#x)", instr->k) > 0;
+    case OP_ID_RCALL:
+        return fprintf(f, "rcall(mcu, %d)", (i16)instr->k) > 0;
+    case OP_ID_CALL:
+        return fprintf(f, "call(mcu, %#x)", instr->k) > 0;
+    case OP_ID_IJMP:
+        return fprintf(f, "ijmp(mcu)") > 0;
+    case OP_ID_ICALL:
+        return fprintf(f, "icall(mcu)") > 0;
+    case OP_ID_RET:
+        return fprintf(f, "ret(mcu)") > 0;
+    case OP_ID_BRBC:
+        return fprintf(f, "brbc(mcu, %u, %d)", instr->d, (i8)instr->r) > 0;
+    case OP_ID_BRBS:
+        return fprintf(f, "brbs(mcu, %u, %d)", instr->d, (i8)instr->r) > 0;
+    case OP_ID_CPSE:
+        return fprintf(f, "cpse(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_SBRC:
+        return fprintf(f, "sbrc(mcu, %u, %u)", instr->d, instr->r) > 0;
+    case OP_ID_SBRS:
+        return fprintf(f, "sbrs(mcu, %u, %u)", instr->d, instr->r) > 0;
+    default:
+        LOG_ERROR("op %u can not be part of a block", instr->op);
+        return false;
+    }
+}
+
+// a block is compiled for pc
+static inline bool compiled(u32 pc) {
+    return reached[pc] && entry[pc] && mcu.blocks[pc].span;
+}
+
+// addresses the block at pc can be followed by, at most two, returns how many, none when only runtime knows
+static u32 successors(u32 pc, u32 next[2]) {
+    const AVR_Block *const block = &mcu.blocks[pc];
+
+    u32 at = pc;
+    for (u32 i = 0; i < block->count; i++) {
+        at += mcu.decoded[at].len;
+    }
+    at %= WORDS;
+
+    // ended by an instruction that is stepped
+    if (block->span == block->cycles) {
+        next[0] = at;
+        return 1;
+    }
+
+    const AVR_Instr *const instr = &mcu.decoded[at];
+    const u32 after              = (at + instr->len) % WORDS;
+
+    switch (instr->op) {
+    case OP_ID_RJMP:
+    case OP_ID_RCALL:
+        next[0] = (at + 1 + (i16)instr->k) % WORDS;
+        return 1;
+    case OP_ID_JMP:
+    case OP_ID_CALL:
+        next[0] = instr->k % WORDS;
+        return 1;
+    case OP_ID_BRBC:
+    case OP_ID_BRBS:
+        next[0] = (at + 1 + (i8)instr->r) % WORDS;
+        next[1] = after;
+        return 2;
+    case OP_ID_CPSE:
+    case OP_ID_SBRC:
+    case OP_ID_SBRS:
+        next[0] = after;
+        next[1] = (after + mcu.decoded[after].len) % WORDS;
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+// emit one function per block entry, a table of them by address, and the attach function
+static AVR_Result emit(FILE *f, const char *hex, u32 *count) {
+    fprintf(f, "// generated by avr-pi-aot from %s, do not edit\n\n", hex);
+    fprintf(f, "#include <avr.c> // NOLINT(bugprone-suspicious-include)\n\n");
+
+    // blocks call each other in any order
+    for (u32 pc = 0; pc < WORDS; pc++) {
+        if (compiled(pc)) {
+            fprintf(f, "static void block_%04x(AVR_MCU *restrict mcu, u64 end);\n", pc);
+        }
+    }
+    fprintf(f, "\n");
+
+    *count = 0;
+
+    for (u32 pc = 0; pc < WORDS; pc++) {
+        const AVR_Block *const block = &mcu.blocks[pc];
+        if (!compiled(pc)) {
+            continue;
+        }
+
+        fprintf(f, "static void block_%04x(AVR_MCU *restrict mcu, u64 end) {\n", pc);
+
+        // instructions of the block plus the control flow ending it
+        const u32 n = block->count + (block->span != block->cycles ? 1u : 0u);
+
+        u32 at = pc;
+        for (u32 i = 0; i < n; i++) {
+            const AVR_Instr *const instr = &mcu.decoded[at];
+
+            fprintf(f, "    mcu->clk += ");
+            if (!emit_call(f, instr)) {
+                return AVR_ERROR;
+            }
+            fprintf(f, ";\n");
+
+            at += instr->len;
+        }
+
+        // avr_run checks loop heads, runs runtime routines natively, and delay loops in closed form, so only plain
+        // blocks are chained to, as a tail call
+        u32 next[2];
+        const u32 n_next = successors(pc, next);
+
+        for (u32 i = 0; i < n_next; i++) {
+            const AVR_Block *const to = &mcu.blocks[next[i]];
+            if (!compiled(next[i]) || to->head || to->hle || to->delay) {
+                continue;
+            }
+
+            fprintf(f,
+                    "    if (mcu->pc == %#x && mcu->clk + %u <= end) {\n"
+                    "        block_%04x(mcu, end);\n"
+                    "        return;\n"
+                    "    }\n",
+                    next[i], to->span, next[i]);
+        }
+
+        fprintf(f, "}\n\n");
+        *count += 1;
+    }
+
+    fprintf(f, "static const AVR_Native blocks[AVR_MCU_FLASH_SIZE / 2] = {\n");
+    for (u32 pc = 0; pc < WORDS; pc++) {
+        if (compiled(pc)) {
+            fprintf(f, "    [%#06x] = block_%04x,\n", pc, pc);
+        }
+    }
+    fprintf(f, "};\n\n");
+
+    // flash the blocks were compiled from, trailing erased words are left to zero initialization
+    u32 end = WORDS;
+    while (end && mcu.flash[end - 1] == 0) {
+        end -= 1;
+    }
+
+    fprintf(f, "static const uint16_t flash[AVR_MCU_FLASH_SIZE / 2] = {");
+    for (u32 pc = 0; pc < end; pc++) {
+        fprintf(f, "%s%#06x,", pc % 12 ? " " : "\n    ", mcu.flash[pc]);
+    }
+    fprintf(f, "\n};\n\n");
+
+    fprintf(f, "__attribute__((visibility(\"default\"))) const AVR_AotStamp avr_aot_stamp = AVR_AOT_STAMP;\n\n");
+
+    fprintf(f,
+            "__attribute__((visibility(\"default\"))) AVR_Result avr_aot_attach(AVR_MCU *restrict mcu) {\n"
+            "    if (memcmp(mcu->flash, flash, sizeof(flash)) != 0) {\n"
+            "        LOG_ERROR(\"program in flash does not match %s\");\n"
+            "        return AVR_ERROR;\n"
+            "    }\n\n"
+            "    mcu->native = blocks;\n"
+            "    return AVR_OK;\n"
+            "}\n",
+            hex);
+
+    return AVR_OK;
+}
+
+// compile src into the shared object so, arguments are passed to the compiler as they are without a shell
+static AVR_Result compile(const char *so, const char *src) {
+    char *const args[] = {
+        AVR_AOT_CC, "-std=gnu99", "-O2", "-DNDEBUG", "-shared", "-fPIC", "-fvisibility=hidden",
+        "-I" AVR_AOT_PUB_INC, "-I" AVR_AOT_PRIV_INC, "-I" AVR_AOT_GEN_INC, "-o", (char *)so, (char *)src, NULL,
+    };
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+        LOG_ERROR("could not start %s", AVR_AOT_CC);
+        return AVR_ERROR;
+    }
+
+    if (pid == 0) {
+        execvp(args[0], args);
+        LOG_ERROR("could not run %s", AVR_AOT_CC);
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            LOG_ERROR("could not wait for %s", AVR_AOT_CC);
+            return AVR_ERROR;
+        }
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? AVR_OK : AVR_ERROR;
+}
+
+int main(int argc, char *argv[]) {
+    char src[MAX_PATH + 2];
+    u32 count;
+
+    if (argc < 3 || strnlen(argv[2], MAX_PATH) >= MAX_PATH) {
+        LOG_ERROR("usage: %s {file}.hex {file}.so [{pc}...], compiled against the tree at %s", argv[0],
+                  AVR_AOT_PRIV_INC);
+        return EXIT_FAILURE;
+    }
+
+    char *hex = read_file(argv[1]);
+    if (hex == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    avr_mcu_init(&mcu);
+
+    if (avr_program(&mcu, hex) != AVR_OK) {
+        LOG_ERROR("failed to write program to flash");
+        free(hex);
+        return EXIT_FAILURE;
+    }
+    free(hex);
+
+    // the blocks asked for, else every block reachable
+    for (int i = 3; i < argc; i++) {
+        char *end;
+        const unsigned long pc = strtoul(argv[i], &end, 0);
+        if (end == argv[i] || *end != '\0' || pc >= WORDS) {
+            LOG_ERROR("invalid block address %s", argv[i]);
+            return EXIT_FAILURE;
+        }
+        reached[pc] = entry[pc] = true;
+    }
+
+    if (argc == 3) {
+        walk();
+    }
+
+    // source is kept next to the shared object
+    (void)snprintf(src, sizeof(src), "%s.c", argv[2]);
+
+    FILE *f = fopen(src, "w");
+    if (f == NULL) {
+        LOG_ERROR("could not open %s", src);
+        return EXIT_FAILURE;
+    }
+
+    if (emit(f, argv[1], &count) != AVR_OK || fclose(f) != 0) {
+        LOG_ERROR("could not write %s", src);
+        return EXIT_FAILURE;
+    }
+
+    if (compile(argv[2], src) != AVR_OK) {
+        LOG_ERROR("failed to compile %s", src);
+        return EXIT_FAILURE;
+    }
+
+    printf("avr-pi-aot: %u blocks compiled into %s\n", count, argv[2]);
+
+    return EXIT_SUCCESS;
+}
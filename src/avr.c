@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "avr_defs.h"
+#include "avr_optable.h"
 #include "defs.h"
 
 #ifndef NDEBUG
@@ -33,11 +34,436 @@
 #endif
 #endif
 
-// can't (quickly) enforce readonly bits in software
-// so just reset the values each cycle
-static void set_readonly(AVR_MCU *restrict mcu) {
-    mcu->data[REG_UCSR0A] |= 0x20; // 0010 0000
-    mcu->data[REG_UCSR0C] |= 0x06; // 0000 0110
+/*******************************************************************************
+ * Deferred Flags
+ ******************************************************************************/
+
+// write the deferred flags to sreg, must be called before anything reads H, S, V, N, Z, or C
+static inline void sreg_sync(AVR_MCU *restrict mcu) {
+    if (mcu->flags.kind == FLAGS_NONE) {
+        return;
+    }
+
+    const AVR_Flags *f = &mcu->flags;
+    u8 sreg            = *mcu->sreg;
+
+    const u8 Rd3 = GET_BIT(f->rd, 3), Rr3 = GET_BIT(f->rr, 3), R3 = GET_BIT(f->r, 3);
+    const u8 Rd7 = GET_BIT(f->rd, 7), Rr7 = GET_BIT(f->rr, 7), R7 = GET_BIT(f->r, 7);
+    const u8 Rdh7 = GET_BIT(f->wd, 15), R15 = GET_BIT(f->w, 15);
+
+    switch (f->kind) {
+    case FLAGS_ADD:
+        // H = Rd3 & Rr3 | Rr3 & ~R3 | ~R3 & Rd3
+        SET_BIT(sreg, SREG_H, (Rd3 & Rr3) | (Rr3 & ~R3) | (~R3 & Rd3));
+        // V = Rd7 & Rr7 & ~R7 | ~Rd7 & ~Rr7 & R7
+        SET_BIT(sreg, SREG_V, (Rd7 & Rr7 & ~R7) | (~Rd7 & ~Rr7 & R7));
+        // N = R7
+        SET_BIT(sreg, SREG_N, R7);
+        // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
+        SET_BIT(sreg, SREG_Z, f->r == 0);
+        // C = Rd7 & Rr7 | Rr7 & ~R7 | ~R7 & Rd7
+        SET_BIT(sreg, SREG_C, (Rd7 & Rr7) | (Rr7 & ~R7) | (~R7 & Rd7));
+        break;
+    case FLAGS_SUB:
+        // H = ~Rd3 & Rr3 | Rr3 & R3 | R3 & ~Rd3
+        SET_BIT(sreg, SREG_H, (~Rd3 & Rr3) | (Rr3 & R3) | (R3 & ~Rd3));
+        // V = Rd7 & ~Rr7 & ~R7 | ~Rd7 & Rr7 & R7
+        SET_BIT(sreg, SREG_V, (Rd7 & ~Rr7 & ~R7) | (~Rd7 & Rr7 & R7));
+        // N = R7
+        SET_BIT(sreg, SREG_N, R7);
+        // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0 (& Z for sbc, sbci, and cpc)
+        SET_BIT(sreg, SREG_Z, f->r == 0 && f->z);
+        // C = ~Rd7 & Rr7 | Rr7 & R7 | R7 & ~Rd7
+        SET_BIT(sreg, SREG_C, (~Rd7 & Rr7) | (Rr7 & R7) | (R7 & ~Rd7));
+        break;
+    case FLAGS_COM:
+        // C = 1
+        PUT_BIT(sreg, SREG_C);
+        /* fall through */
+    case FLAGS_LOGIC:
+        // V = 0
+        CLR_BIT(sreg, SREG_V);
+        // N = R7
+        SET_BIT(sreg, SREG_N, R7);
+        // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
+        SET_BIT(sreg, SREG_Z, f->r == 0);
+        break;
+    case FLAGS_NEG:
+        // H = R3 & ~Rd3
+        SET_BIT(sreg, SREG_H, R3 & ~Rd3);
+        // V = R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
+        SET_BIT(sreg, SREG_V, f->r == 0x80);
+        // N = R7
+        SET_BIT(sreg, SREG_N, R7);
+        // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
+        SET_BIT(sreg, SREG_Z, f->r == 0);
+        // C = R7 | R6 | R5 | R4 | R3 | R2 | R1 | R0
+        SET_BIT(sreg, SREG_C, f->r != 0);
+        break;
+    case FLAGS_INC:
+    case FLAGS_DEC:
+        // V = ~R7 & R6 & R5 & R4 & R3 & R2 & R1 & R0 (inc), R7 & ~R6 & ... & ~R0 (dec)
+        SET_BIT(sreg, SREG_V, f->r == (f->kind == FLAGS_INC ? 0x80 : 0x7F));
+        // N = R7
+        SET_BIT(sreg, SREG_N, R7);
+        // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
+        SET_BIT(sreg, SREG_Z, f->r == 0);
+        break;
+    case FLAGS_ADIW:
+        // V = ~Rdh7 & R15
+        SET_BIT(sreg, SREG_V, ~Rdh7 & R15);
+        // N = R15
+        SET_BIT(sreg, SREG_N, R15);
+        // Z = ~R15 & ~R14 & ... & ~R0
+        SET_BIT(sreg, SREG_Z, f->w == 0);
+        // C = ~R15 & Rdh7
+        SET_BIT(sreg, SREG_C, ~R15 & Rdh7);
+        break;
+    case FLAGS_SBIW:
+        // V = R15 & ~Rdh7
+        SET_BIT(sreg, SREG_V, R15 & ~Rdh7);
+        // N = R15
+        SET_BIT(sreg, SREG_N, R15);
+        // Z = ~R15 & ~R14 & ... & ~R0
+        SET_BIT(sreg, SREG_Z, f->w == 0);
+        // C = R15 & ~Rdh7
+        SET_BIT(sreg, SREG_C, R15 & ~Rdh7);
+        break;
+    case FLAGS_MUL:
+        // C = R15 (R16 for fractional multiplies)
+        SET_BIT(sreg, SREG_C, f->rd);
+        // Z = ~R15 & ~R14 & ... & ~R0
+        SET_BIT(sreg, SREG_Z, f->w == 0);
+        break;
+    case FLAGS_SHIFT:
+        // N = R7
+        SET_BIT(sreg, SREG_N, R7);
+        // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
+        SET_BIT(sreg, SREG_Z, f->r == 0);
+        // C = Rd0
+        SET_BIT(sreg, SREG_C, GET_BIT(f->rd, 0));
+        // V = N ^ C
+        SET_BIT(sreg, SREG_V, GET_BIT(sreg, SREG_N) ^ GET_BIT(sreg, SREG_C));
+        break;
+    }
+
+    // S = N ^ V, everything but multiplies
+    if (f->kind != FLAGS_MUL) {
+        SET_BIT(sreg, SREG_S, GET_BIT(sreg, SREG_N) ^ GET_BIT(sreg, SREG_V));
+    }
+
+    *mcu->sreg      = sreg;
+    mcu->flags.kind = FLAGS_NONE;
+}
+
+// record the operands and result of a flag setting instruction
+static inline void defer(AVR_MCU *restrict mcu, u8 kind, u8 Rd, u8 Rr, u8 R, u8 Z) {
+    // add, sub, and neg kinds write every deferred flag, the others keep some so earlier flags are written first
+    if (kind != FLAGS_ADD && kind != FLAGS_SUB && kind != FLAGS_NEG) {
+        sreg_sync(mcu);
+    }
+
+    mcu->flags.kind = kind;
+    mcu->flags.rd   = Rd;
+    mcu->flags.rr   = Rr;
+    mcu->flags.r    = R;
+    mcu->flags.z    = Z;
+}
+
+// record the operand and result of a word or multiply instruction, C is the carry out of a multiply
+static inline void defer_word(AVR_MCU *restrict mcu, u8 kind, u16 Rd, u16 R, u8 C) {
+    // H is kept
+    sreg_sync(mcu);
+
+    mcu->flags.kind = kind;
+    mcu->flags.rd   = C;
+    mcu->flags.wd   = Rd;
+    mcu->flags.w    = R;
+}
+
+/*******************************************************************************
+ * IO Register Hooks
+ ******************************************************************************/
+
+static void sched_sync(AVR_MCU *restrict mcu);
+
+// irq bit set when a flag or enable register may have changed, the pending vectors are worked out again before the
+// next interrupt check
+#define IRQ_STALE (1u << 31)
+
+// addresses below this may have a hook, working registers, io, and extended io
+#define IO_HOOK_END AVR_MCU_SRAM_OFFSET
+
+#define NS_PER_S 1000000000ull
+
+// cycles after CLKPCE is written that CLKPR takes a new prescaler, the largest prescaler, a division by 256, and the
+// slowest clock source it still leaves a system clock of 1 Hz from
+#define CLKPCE_CYCLES 4
+#define CLKPS_MAX     8
+#define OSC_HZ_MIN    (1u << CLKPS_MAX)
+
+// whether any timer drives a pin through its compare output, timers leave ports alone otherwise
+static inline bool compare_outputs(const AVR_MCU *restrict mcu) {
+    return (mcu->data[REG_TCCR0A] | mcu->data[REG_TCCR1A] | mcu->data[REG_TCCR2A]) & 0xF0;
+}
+
+// system clock in Hz, the clock source divided by the CLKPR prescaler
+static inline u32 system_clock(const AVR_MCU *restrict mcu) {
+    return mcu->osc_hz >> MSK(mcu->data[REG_CLKPR], 0x0F);
+}
+
+// time cycles take at hz, split at whole seconds so neither product overflows
+static inline u64 cycles_ns(u64 cycles, u32 hz) {
+    const u64 s = cycles / hz;
+    return s * NS_PER_S + (cycles - s * hz) * NS_PER_S / hz;
+}
+
+// emulated time at clk, counted at the system clock since it last changed
+static inline u64 emulated_ns(const AVR_MCU *restrict mcu) {
+    return mcu->ns + cycles_ns(mcu->clk - mcu->ns_clk, system_clock(mcu));
+}
+
+// write the bits of v set in mask
+static inline void io_write(AVR_MCU *restrict mcu, u16 addr, u8 v, u8 mask) {
+    mcu->data[addr] = (mcu->data[addr] & ~mask) | (v & mask);
+}
+
+// the deferred flags are written before sreg is accessed
+static u8 load_sreg(AVR_MCU *restrict mcu, u16 addr) {
+    sreg_sync(mcu);
+    return mcu->data[addr];
+}
+
+static void store_sreg(AVR_MCU *restrict mcu, u16 addr, u8 v, u8 mask) {
+    sreg_sync(mcu);
+    io_write(mcu, addr, v, mask);
+}
+
+static inline AVR_PinMode pin_mode(u8 ddr, u8 port, u8 bit) {
+    return GET_BIT(ddr, bit) ? AVR_PIN_OUTPUT : GET_BIT(port, bit) ? AVR_PIN_INPUT_PULLUP : AVR_PIN_INPUT;
+}
+
+// callbacks may read the mcu, the deferred flags and the timer counters are brought up to date before one runs, from
+// inside a timer tick the counters already are
+static inline void callback_sync(AVR_MCU *restrict mcu) {
+    sreg_sync(mcu);
+    sched_sync(mcu);
+}
+
+// tell the host a port or data direction register changed from old
+static void gpio_notify(AVR_MCU *restrict mcu, u16 addr, u8 old) {
+    const AVR_Callbacks *const cb = &mcu->callbacks;
+    const u8 val                  = mcu->data[addr];
+
+    if (val == old || !(cb->port || cb->ddr || cb->pin_mode)) {
+        return;
+    }
+
+    callback_sync(mcu);
+
+    // pin, ddr, and port registers of each port are consecutive
+    const AVR_Port port = (AVR_Port)((addr - REG_PINB) / 3);
+    const u16 ddr       = REG_DDRB + port * 3;
+    const bool is_ddr   = addr == ddr;
+
+    if (is_ddr && cb->ddr) {
+        cb->ddr(cb->user, port, old, val);
+    } else if (!is_ddr && cb->port) {
+        cb->port(cb->user, port, old, val);
+    }
+
+    if (cb->pin_mode) {
+        const u8 ddr_old  = is_ddr ? old : mcu->data[ddr];
+        const u8 port_old = is_ddr ? mcu->data[ddr + 1] : old;
+
+        for (u8 bit = 0; bit < 8; bit++) {
+            const AVR_PinMode mode = pin_mode(mcu->data[ddr], mcu->data[ddr + 1], bit);
+            if (mode != pin_mode(ddr_old, port_old, bit)) {
+                cb->pin_mode(cb->user, port, bit, mode);
+            }
+        }
+    }
+}
+
+static void store_gpio(AVR_MCU *restrict mcu, u16 addr, u8 v, u8 mask) {
+    const u8 old = mcu->data[addr];
+    io_write(mcu, addr, v, mask);
+    gpio_notify(mcu, addr, old);
+}
+
+// ports are driven by timers while compare outputs are enabled, avr_run counts accesses to them, see AVR_Idle
+static u8 load_port(AVR_MCU *restrict mcu, u16 addr) {
+    if (compare_outputs(mcu)) {
+        mcu->observed += 1;
+    }
+    return mcu->data[addr];
+}
+
+static void store_port(AVR_MCU *restrict mcu, u16 addr, u8 v, u8 mask) {
+    if (compare_outputs(mcu)) {
+        mcu->observed += 1;
+    }
+    store_gpio(mcu, addr, v, mask);
+}
+
+// timer counters are brought up to date before an access, a store changes when the timers are due next
+static u8 load_tcnt(AVR_MCU *restrict mcu, u16 addr) {
+    mcu->observed += 1;
+    sched_sync(mcu);
+    return mcu->data[addr];
+}
+
+static void store_tcnt(AVR_MCU *restrict mcu, u16 addr, u8 v, u8 mask) {
+    mcu->observed += 1;
+    sched_sync(mcu);
+    io_write(mcu, addr, v, mask);
+    mcu->sched_due = 0;
+}
+
+// timer configuration changes when the timers are due next
+static void store_timer(AVR_MCU *restrict mcu, u16 addr, u8 v, u8 mask) {
+    sched_sync(mcu);
+    io_write(mcu, addr, v, mask);
+    mcu->sched_due = 0;
+}
+
+// a prescaler reset restarts the ticks of the timers it clocks, the reset bits clear themselves unless TSM holds them
+static void store_gtccr(AVR_MCU *restrict mcu, u16 addr, u8 v, u8 mask) {
+    mcu->observed += 1;
+    sched_sync(mcu);
+    io_write(mcu, addr, v, mask);
+
+    u8 *const gtccr = &mcu->data[addr];
+    if (GET_BIT(*gtccr, BIT_PSRSYNC)) {
+        mcu->psr_sync = mcu->clk;
+    }
+    if (GET_BIT(*gtccr, BIT_PSRASY)) {
+        mcu->psr_async = mcu->clk;
+    }
+    if (!GET_BIT(*gtccr, BIT_TSM)) {
+        CLR_BIT(*gtccr, BIT_PSRSYNC);
+        CLR_BIT(*gtccr, BIT_PSRASY);
+    }
+    mcu->sched_due = 0;
+}
+
+// the prescaler changes only within CLKPCE_CYCLES of CLKPCE being written alone, emulated time is rebased to the clock
+// it changes at, reads never see CLKPCE
+static void store_clkpr(AVR_MCU *restrict mcu, u16 addr, u8 v, u8 mask) {
+    v = (mcu->data[addr] & ~mask) | (v & mask);
+
+    if (v == (1 << BIT_CLKPCE)) {
+        mcu->clkpce = mcu->clk + CLKPCE_CYCLES;
+    } else if (!GET_BIT(v, BIT_CLKPCE) && mcu->clk < mcu->clkpce) {
+        mcu->ns         = emulated_ns(mcu);
+        mcu->ns_clk     = mcu->clk;
+        mcu->data[addr] = MIN(MSK(v, 0x0F), CLKPS_MAX);
+        mcu->clkpce     = 0;
+    }
+}
+
+// interrupt flag and enable registers change which interrupts are pending
+static void store_irq(AVR_MCU *restrict mcu, u16 addr, u8 v, u8 mask) {
+    io_write(mcu, addr, v, mask);
+    mcu->irq |= IRQ_STALE;
+}
+
+// timer interrupt flags are cleared by writing a one to them
+static void store_tifr(AVR_MCU *restrict mcu, u16 addr, u8 v, u8 mask) {
+    mcu->data[addr] &= ~(v & mask);
+    mcu->irq        |= IRQ_STALE;
+}
+
+// reading the received byte clears its flag
+static u8 load_udr0(AVR_MCU *restrict mcu, u16 addr) {
+    CLR_BIT(mcu->data[REG_UCSR0A], BIT_RXC0);
+    mcu->irq |= IRQ_STALE;
+    return mcu->data[addr];
+}
+
+// writing the byte to send hands it to the host
+static void store_udr0(AVR_MCU *restrict mcu, u16 addr, u8 v, u8 mask) {
+    io_write(mcu, addr, v, mask);
+    if (mcu->callbacks.uart_tx) {
+        callback_sync(mcu);
+        mcu->callbacks.uart_tx(mcu->callbacks.user, mcu->data[addr]);
+    }
+}
+
+// io registers with side effects or read only bits, by data space address, loads and stores of every other address
+// go straight to data memory
+static const struct {
+    u8 readonly;                                                  // bits stores leave as they are
+    u8 (*load)(AVR_MCU *restrict mcu, u16 addr);                  // value a load sees, NULL if plain
+    void (*store)(AVR_MCU *restrict mcu, u16 addr, u8 v, u8 mask); // writes the bits of v set in mask, NULL if plain
+} io_hooks[IO_HOOK_END] = {
+    [AVR_MCU_SREG_OFFSET] = {.load = load_sreg, .store = store_sreg},
+    [REG_DDRB]            = {.store = store_gpio},
+    [REG_PORTB]           = {.load = load_port, .store = store_port},
+    [REG_DDRC]            = {.store = store_gpio},
+    [REG_PORTC]           = {.store = store_gpio},
+    [REG_DDRD]            = {.store = store_gpio},
+    [REG_PORTD]           = {.load = load_port, .store = store_port},
+    [REG_TCNT0]           = {.load = load_tcnt, .store = store_tcnt},
+    [REG_TCNT1L]          = {.load = load_tcnt, .store = store_tcnt},
+    [REG_TCNT1H]          = {.load = load_tcnt, .store = store_tcnt},
+    [REG_TCNT2]           = {.load = load_tcnt, .store = store_tcnt},
+    [REG_GTCCR]           = {.store = store_gtccr},
+    [REG_TCCR0A]          = {.store = store_timer},
+    [REG_TCCR0B]          = {.store = store_timer},
+    [REG_OCR0A]           = {.store = store_timer},
+    [REG_OCR0B]           = {.store = store_timer},
+    [REG_TCCR1A]          = {.store = store_timer},
+    [REG_TCCR1B]          = {.store = store_timer},
+    [REG_ICR1L]           = {.store = store_timer},
+    [REG_ICR1H]           = {.store = store_timer},
+    [REG_OCR1AL]          = {.store = store_timer},
+    [REG_OCR1AH]          = {.store = store_timer},
+    [REG_OCR1BL]          = {.store = store_timer},
+    [REG_OCR1BH]          = {.store = store_timer},
+    [REG_TCCR2A]          = {.store = store_timer},
+    [REG_TCCR2B]          = {.store = store_timer},
+    [REG_OCR2A]           = {.store = store_timer},
+    [REG_OCR2B]           = {.store = store_timer},
+    [REG_TIFR0]           = {.store = store_tifr},
+    [REG_TIFR1]           = {.store = store_tifr},
+    [REG_TIFR2]           = {.store = store_tifr},
+    [REG_TIMSK0]          = {.store = store_irq},
+    [REG_TIMSK1]          = {.store = store_irq},
+    [REG_TIMSK2]          = {.store = store_irq},
+    [REG_EECR]            = {.store = store_irq},
+    [REG_MCUSR]           = {.store = store_irq},
+    [REG_UCSR0A]          = {.readonly = 0x20, .store = store_irq}, // UDRE0
+    [REG_UCSR0B]          = {.store = store_irq},
+    [REG_UCSR0C]          = {.readonly = 0x06}, // UCSZ01, UCSZ00
+    [REG_UDR0]            = {.load = load_udr0, .store = store_udr0},
+    [REG_CLKPR]           = {.store = store_clkpr},
+};
+
+// load a byte from data space
+static inline u8 data_load(AVR_MCU *restrict mcu, u16 addr) {
+    if (addr < IO_HOOK_END && io_hooks[addr].load) {
+        return io_hooks[addr].load(mcu, addr);
+    }
+
+    return mcu->data[addr];
+}
+
+// store the bits of v set in mask to data space, every bit for anything but sbi and cbi
+static inline void data_store_bits(AVR_MCU *restrict mcu, u16 addr, u8 v, u8 mask) {
+    if (addr < IO_HOOK_END) {
+        mask &= ~io_hooks[addr].readonly;
+        if (io_hooks[addr].store) {
+            io_hooks[addr].store(mcu, addr, v, mask);
+            return;
+        }
+    }
+
+    io_write(mcu, addr, v, mask);
+}
+
+static inline void data_store(AVR_MCU *restrict mcu, u16 addr, u8 v) {
+    data_store_bits(mcu, addr, v, 0xFF);
 }
 
 /*******************************************************************************
@@ -55,24 +481,11 @@ static inline int add(AVR_MCU *restrict mcu, u8 d, u8 r) {
     // R <- Rd + Rr
     const u8 R = *Rd + *Rr;
 
-    const u8 Rd3 = GET_BIT(*Rd, 3), Rr3 = GET_BIT(*Rr, 3), R3 = GET_BIT(R, 3);
-    const u8 Rd7 = GET_BIT(*Rd, 7), Rr7 = GET_BIT(*Rr, 7), R7 = GET_BIT(R, 7);
-
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // H = Rd3 & Rr3 | Rr3 & ~R3 | ~R3 & Rd3
-    SET_BIT(*mcu->sreg, SREG_H, (Rd3 & Rr3) | (Rr3 & ~R3) | (~R3 & Rd3));
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = Rd7 & Rr7 & ~R7 | ~Rd7 & ~Rr7 & R7
-    SET_BIT(*mcu->sreg, SREG_V, (Rd7 & Rr7 & ~R7) | (~Rd7 & ~Rr7 & R7));
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, R7);
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
-    // C = Rd7 & Rr7 | Rr7 & ~R7 | ~R7 & Rd7
-    SET_BIT(*mcu->sreg, SREG_C, (Rd7 & Rr7) | (Rr7 & ~R7) | (~R7 & Rd7));
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_ADD, *Rd, *Rr, R, 1);
 
     *Rd = R;
 
@@ -87,27 +500,16 @@ static inline int adc(AVR_MCU *restrict mcu, u8 d, u8 r) {
     u8 *Rd       = &mcu->reg[d];
     const u8 *Rr = &mcu->reg[r];
 
+    sreg_sync(mcu);
+
     // R <- Rd + Rr + C
     const u8 R = *Rd + *Rr + GET_BIT(*mcu->sreg, SREG_C);
 
-    const u8 Rd3 = GET_BIT(*Rd, 3), Rr3 = GET_BIT(*Rr, 3), R3 = GET_BIT(R, 3);
-    const u8 Rd7 = GET_BIT(*Rd, 7), Rr7 = GET_BIT(*Rr, 7), R7 = GET_BIT(R, 7);
-
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // H = Rd3 & Rr3 | Rr3 & ~R3 | ~R3 & Rd3
-    SET_BIT(*mcu->sreg, SREG_H, (Rd3 & Rr3) | (Rr3 & ~R3) | (~R3 & Rd3));
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = Rd7 & Rr7 & ~R7 | ~Rd7 & ~Rr7 & R7
-    SET_BIT(*mcu->sreg, SREG_V, (Rd7 & Rr7 & ~R7) | (~Rd7 & ~Rr7 & R7));
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, R7);
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0 & Z
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
-    // C = Rd7 & Rr7 | Rr7 & ~R7 | ~R7 & Rd7
-    SET_BIT(*mcu->sreg, SREG_C, (Rd7 & Rr7) | (Rr7 & ~R7) | (~R7 & Rd7));
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_ADD, *Rd, *Rr, R, 1);
 
     *Rd = R;
 
@@ -125,22 +527,11 @@ static inline int adiw(AVR_MCU *restrict mcu, u8 d, u8 K) {
     // R <- Rd + Rr
     const u16 R = *Rd + K;
 
-    const u8 Rdh7 = GET_BIT(*Rd, 15);
-    const u8 R15  = GET_BIT(R, 15);
-
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = ~Rdh7 & R15
-    SET_BIT(*mcu->sreg, SREG_V, ~Rdh7 & R15);
-    // N = R15
-    SET_BIT(*mcu->sreg, SREG_N, R15);
-    // Z = ~R15 & ~R14 & ~R13 & ~R12 & ~R11 & ~R10 & ~R9 & ~R8 & ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
-    // C = ~R15 & Rdh7
-    SET_BIT(*mcu->sreg, SREG_C, ~R15 & Rdh7);
+    // flags deferred, see sreg_sync
+    defer_word(mcu, FLAGS_ADIW, *Rd, R, 0);
 
     *Rd = R;
 
@@ -158,24 +549,11 @@ static inline int sub(AVR_MCU *restrict mcu, u8 d, u8 r) {
     // R <- Rd - Rr
     const u8 R = *Rd - *Rr;
 
-    const u8 Rd3 = GET_BIT(*Rd, 3), Rr3 = GET_BIT(*Rr, 3), R3 = GET_BIT(R, 3);
-    const u8 Rd7 = GET_BIT(*Rd, 7), Rr7 = GET_BIT(*Rr, 7), R7 = GET_BIT(R, 7);
-
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // H = ~Rd3 & Rr3 | Rr3 & R3 | R3 & ~Rd3
-    SET_BIT(*mcu->sreg, SREG_H, (~Rd3 & Rr3) | (Rr3 & R3) | (R3 & ~Rd3));
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = Rd7 & ~Rr7 & ~R7 | ~Rd7 & Rr7 & R7
-    SET_BIT(*mcu->sreg, SREG_V, (Rd7 & ~Rr7 & ~R7) | (~Rd7 & Rr7 & R7));
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, R7);
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
-    // C = ~Rd7 & Rr7 | Rr7 & R7 | R7 & ~Rd7
-    SET_BIT(*mcu->sreg, SREG_C, (~Rd7 & Rr7) | (Rr7 & R7) | (R7 & ~Rd7));
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_SUB, *Rd, *Rr, R, 1);
 
     *Rd = R;
 
@@ -192,24 +570,11 @@ static inline int subi(AVR_MCU *restrict mcu, u8 d, u8 K) {
     // R <- Rd - K
     const u8 R = *Rd - K;
 
-    const u8 Rd3 = GET_BIT(*Rd, 3), K3 = GET_BIT(K, 3), R3 = GET_BIT(R, 3);
-    const u8 Rd7 = GET_BIT(*Rd, 7), K7 = GET_BIT(K, 7), R7 = GET_BIT(R, 7);
-
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // H = ~Rd3 & K3 | K3 & R3 | R3 & ~Rd3
-    SET_BIT(*mcu->sreg, SREG_H, (~Rd3 & K3) | (K3 & R3) | (R3 & ~Rd3));
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = Rd7 & ~K7 & ~R7 | ~Rd7 & K7 & R7
-    SET_BIT(*mcu->sreg, SREG_V, (Rd7 & ~K7 & ~R7) | (~Rd7 & K7 & R7));
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, R7);
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
-    // C = ~Rd7 & K7 | K7 & R7 | R7 & ~Rd7
-    SET_BIT(*mcu->sreg, SREG_C, (~Rd7 & K7) | (K7 & R7) | (R7 & ~Rd7));
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_SUB, *Rd, K, R, 1);
 
     *Rd = R;
 
@@ -224,27 +589,16 @@ static inline int sbc(AVR_MCU *restrict mcu, u8 d, u8 r) {
     u8 *Rd       = &mcu->reg[d];
     const u8 *Rr = &mcu->reg[r];
 
+    sreg_sync(mcu);
+
     // R <- Rd - Rr - C
     const u8 R = *Rd - *Rr - GET_BIT(*mcu->sreg, SREG_C);
 
-    const u8 Rd3 = GET_BIT(*Rd, 3), Rr3 = GET_BIT(*Rr, 3), R3 = GET_BIT(R, 3);
-    const u8 Rd7 = GET_BIT(*Rd, 7), Rr7 = GET_BIT(*Rr, 7), R7 = GET_BIT(R, 7);
-
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // H = ~Rd3 & Rr3 | Rr3 & R3 | R3 & ~Rd3
-    SET_BIT(*mcu->sreg, SREG_H, (~Rd3 & Rr3) | (Rr3 & R3) | (R3 & ~Rd3));
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = Rd7 & ~Rr7 & ~R7 | ~Rd7 & Rr7 & R7
-    SET_BIT(*mcu->sreg, SREG_V, (Rd7 & ~Rr7 & ~R7) | (~Rd7 & Rr7 & R7));
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, R7);
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0 & Z
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0 && GET_BIT(*mcu->sreg, SREG_Z));
-    // C = ~Rd7 & Rr7 | Rr7 & R7 | R7 & ~Rd7
-    SET_BIT(*mcu->sreg, SREG_C, (~Rd7 & Rr7) | (Rr7 & R7) | (R7 & ~Rd7));
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_SUB, *Rd, *Rr, R, GET_BIT(*mcu->sreg, SREG_Z));
 
     *Rd = R;
 
@@ -258,27 +612,16 @@ static inline int sbci(AVR_MCU *restrict mcu, u8 d, u8 K) {
 
     u8 *Rd = &mcu->reg[d];
 
+    sreg_sync(mcu);
+
     // R <- Rd - K - C
     const u8 R = (*Rd - K) - GET_BIT(*mcu->sreg, SREG_C);
 
-    const u8 Rd3 = GET_BIT(*Rd, 3), K3 = GET_BIT(K, 3), R3 = GET_BIT(R, 3);
-    const u8 Rd7 = GET_BIT(*Rd, 7), K7 = GET_BIT(K, 7), R7 = GET_BIT(R, 7);
-
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // H = ~Rd3 & K3 | K3 & R3 | R3 & ~Rd3
-    SET_BIT(*mcu->sreg, SREG_H, (~Rd3 & K3) | (K3 & R3) | (R3 & ~Rd3));
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = Rd7 & ~K7 & ~R7 | ~Rd7 & K7 & R7
-    SET_BIT(*mcu->sreg, SREG_V, (Rd7 & ~K7 & ~R7) | (~Rd7 & K7 & R7));
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, R7);
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0 & Z
-    SET_BIT(*mcu->sreg, SREG_Z, (R == 0) & GET_BIT(*mcu->sreg, SREG_Z));
-    // C = ~Rd7 & K7 | K7 & R7 | R7 & ~Rd7
-    SET_BIT(*mcu->sreg, SREG_C, (~Rd7 & K7) | (K7 & R7) | (R7 & ~Rd7));
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_SUB, *Rd, K, R, GET_BIT(*mcu->sreg, SREG_Z));
 
     *Rd = R;
 
@@ -295,22 +638,11 @@ static inline int sbiw(AVR_MCU *restrict mcu, u8 d, u8 K) {
     // R <- Rd - K
     const u16 R = *Rd - K;
 
-    const u8 Rdh7 = GET_BIT(*Rd, 15);
-    const u8 R15  = GET_BIT(R, 15);
-
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = R15 & ~Rdh7
-    SET_BIT(*mcu->sreg, SREG_V, R15 & ~Rdh7);
-    // N = R15
-    SET_BIT(*mcu->sreg, SREG_N, R15);
-    // Z = ~R15 & ~R14 & ~R13 & ~R12 & ~R11 & ~R10 & ~R9 & ~R8 & ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
-    // V = R15 & ~Rdh7
-    SET_BIT(*mcu->sreg, SREG_C, R15 & ~Rdh7);
+    // flags deferred, see sreg_sync
+    defer_word(mcu, FLAGS_SBIW, *Rd, R, 0);
 
     *Rd = R;
 
@@ -331,14 +663,8 @@ static inline int and (AVR_MCU *restrict mcu, u8 d, const u8 r) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = 0
-    CLR_BIT(*mcu->sreg, SREG_V);
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, GET_BIT(*Rd, 7));
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, *Rd == 0);
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_LOGIC, 0, 0, *Rd, 1);
 
     return 1;
 }
@@ -356,14 +682,8 @@ static inline int andi(AVR_MCU *restrict mcu, u8 d, u8 K) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = 0
-    CLR_BIT(*mcu->sreg, SREG_V);
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, GET_BIT(*Rd, 7));
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, *Rd == 0);
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_LOGIC, 0, 0, *Rd, 1);
 
     return 1;
 }
@@ -382,14 +702,8 @@ static inline int or (AVR_MCU *restrict mcu, u8 d, const u8 r) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = 0
-    CLR_BIT(*mcu->sreg, SREG_V);
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, GET_BIT(*Rd, 7));
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, *Rd == 0);
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_LOGIC, 0, 0, *Rd, 1);
 
     return 1;
 }
@@ -407,14 +721,8 @@ static inline int ori(AVR_MCU *restrict mcu, u8 d, u8 K) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = 0
-    CLR_BIT(*mcu->sreg, SREG_V);
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, GET_BIT(*Rd, 7));
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, *Rd == 0);
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_LOGIC, 0, 0, *Rd, 1);
 
     return 1;
 }
@@ -433,14 +741,8 @@ static inline int eor(AVR_MCU *restrict mcu, u8 d, u8 r) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = 0
-    CLR_BIT(*mcu->sreg, SREG_V);
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, GET_BIT(*Rd, 7));
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, *Rd == 0);
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_LOGIC, 0, 0, *Rd, 1);
 
     return 1;
 }
@@ -457,16 +759,8 @@ static inline int com(AVR_MCU *restrict mcu, u8 d) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = 0
-    CLR_BIT(*mcu->sreg, SREG_V);
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, GET_BIT(*Rd, 7));
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, *Rd == 0);
-    // C = 1
-    PUT_BIT(*mcu->sreg, SREG_C);
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_COM, 0, 0, *Rd, 1);
 
     return 1;
 }
@@ -483,18 +777,8 @@ static inline int neg(AVR_MCU *restrict mcu, u8 d) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // H = R3 & ~Rd3
-    SET_BIT(*mcu->sreg, SREG_H, GET_BIT(R, 3) & ~GET_BIT(*Rd, 3));
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_V, R == 0x80);
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, GET_BIT(R, 7));
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
-    // C = R7 | R6 | R5 | R4 | R3 | R2 | R1 | R0
-    SET_BIT(*mcu->sreg, SREG_C, R != 0);
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_NEG, *Rd, 0, R, 1);
 
     *Rd = R;
 
@@ -513,14 +797,8 @@ static inline int inc(AVR_MCU *restrict mcu, u8 d) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = ~R7 & R6 & R5 & R4 & R3 & R2 & R1 & R0
-    SET_BIT(*mcu->sreg, SREG_V, *Rd == 0x80);
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, GET_BIT(*Rd, 7));
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, *Rd == 0);
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_INC, 0, 0, *Rd, 1);
 
     return 1;
 }
@@ -537,14 +815,8 @@ static inline int dec(AVR_MCU *restrict mcu, u8 d) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = ~R7 & R6 & R5 & R4 & R3 & R2 & R1 & R0
-    SET_BIT(*mcu->sreg, SREG_V, *Rd == 0x7F);
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, GET_BIT(*Rd, 7));
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, *Rd == 0);
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_DEC, 0, 0, *Rd, 1);
 
     return 1;
 }
@@ -578,10 +850,8 @@ static inline int mul(AVR_MCU *restrict mcu, u8 d, u8 r) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // C = R15
-    SET_BIT(*mcu->sreg, SREG_C, GET_BIT(R, 15));
-    // Z = ~R15 & ~R14 & ~R13 & ~R12 & ~R11 & ~R10 & ~R9 & ~R8 & ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
+    // flags deferred, see sreg_sync
+    defer_word(mcu, FLAGS_MUL, 0, R, GET_BIT(R, 15));
 
     *(u16 *)&mcu->reg[0] = R;
 
@@ -602,10 +872,8 @@ static inline int muls(AVR_MCU *restrict mcu, u8 d, u8 r) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // C = R15
-    SET_BIT(*mcu->sreg, SREG_C, GET_BIT(R, 15));
-    // Z = ~R15 & ~R14 & ~R13 & ~R12 & ~R11 & ~R10 & ~R9 & ~R8 & ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
+    // flags deferred, see sreg_sync
+    defer_word(mcu, FLAGS_MUL, 0, R, GET_BIT(R, 15));
 
     *(i16 *)&mcu->reg[0] = R;
 
@@ -626,10 +894,8 @@ static inline int mulsu(AVR_MCU *restrict mcu, u8 d, u8 r) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // C = R15
-    SET_BIT(*mcu->sreg, SREG_C, GET_BIT(R, 15));
-    // Z = ~R15 & ~R14 & ~R13 & ~R12 & ~R11 & ~R10 & ~R9 & ~R8 & ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
+    // flags deferred, see sreg_sync
+    defer_word(mcu, FLAGS_MUL, 0, R, GET_BIT(R, 15));
 
     *(i16 *)&mcu->reg[0] = R;
 
@@ -650,10 +916,8 @@ static inline int fmul(AVR_MCU *restrict mcu, u8 d, u8 r) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // C = R16
-    SET_BIT(*mcu->sreg, SREG_C, GET_BIT(R, 16));
-    // Z = ~R15 & ~R14 & ~R13 & ~R12 & ~R11 & ~R10 & ~R9 & ~R8 & ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
+    // flags deferred, see sreg_sync
+    defer_word(mcu, FLAGS_MUL, 0, R, GET_BIT(R, 16));
 
     *(u16 *)&mcu->reg[0] = (u16)R;
 
@@ -674,10 +938,8 @@ static inline int fmuls(AVR_MCU *restrict mcu, u8 d, u8 r) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // C = R16
-    SET_BIT(*mcu->sreg, SREG_C, GET_BIT(R, 16));
-    // Z = ~R15 & ~R14 & ~R13 & ~R12 & ~R11 & ~R10 & ~R9 & ~R8 & ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
+    // flags deferred, see sreg_sync
+    defer_word(mcu, FLAGS_MUL, 0, R, GET_BIT(R, 16));
 
     *(i16 *)&mcu->reg[0] = (i16)R;
 
@@ -698,10 +960,8 @@ static inline int fmulsu(AVR_MCU *restrict mcu, u8 d, u8 r) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // C = R16
-    SET_BIT(*mcu->sreg, SREG_C, GET_BIT(R, 16));
-    // Z = ~R15 & ~R14 & ~R13 & ~R12 & ~R11 & ~R10 & ~R9 & ~R8 & ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
+    // flags deferred, see sreg_sync
+    defer_word(mcu, FLAGS_MUL, 0, R, GET_BIT(R, 16));
 
     *(i16 *)&mcu->reg[0] = (i16)R;
 
@@ -819,9 +1079,7 @@ static inline int cpse(AVR_MCU *restrict mcu, u8 d, u8 r) {
 
     // if Rd == Rr then PC <- PC + 2 (or 3) else PC <- PC + 1
     if (*Rd == *Rr) {
-        u16 next_op = mcu->flash[mcu->pc + 1];
-
-        i = 2 + IS_32BIT_OP(next_op);
+        i = 1 + mcu->decoded[mcu->pc + 1].len;
     }
 
     // PC <- PC + 2 (or 3) if true else PC <- PC + 1
@@ -841,24 +1099,11 @@ static inline int cp(AVR_MCU *restrict mcu, u8 d, u8 r) {
     // R = Rd - Rr
     const u8 R = *Rd - *Rr;
 
-    const u8 Rd3 = GET_BIT(*Rd, 3), Rr3 = GET_BIT(*Rr, 3), R3 = GET_BIT(R, 3);
-    const u8 Rd7 = GET_BIT(*Rd, 7), Rr7 = GET_BIT(*Rr, 7), R7 = GET_BIT(R, 7);
-
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // H = ~Rd3 & Rr3 | Rr3 & R3 | R3 & ~Rd3
-    SET_BIT(*mcu->sreg, SREG_H, (~Rd3 & Rr3) | (Rr3 & R3) | (R3 & ~Rd3));
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = Rd7 & ~Rr7 & ~R7 | ~Rd7 & Rr7 & R7
-    SET_BIT(*mcu->sreg, SREG_V, (Rd7 & ~Rr7 & ~R7) | (~Rd7 & Rr7 & R7));
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, R7);
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
-    // C = ~Rd7 & Rr7 | Rr7 & R7 | R7 & ~Rd7
-    SET_BIT(*mcu->sreg, SREG_C, (~Rd7 & Rr7) | (Rr7 & R7) | (R7 & ~Rd7));
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_SUB, *Rd, *Rr, R, 1);
 
     return 1;
 }
@@ -871,27 +1116,16 @@ static inline int cpc(AVR_MCU *restrict mcu, u8 d, u8 r) {
     const u8 *Rd = &mcu->reg[d];
     const u8 *Rr = &mcu->reg[r];
 
+    sreg_sync(mcu);
+
     // R = Rd - Rr - C
     const u8 R = *Rd - *Rr - GET_BIT(*mcu->sreg, SREG_C);
 
-    const u8 Rd3 = GET_BIT(*Rd, 3), Rr3 = GET_BIT(*Rr, 3), R3 = GET_BIT(R, 3);
-    const u8 Rd7 = GET_BIT(*Rd, 7), Rr7 = GET_BIT(*Rr, 7), R7 = GET_BIT(R, 7);
-
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // H = ~Rd3 & Rr3 | Rr3 & R3 | R3 & ~Rd3
-    SET_BIT(*mcu->sreg, SREG_H, (~Rd3 & Rr3) | (Rr3 & R3) | (R3 & ~Rd3));
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = Rd7 & ~Rr7 & ~R7 | ~Rd7 & Rr7 & R7
-    SET_BIT(*mcu->sreg, SREG_V, (Rd7 & ~Rr7 & ~R7) | (~Rd7 & Rr7 & R7));
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, R7);
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0 & Z
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0 && GET_BIT(*mcu->sreg, SREG_Z));
-    // C = ~Rd7 & Rr7 | Rr7 & R7 | R7 & ~Rd7
-    SET_BIT(*mcu->sreg, SREG_C, (~Rd7 & Rr7) | (Rr7 & R7) | (R7 & ~Rd7));
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_SUB, *Rd, *Rr, R, GET_BIT(*mcu->sreg, SREG_Z));
 
     return 1;
 }
@@ -906,24 +1140,11 @@ static inline int cpi(AVR_MCU *restrict mcu, u8 d, u8 K) {
     // R = Rd - K
     const u8 R = *Rd - K;
 
-    const u8 Rd3 = GET_BIT(*Rd, 3), K3 = GET_BIT(K, 3), R3 = GET_BIT(R, 3);
-    const u8 Rd7 = GET_BIT(*Rd, 7), K7 = GET_BIT(K, 7), R7 = GET_BIT(R, 7);
-
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // H = ~Rd3 & K3 | K3 & R3 | R3 & ~Rd3
-    SET_BIT(*mcu->sreg, SREG_H, (~Rd3 & K3) | (K3 & R3) | (R3 & ~Rd3));
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = Rd7 & ~K7 & ~R7 | ~Rd7 & K7 & R7
-    SET_BIT(*mcu->sreg, SREG_V, (Rd7 & ~K7 & ~R7) | (~Rd7 & K7 & R7));
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, R7);
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
-    // C = ~Rd7 & K7 | K7 & R7 | R7 & ~Rd7
-    SET_BIT(*mcu->sreg, SREG_C, (~Rd7 & K7) | (K7 & R7) | (R7 & ~Rd7));
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_SUB, *Rd, K, R, 1);
 
     return 1;
 }
@@ -939,9 +1160,7 @@ static inline int sbrc(AVR_MCU *restrict mcu, u8 r, u8 b) {
 
     // if Rr(b) = 0 then PC <- PC + 2 (or 3) else PC <- PC + 1
     if (GET_BIT(*Rr, b) == 0) {
-        u16 next_op = mcu->flash[mcu->pc + 1];
-
-        i = 2 + IS_32BIT_OP(next_op);
+        i = 1 + mcu->decoded[mcu->pc + 1].len;
     }
 
     // PC <- PC + 2 (or 3) if true else PC <- PC + 1
@@ -961,9 +1180,7 @@ static inline int sbrs(AVR_MCU *restrict mcu, u8 r, u8 b) {
 
     // if Rr(b) = 1 then PC <- PC + 2 (or 3) else PC <- PC + 1
     if (GET_BIT(*Rr, b)) {
-        u16 next_op = mcu->flash[mcu->pc + 1];
-
-        i = 2 + IS_32BIT_OP(next_op);
+        i = 1 + mcu->decoded[mcu->pc + 1].len;
     }
 
     // PC <- PC + 2 (or 3) if true else PC <- PC + 1
@@ -980,10 +1197,8 @@ static inline int sbic(AVR_MCU *restrict mcu, u8 A, u8 b) {
     u8 i = 1;
 
     // if IO(A,b) = 0 then PC <- PC + 2 (or 3) else PC <- PC + 1
-    if (GET_BIT(mcu->io_reg[A], b) == 0) {
-        u16 next_op = mcu->flash[mcu->pc + 1];
-
-        i = 2 + IS_32BIT_OP(next_op);
+    if (GET_BIT(data_load(mcu, AVR_MCU_IO_REG_OFFSET + A), b) == 0) {
+        i = 1 + mcu->decoded[mcu->pc + 1].len;
     }
 
     // PC <- PC + 2 (or 3) if true else PC <- PC + 1
@@ -1000,10 +1215,8 @@ static inline int sbis(AVR_MCU *restrict mcu, u8 A, u8 b) {
     u8 i = 1;
 
     // if Rr(b) = 1 then PC <- PC + 2 (or 3) else PC <- PC + 1
-    if (GET_BIT(mcu->io_reg[A], b)) {
-        u16 next_op = mcu->flash[mcu->pc + 1];
-
-        i = 2 + IS_32BIT_OP(next_op);
+    if (GET_BIT(data_load(mcu, AVR_MCU_IO_REG_OFFSET + A), b)) {
+        i = 1 + mcu->decoded[mcu->pc + 1].len;
     }
 
     // PC <- PC + 2 (or 3) if true else PC <- PC + 1
@@ -1017,6 +1230,8 @@ static inline int brbs(AVR_MCU *restrict mcu, u8 s, i8 k) {
     ASSERT_BOUNDS(s, 0, 7);
     ASSERT_BOUNDS(k, -64, 63);
 
+    sreg_sync(mcu);
+
     // PC <- PC + k + 1 if true
     // PC <- PC + 1 if false
     if (GET_BIT(*mcu->sreg, s) == 1) {
@@ -1033,6 +1248,8 @@ static inline int brbc(AVR_MCU *restrict mcu, u8 s, i8 k) {
     ASSERT_BOUNDS(s, 0, 7);
     ASSERT_BOUNDS(k, -64, 63);
 
+    sreg_sync(mcu);
+
     // PC <- PC + k + 1 if true
     // PC <- PC + 1 if false
     if (GET_BIT(*mcu->sreg, s) == 0) {
@@ -1054,7 +1271,7 @@ static inline int sbi(AVR_MCU *restrict mcu, u8 A, u8 b) {
     ASSERT_BOUNDS(b, 0, 7);
 
     // IO(A,b) = 1
-    PUT_BIT(mcu->io_reg[A], b);
+    data_store_bits(mcu, AVR_MCU_IO_REG_OFFSET + A, 1 << b, 1 << b);
 
     // PC <- PC + 1
     mcu->pc += 1;
@@ -1068,7 +1285,7 @@ static inline int cbi(AVR_MCU *restrict mcu, u8 A, u8 b) {
     ASSERT_BOUNDS(b, 0, 7);
 
     // IO(A,b) = 0
-    CLR_BIT(mcu->io_reg[A], b);
+    data_store_bits(mcu, AVR_MCU_IO_REG_OFFSET + A, 0, 1 << b);
 
     // PC <- PC + 1
     mcu->pc += 1;
@@ -1088,19 +1305,8 @@ static inline int lsr(AVR_MCU *restrict mcu, u8 d) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = N ^ C  **DELAYED**
-    /* see NOTE */
-    // N = 0
-    CLR_BIT(*mcu->sreg, SREG_N);
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
-    // C = Rd0
-    SET_BIT(*mcu->sreg, SREG_C, GET_BIT(*Rd, 0));
-
-    // V = N ^ C  <- NOTE N and C AFTER shift so we delay it
-    SET_BIT(*mcu->sreg, SREG_V, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_C));
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_SHIFT, *Rd, 0, R, 1);
 
     *Rd = R;
 
@@ -1113,25 +1319,16 @@ static inline int ror(AVR_MCU *restrict mcu, u8 d) {
 
     u8 *Rd = &mcu->reg[d];
 
+    sreg_sync(mcu);
+
     // R <- C -> Rd >> 1
     const u8 R = (*Rd >> 1) | (GET_BIT(*mcu->sreg, SREG_C) << 7);
 
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = N ^ C  **DELAYED**
-    /* see NOTE */
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, GET_BIT(R, 7));
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
-    // C = Rd0
-    SET_BIT(*mcu->sreg, SREG_C, GET_BIT(*Rd, 0));
-
-    // V = N ^ C  <- NOTE N and C AFTER shift so we delay it
-    SET_BIT(*mcu->sreg, SREG_V, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_C));
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_SHIFT, *Rd, 0, R, 1);
 
     *Rd = R;
 
@@ -1150,19 +1347,8 @@ static inline int asr(AVR_MCU *restrict mcu, u8 d) {
     // PC <- PC + 1
     mcu->pc += 1;
 
-    // S = N ^ V
-    SET_BIT(*mcu->sreg, SREG_S, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_V));
-    // V = N ^ C  **DELAYED**
-    /* see NOTE */
-    // N = R7
-    SET_BIT(*mcu->sreg, SREG_N, GET_BIT(R, 7));
-    // Z = ~R7 & ~R6 & ~R5 & ~R4 & ~R3 & ~R2 & ~R1 & ~R0
-    SET_BIT(*mcu->sreg, SREG_Z, R == 0);
-    // C = Rd0
-    SET_BIT(*mcu->sreg, SREG_C, GET_BIT(*Rd, 0));
-
-    // V = N ^ C  <- NOTE N and C AFTER shift so we delay it
-    SET_BIT(*mcu->sreg, SREG_V, GET_BIT(*mcu->sreg, SREG_N) ^ GET_BIT(*mcu->sreg, SREG_C));
+    // flags deferred, see sreg_sync
+    defer(mcu, FLAGS_SHIFT, *Rd, 0, R, 1);
 
     *Rd = R;
 
@@ -1190,6 +1376,11 @@ static inline int swap(AVR_MCU *restrict mcu, u8 d) {
 static inline int bset(AVR_MCU *restrict mcu, u8 s) {
     ASSERT_BOUNDS(s, 0, 7);
 
+    // T and I are never deferred
+    if (s < SREG_T) {
+        sreg_sync(mcu);
+    }
+
     // SREG(s) <- 1
     PUT_BIT(*mcu->sreg, s);
 
@@ -1212,6 +1403,11 @@ static inline int bset(AVR_MCU *restrict mcu, u8 s) {
 static inline int bclr(AVR_MCU *restrict mcu, u8 s) {
     ASSERT_BOUNDS(s, 0, 7);
 
+    // T and I are never deferred
+    if (s < SREG_T) {
+        sreg_sync(mcu);
+    }
+
     // SREG(s) <- 0
     CLR_BIT(*mcu->sreg, s);
 
@@ -1326,7 +1522,7 @@ static inline int ld_x(AVR_MCU *restrict mcu, u8 d) {
     const u16 X = *(u16 *)&mcu->reg[REG_X];
 
     // Rd <- (X)
-    *Rd = mcu->data[X];
+    *Rd = data_load(mcu, X);
 
     // PC <- PC + 1
     mcu->pc += 1;
@@ -1355,7 +1551,7 @@ static inline int ld_y(AVR_MCU *restrict mcu, u8 d) {
     const u16 Y = *(u16 *)&mcu->reg[REG_Y];
 
     // Rd <- (Y)
-    *Rd = mcu->data[Y];
+    *Rd = data_load(mcu, Y);
 
     // PC <- PC + 1
     mcu->pc += 1;
@@ -1384,7 +1580,7 @@ static inline int ld_z(AVR_MCU *restrict mcu, u8 d) {
     const u16 Z = *(u16 *)&mcu->reg[REG_Z];
 
     // Rd <- (Z)
-    *Rd = mcu->data[Z];
+    *Rd = data_load(mcu, Z);
 
     // PC <- PC + 1
     mcu->pc += 1;
@@ -1417,7 +1613,7 @@ static inline int ldd_y(AVR_MCU *restrict mcu, u8 d, u8 q) {
     ASSERT_BOUNDS(Y + q, 0, AVR_MCU_RAMEND);
 
     // Rd <- (Y + q)
-    *Rd = mcu->data[Y + q];
+    *Rd = data_load(mcu, Y + q);
 
     // PC <- PC + 1
     mcu->pc += 1;
@@ -1435,7 +1631,7 @@ static inline int ldd_z(AVR_MCU *restrict mcu, u8 d, u8 q) {
     ASSERT_BOUNDS(Z + q, 0, AVR_MCU_RAMEND);
 
     // Rd <- (Z + q)
-    *Rd = mcu->data[Z + q];
+    *Rd = data_load(mcu, Z + q);
 
     // PC <- PC + 1
     mcu->pc += 1;
@@ -1451,7 +1647,7 @@ static inline int lds(AVR_MCU *restrict mcu, u8 d, u16 k) {
     u8 *Rd = &mcu->reg[d];
 
     // Rd <- (k)
-    *Rd = mcu->data[k];
+    *Rd = data_load(mcu, k);
 
     // PC <- PC + 2
     mcu->pc += 2;
@@ -1467,7 +1663,7 @@ static inline int st_x(AVR_MCU *restrict mcu, u8 r) {
     const u16 X  = *(u16 *)&mcu->reg[REG_X];
 
     // (X) <- Rr
-    mcu->data[X] = *Rr;
+    data_store(mcu, X, *Rr);
 
     // PC <- PC + 1
     mcu->pc += 1;
@@ -1493,7 +1689,7 @@ static inline int st_y(AVR_MCU *restrict mcu, u8 r) {
     const u16 Y  = *(u16 *)&mcu->reg[REG_Y];
 
     // (Y) <- Rr
-    mcu->data[Y] = *Rr;
+    data_store(mcu, Y, *Rr);
 
     // PC <- PC + 1
     mcu->pc += 1;
@@ -1520,7 +1716,7 @@ static inline int st_z(AVR_MCU *restrict mcu, u8 r) {
     const u16 Z  = *(u16 *)&mcu->reg[REG_Z];
 
     // (Z) <- Rr
-    mcu->data[Z] = *Rr;
+    data_store(mcu, Z, *Rr);
 
     // PC <- PC + 1
     mcu->pc += 1;
@@ -1551,7 +1747,7 @@ static inline int std_y(AVR_MCU *restrict mcu, u8 q, u8 r) {
     ASSERT_BOUNDS(Y + q, 0, AVR_MCU_RAMEND);
 
     // (Y + q) <- Rr
-    mcu->data[Y + q] = *Rr;
+    data_store(mcu, Y + q, *Rr);
 
     // PC <- PC + 1
     mcu->pc += 1;
@@ -1569,7 +1765,7 @@ static inline int std_z(AVR_MCU *restrict mcu, u8 q, u8 r) {
     ASSERT_BOUNDS(Z + q, 0, AVR_MCU_RAMEND);
 
     // (Z + q) <- Rr
-    mcu->data[Z + q] = *Rr;
+    data_store(mcu, Z + q, *Rr);
 
     // PC <- PC + 1
     mcu->pc += 1;
@@ -1585,7 +1781,7 @@ static inline int sts(AVR_MCU *restrict mcu, u16 k, u8 r) {
     const u8 *Rr = &mcu->reg[r];
 
     // (k) <- Rr
-    mcu->data[k] = *Rr;
+    data_store(mcu, k, *Rr);
 
     // PC <- PC + 2
     mcu->pc += 2;
@@ -1616,6 +1812,13 @@ static inline int lpm_postinc(AVR_MCU *restrict mcu, u8 d) {
     return 3;
 }
 
+static void decode(AVR_MCU *restrict mcu, u16 pc);
+static void link_blocks(AVR_MCU *restrict mcu, u16 pc);
+static void fuse(AVR_MCU *restrict mcu, u16 lo, u16 hi);
+static void hle_scan(AVR_MCU *restrict mcu, u16 lo, u16 hi);
+static void delay_scan(AVR_MCU *restrict mcu, u16 lo, u16 hi);
+static void mark_heads(AVR_MCU *restrict mcu, u16 lo, u16 hi);
+
 // spm - store program memory
 static inline int spm(AVR_MCU *restrict mcu) {
     const u16 *Rr = (u16 *)&mcu->reg[0];
@@ -1624,6 +1827,24 @@ static inline int spm(AVR_MCU *restrict mcu) {
     // (Z) <- Rr
     mcu->flash[Z] = *Rr;
 
+    // keep predecoded flash in sync, previous word may be a 32 bit op using Z as its operand
+    if (Z < AVR_MCU_FLASH_SIZE / 2) {
+        decode(mcu, Z);
+    }
+    if (Z > 0 && Z <= AVR_MCU_FLASH_SIZE / 2) {
+        decode(mcu, Z - 1);
+    }
+
+    // blocks at or before Z may run through the new word
+    link_blocks(mcu, Z < AVR_MCU_FLASH_SIZE / 2 ? Z : AVR_MCU_FLASH_SIZE / 2 - 1);
+    fuse(mcu, Z > FUSE_MAX_RUN ? Z - FUSE_MAX_RUN : 0, Z < AVR_MCU_FLASH_SIZE / 2 ? Z : AVR_MCU_FLASH_SIZE / 2 - 1);
+    hle_scan(mcu, Z >= HLE_MAX_LEN ? Z - HLE_MAX_LEN + 1 : 0,
+             Z < AVR_MCU_FLASH_SIZE / 2 ? Z : AVR_MCU_FLASH_SIZE / 2 - 1);
+    delay_scan(mcu, Z >= DELAY_MAX_LEN ? Z - DELAY_MAX_LEN + 1 : 0,
+               Z < AVR_MCU_FLASH_SIZE / 2 ? Z : AVR_MCU_FLASH_SIZE / 2 - 1);
+    mark_heads(mcu, Z > 0 ? Z - 1 : 0, Z < AVR_MCU_FLASH_SIZE / 2 ? Z : AVR_MCU_FLASH_SIZE / 2 - 1);
+    mcu->native = NULL;
+
     // PC <- PC + 1
     mcu->pc += 1;
 
@@ -1638,7 +1859,7 @@ static inline int in(AVR_MCU *restrict mcu, u8 d, u8 A) {
     u8 *Rd = &mcu->reg[d];
 
     // Rd <- IO(A)
-    *Rd = mcu->io_reg[A];
+    *Rd = data_load(mcu, AVR_MCU_IO_REG_OFFSET + A);
 
     // PC <- PC + 1
     mcu->pc += 1;
@@ -1654,7 +1875,7 @@ static inline int out(AVR_MCU *restrict mcu, u8 A, u8 r) {
     const u8 *Rr = &mcu->reg[r];
 
     // IO(A) <- Rr
-    mcu->io_reg[A] = *Rr;
+    data_store(mcu, AVR_MCU_IO_REG_OFFSET + A, *Rr);
 
     // PC <- PC + 1
     mcu->pc += 1;
@@ -1672,7 +1893,7 @@ static inline int push(AVR_MCU *restrict mcu, u8 r) {
     *mcu->sp -= 1;
 
     // STACK <- Rr
-    mcu->data[*mcu->sp] = *Rr;
+    data_store(mcu, *mcu->sp, *Rr);
 
     // PC <- PC + 1
     mcu->pc += 1;
@@ -1687,7 +1908,7 @@ static inline int pop(AVR_MCU *restrict mcu, u8 d) {
     u8 *Rd = &mcu->reg[d];
 
     // Rd <- STACK
-    *Rd = mcu->data[*mcu->sp];
+    *Rd = data_load(mcu, *mcu->sp);
 
     // SP <- SP + 1
     *mcu->sp += 1;
@@ -1712,13 +1933,11 @@ static inline int nop(AVR_MCU *restrict mcu) {
 
 // sleep -
 static inline int sleep(AVR_MCU *restrict mcu) {
-    switch (mcu->data[REG_SMCR]) {
-    case SLEEP_IDLE:
-    case SLEEP_ADC_NR:
-    case SLEEP_POWER_DOWN:
-    case SLEEP_POWER_SAVE:
-        LOG_DEBUG("SLEEP MODE %#x TODO", mcu->data[REG_SMCR]);
-        break;
+    // enter the mode SMCR selects if sleep is enabled, timers are brought up to the sleep before it stops their clocks
+    if (GET_BIT(mcu->data[REG_SMCR], BIT_SE)) {
+        sched_sync(mcu);
+        mcu->sleep     = MSK(mcu->data[REG_SMCR], 0x0F);
+        mcu->sched_due = 0;
     }
 
     // PC <- PC + 1
@@ -1763,9 +1982,39 @@ static inline u16 get_clk_ps(u8 bitfield) {
     };
 }
 
+// whether the sleep mode the mcu is in stops the clock of timer n, timer 2 keeps its own clock in power save and adc
+// noise reduction
+static inline bool sleep_stops(const AVR_MCU *restrict mcu, u8 n) {
+    switch (mcu->sleep) {
+    case 0:
+    case SLEEP_IDLE:
+        return false;
+    case SLEEP_ADC_NR:
+    case SLEEP_POWER_SAVE:
+        return n != 2;
+    default:
+        return true;
+    }
+}
+
+// clock divisor of timer n, zero if its clock is off or stopped by sleep
+static inline u16 timer_div(const AVR_MCU *restrict mcu, u8 n) {
+    static const u8 tccrb[] = {REG_TCCR0B, REG_TCCR1B, REG_TCCR2B};
+
+    return sleep_stops(mcu, n) ? 0 : get_clk_ps(mcu->data[tccrb[n]] & 0x07);
+}
+
+// cycles a timer clocked every div cycles is into its tick at clk, counted from the last reset of its prescaler,
+// timer 2 has its own, the divisors are powers of two so this is a mask rather than a division
+static inline u16 timer_phase(const AVR_MCU *restrict mcu, u8 n, u64 clk, u16 div) {
+    return (u16)(clk - (n == 2 ? mcu->psr_async : mcu->psr_sync)) & (div - 1);
+}
+
 // compare output used for setting OCx pins
 // NOLINTNEXTLINE
 static inline void comp_normal(AVR_MCU *restrict mcu, u8 reg, u8 bit, u8 com) {
+    const u8 old = mcu->data[reg];
+
     switch (com) {
     case 1:
         TGL_BIT(mcu->data[reg], bit);
@@ -1777,6 +2026,8 @@ static inline void comp_normal(AVR_MCU *restrict mcu, u8 reg, u8 bit, u8 com) {
         PUT_BIT(mcu->data[reg], bit);
         break;
     }
+
+    gpio_notify(mcu, reg, old);
 }
 
 // compare output used for setting OCx pins in PWM mode
@@ -1785,6 +2036,8 @@ static inline void comp_normal(AVR_MCU *restrict mcu, u8 reg, u8 bit, u8 com) {
 // NOTE WGM02 must equal 1
 // NOLINTNEXTLINE
 static inline void comp_pwm(AVR_MCU *restrict mcu, u8 reg, u8 bit, u8 com, bool reverse) {
+    const u8 old = mcu->data[reg];
+
     switch (com) {
     case 1:
         TGL_BIT(mcu->reg[reg], bit);
@@ -1796,13 +2049,15 @@ static inline void comp_pwm(AVR_MCU *restrict mcu, u8 reg, u8 bit, u8 com, bool
         SET_BIT(mcu->reg[reg], bit, !reverse);
         break;
     }
+
+    gpio_notify(mcu, reg, old);
 }
 
 // need a function per timer because there are slight variations in each
 static inline void timer0_tick(AVR_MCU *restrict mcu) {
     // clk divisor
-    const u16 div0 = get_clk_ps(mcu->data[REG_TCCR0B] & 0x07);
-    if (div0 == 0 || mcu->clk % div0) {
+    const u16 div0 = timer_div(mcu, 0);
+    if (div0 == 0 || timer_phase(mcu, 0, mcu->clk, div0)) {
         return;
     }
 
@@ -1888,13 +2143,13 @@ static inline void timer0_tick(AVR_MCU *restrict mcu) {
 // need a function per timer because there are slight variations in each
 static inline void timer1_tick(AVR_MCU *restrict mcu) {
     // clk divisor
-    const u16 div1 = get_clk_ps(mcu->data[REG_TCCR1B] & 0x07);
-    if (div1 == 0 || mcu->clk % div1) {
+    const u16 div1 = timer_div(mcu, 1);
+    if (div1 == 0 || timer_phase(mcu, 1, mcu->clk, div1)) {
         return;
     }
 
     u16 *const tcnt1 = (u16 *)&mcu->data[REG_TCNT1L];
-    const u8 wgm1    = MSH(mcu->data[REG_TCCR1B], 0x18, 3) | MSK(mcu->data[REG_TCCR1A], 0x03);
+    const u8 wgm1    = MSH(mcu->data[REG_TCCR1B], 0x18, 1) | MSK(mcu->data[REG_TCCR1A], 0x03);
     const u8 coma1   = MSH(mcu->data[REG_TCCR1A], 0xC0, 6);
     const u8 comb1   = MSH(mcu->data[REG_TCCR1A], 0x30, 4);
     u16 top1;
@@ -1912,10 +2167,12 @@ static inline void timer1_tick(AVR_MCU *restrict mcu) {
     case 7:
         top1 = 0x03FF;
         break;
+    case 8:
     case 10:
     case 14:
         top1 = *(u16 *)&mcu->data[REG_ICR1L];
         break;
+    case 9:
     case 11:
     case 15:
         top1 = *(u16 *)&mcu->data[REG_OCR1AL];
@@ -2014,8 +2271,8 @@ static inline void timer1_tick(AVR_MCU *restrict mcu) {
 
 static inline void timer2_tick(AVR_MCU *restrict mcu) {
     // clk divisor
-    const u16 div2 = get_clk_ps(mcu->data[REG_TCCR2B] & 0x07);
-    if (div2 == 0 || mcu->clk % div2) {
+    const u16 div2 = timer_div(mcu, 2);
+    if (div2 == 0 || timer_phase(mcu, 2, mcu->clk, div2)) {
         return;
     }
 
@@ -2098,71 +2355,1154 @@ static inline void timer2_tick(AVR_MCU *restrict mcu) {
     mcu->data[REG_TIFR2] |= (*tcnt2 == 0); // only set never clear
 }
 
-// enter an interrupt service routine
-// this should be called after an execute call so we store current pc
-// takes 4 cycles just like a normal call instruction
-// iv : interrupt vector
-static inline int isr(AVR_MCU *restrict mcu, u16 iv) {
-    ASSERT_BOUNDS(iv, 0, sizeof(mcu->flash) - 1);
-
-    // SP <- PC - 2
-    *mcu->sp -= 2;
+// timers are brought up to date at least this often so the cycles until the next event fit sched_due
+#define TIMER_SYNC_MAX 0x8000
 
-    // STACK <- PC
-    *(u16 *)&mcu->data[*mcu->sp] = mcu->pc;
+// no tick of the timer does more than count
+#define TIMER_NEVER UINT32_MAX
 
-    // PC <- iv
-    mcu->pc = iv;
+// ticks until a counter at v counting by one in direction up first reaches t
+static inline u32 dist8(u8 v, u8 t, bool up) {
+    return (u32)(u8)(up ? t - v - 1 : v - t - 1) + 1;
+}
 
-    return 4;
+static inline u32 dist16(u16 v, u16 t) {
+    return (u32)(u16)(t - v - 1) + 1;
 }
 
-void avr_mcu_init(AVR_MCU *restrict mcu) {
-    memset(mcu, 0, sizeof(*mcu));
+// ticks until a counter at v that wraps from top to zero reaches zero or one of its compare values
+static inline u32 dist_top(u16 v, u16 top, u16 a, u16 b) {
+    // above top the counter wraps on the next tick
+    if (v > top) {
+        return 1;
+    }
 
-    mcu->sreg       = &mcu->data[AVR_MCU_SREG_OFFSET];
-    mcu->sp         = (u16 *)&mcu->data[AVR_MCU_SP_OFFSET];
-    mcu->reg        = &mcu->data[AVR_MCU_REG_OFFSET];
-    mcu->io_reg     = &mcu->data[AVR_MCU_IO_REG_OFFSET];
-    mcu->ext_io_reg = &mcu->data[AVR_MCU_EXT_IO_REG_OFFSET];
-    mcu->sram       = &mcu->data[AVR_MCU_SRAM_OFFSET];
+    u32 k = (u32)top - v + 1;
+    if (a > v && a <= top) {
+        k = MIN(k, (u32)a - v);
+    }
+    if (b > v && b <= top) {
+        k = MIN(k, (u32)b - v);
+    }
+
+    return k;
+}
 
-    *mcu->sp = AVR_MCU_RAMEND;
+// ticks until the tick of an 8 bit timer that matches a compare value, overflows, or turns around, every tick
+// before it only counts
+static u32 timer8_events(const AVR_MCU *restrict mcu, u8 wgm, u16 tcnt, u16 ocra, u16 ocrb) {
+    const u8 v = mcu->data[tcnt];
+    const u8 a = mcu->data[ocra];
+    const u8 b = mcu->data[ocrb];
 
-    set_readonly(mcu);
+    switch (wgm) {
+    case 0: // NORMAL
+        return MIN(MIN(dist8(v, a, true), dist8(v, b, true)), dist8(v, 0, true));
+    case 2: // CTC
+    case 7: // Fast PWM Mode
+        return dist_top(v, a, a, b);
+    case 3:
+        return dist_top(v, 0xFF, a, b);
+    case 5: // Phase Correct PWM Mode
+    case 1: {
+        const u8 top = wgm == 5 ? a : 0xFF;
+        const bool up = !mcu->pwm_invert;
+        return MIN(MIN(dist8(v, a, up), dist8(v, b, up)), MIN(dist8(v, 0, up), dist8(v, top, up)));
+    }
+    default:
+        return 1;
+    }
 }
 
-AVR_Result avr_program(AVR_MCU *restrict mcu, const char *restrict hex) {
-    while (*hex) {
-        if (*hex != ':') {
-            hex += 1;
-            continue;
-        }
+// count an 8 bit timer through ticks that do nothing else
+static void timer8_count(AVR_MCU *restrict mcu, u8 wgm, u16 tcnt, u32 ticks) {
+    if (wgm == 1 || wgm == 5) {
+        mcu->data[tcnt] += mcu->pwm_invert ? -ticks : ticks;
+    } else {
+        mcu->data[tcnt] += ticks;
+    }
+}
 
-        hex += 1;
+static inline u8 timer0_wgm(const AVR_MCU *restrict mcu) {
+    return MSH(mcu->data[REG_TCCR0B], 0x08, 1) | MSK(mcu->data[REG_TCCR0A], 0x03);
+}
 
-        const u8 len = xstr2byte(hex);
-        hex += 2;
+static inline u8 timer1_wgm(const AVR_MCU *restrict mcu) {
+    return MSH(mcu->data[REG_TCCR1B], 0x18, 1) | MSK(mcu->data[REG_TCCR1A], 0x03);
+}
 
-        const u16 addr = (xstr2byte(hex) << 8) | xstr2byte(hex + 2);
-        hex += 4;
+static inline u8 timer2_wgm(const AVR_MCU *restrict mcu) {
+    return MSH(mcu->data[REG_TCCR2B], 0x08, 1) | MSK(mcu->data[REG_TCCR2A], 0x03);
+}
 
-        const u8 type = xstr2byte(hex);
-        hex += 2;
+// timer1_tick counterpart of timer8_events
+static u32 timer1_events(const AVR_MCU *restrict mcu, u8 wgm) {
+    const u16 v   = *(u16 *)&mcu->data[REG_TCNT1L];
+    const u16 a   = *(u16 *)&mcu->data[REG_OCR1AL];
+    const u16 b   = *(u16 *)&mcu->data[REG_OCR1BL];
+    const u16 icr = *(u16 *)&mcu->data[REG_ICR1L];
 
-        switch (type) {
-        case DATA_RECORD: {
-            u8 checksum = len + (addr >> 8) + (addr & 0xFF) + type;
+    switch (wgm) {
+    case 0: // NORMAL
+        return MIN(MIN(dist16(v, a), dist16(v, b)), dist16(v, 0));
+    case 4: // CTC
+    case 15:
+        return dist_top(v, a, a, b);
+    case 12: // CTC
+    case 14:
+        return dist_top(v, icr, icr, b);
+    case 5: // Fast PWM Mode
+        return dist_top(v, 0x00FF, a, b);
+    case 6:
+        return dist_top(v, 0x01FF, a, b);
+    case 7:
+        return dist_top(v, 0x03FF, a, b);
+    case 1:
+    case 2:
+    case 3: {
+        // every tick loads the counter with a value set by the direction
+        const u16 top = wgm == 1 ? 0x00FF : wgm == 2 ? 0x01FF : 0x03FF;
+        const u16 w   = mcu->pwm_invert ? 0xFFFF : 1;
+        return w == a || w == b || w == top ? 1 : TIMER_NEVER;
+    }
+    default:
+        return 1;
+    }
+}
 
-            for (u8 i = 0; i < len; i++) {
-                const u8 b = xstr2byte(hex);
-                hex += 2;
+// timer1_tick counterpart of timer8_count
+static void timer1_count(AVR_MCU *restrict mcu, u8 wgm, u32 ticks) {
+    u16 *const tcnt1 = (u16 *)&mcu->data[REG_TCNT1L];
 
-                ((u8 *)mcu->flash)[addr + i] = b;
-                checksum += b;
-            }
+    if (wgm == 1 || wgm == 2 || wgm == 3) {
+        if (ticks) {
+            *tcnt1 = mcu->pwm_invert ? -1 : 1;
+        }
+    } else {
+        *tcnt1 += ticks;
+    }
+}
 
-            checksum = TWO_COMP(checksum);
+// ticks timer n clocked every div cycles makes in the cycles after sched_clk
+static inline u32 timer_ticks(const AVR_MCU *restrict mcu, u8 n, u16 div, u32 cycles) {
+    return div ? (timer_phase(mcu, n, mcu->sched_clk, div) + cycles) / div : 0;
+}
+
+// cycles after sched_clk until timer n clocked every div cycles makes its k-th tick
+static inline u32 timer_cycles(const AVR_MCU *restrict mcu, u8 n, u16 div, u32 k) {
+    if (div == 0 || k == TIMER_NEVER || k > TIMER_SYNC_MAX) {
+        return TIMER_SYNC_MAX;
+    }
+
+    return MIN(div - timer_phase(mcu, n, mcu->sched_clk, div) + (k - 1) * div, TIMER_SYNC_MAX);
+}
+
+// cycles after sched_clk until the first cycle a timer tick does more than count
+static u16 timers_due(const AVR_MCU *restrict mcu) {
+    const u16 div0 = timer_div(mcu, 0);
+    const u16 div1 = timer_div(mcu, 1);
+    const u16 div2 = timer_div(mcu, 2);
+
+    u32 due = TIMER_SYNC_MAX;
+    if (div0) {
+        const u32 c = timer_cycles(mcu, 0, div0, timer8_events(mcu, timer0_wgm(mcu), REG_TCNT0, REG_OCR0A, REG_OCR0B));
+        due         = MIN(due, c);
+    }
+    if (div1) {
+        const u32 c = timer_cycles(mcu, 1, div1, timer1_events(mcu, timer1_wgm(mcu)));
+        due         = MIN(due, c);
+    }
+    if (div2) {
+        const u32 c = timer_cycles(mcu, 2, div2, timer8_events(mcu, timer2_wgm(mcu), REG_TCNT2, REG_OCR2A, REG_OCR2B));
+        due         = MIN(due, c);
+    }
+
+    return due;
+}
+
+// count the timers through cycles after sched_clk that are all before the cycle they are due
+static void timers_count(AVR_MCU *restrict mcu, u16 cycles) {
+    const u16 div0 = timer_div(mcu, 0);
+    const u16 div1 = timer_div(mcu, 1);
+    const u16 div2 = timer_div(mcu, 2);
+
+    timer8_count(mcu, timer0_wgm(mcu), REG_TCNT0, timer_ticks(mcu, 0, div0, cycles));
+    timer1_count(mcu, timer1_wgm(mcu), timer_ticks(mcu, 1, div1, cycles));
+    timer8_count(mcu, timer2_wgm(mcu), REG_TCNT2, timer_ticks(mcu, 2, div2, cycles));
+}
+
+/*******************************************************************************
+ * Event Scheduler
+ ******************************************************************************/
+
+static inline void sched_place(AVR_Schedule *restrict s, u8 i, u8 ev) {
+    s->heap[i] = ev;
+    s->pos[ev] = i;
+}
+
+// move the event at heap index i up or down to where its cycle orders it
+static void sched_fix(AVR_Schedule *restrict s, u8 i) {
+    const u8 ev  = s->heap[i];
+    const u64 at = s->at[ev];
+
+    while (i > 0 && s->at[s->heap[(i - 1) / 2]] > at) {
+        sched_place(s, i, s->heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+
+    for (;;) {
+        u8 child = 2 * i + 1;
+        if (child >= s->count) {
+            break;
+        }
+        if (child + 1 < s->count && s->at[s->heap[child + 1]] < s->at[s->heap[child]]) {
+            child += 1;
+        }
+        if (s->at[s->heap[child]] >= at) {
+            break;
+        }
+
+        sched_place(s, i, s->heap[child]);
+        i = child;
+    }
+
+    sched_place(s, i, ev);
+}
+
+// schedule event ev for clock at, moving it if it is already pending, peripherals must be brought up
+// to date first
+static void sched_at(AVR_MCU *restrict mcu, AVR_Event ev, u64 at) {
+    AVR_Schedule *const s = &mcu->schedule;
+
+    s->at[ev] = at;
+    if (s->pos[ev] == AVR_EVENT_COUNT) {
+        s->heap[s->count] = ev;
+        s->count += 1;
+        sched_fix(s, s->count - 1);
+    } else {
+        sched_fix(s, s->pos[ev]);
+    }
+
+    // an event sooner than the next one shortens the wait, one already due fires on the next cycle
+    if (mcu->sched_due && at < mcu->sched_clk + mcu->sched_due) {
+        mcu->sched_due = at > mcu->sched_clk ? at - mcu->sched_clk : 1;
+    }
+}
+
+// drop event ev if it is pending
+static inline void sched_cancel(AVR_MCU *restrict mcu, AVR_Event ev) {
+    AVR_Schedule *const s = &mcu->schedule;
+    const u8 i            = s->pos[ev];
+
+    if (i == AVR_EVENT_COUNT) {
+        return;
+    }
+
+    s->count -= 1;
+    s->pos[ev] = AVR_EVENT_COUNT;
+    if (i < s->count) {
+        sched_place(s, i, s->heap[s->count]);
+        sched_fix(s, i);
+    }
+}
+
+// run event ev, the timers have already ticked the cycle it is due
+static void sched_fire(AVR_MCU *restrict mcu, AVR_Event ev) {
+    (void)mcu;
+
+    switch (ev) {
+    case AVR_EVENT_TIMER:
+        // sched_sync works out when the timers are due next
+        break;
+    default:
+        LOG_ERROR("unknown event %d", ev);
+        break;
+    }
+}
+
+// move sched_clk through cycles that are all before the next event
+static inline void sched_count(AVR_MCU *restrict mcu, u16 cycles) {
+    timers_count(mcu, cycles);
+
+    mcu->sched_clk += cycles;
+}
+
+// bring peripherals from sched_clk up to clk, counting in closed form up to each cycle an event is due, ticking the
+// timers that cycle the way the cycle always did and then running the events due
+static void sched_sync(AVR_MCU *restrict mcu) {
+    AVR_Schedule *const s = &mcu->schedule;
+
+    for (;;) {
+        if (mcu->sched_due == 0) {
+            sched_at(mcu, AVR_EVENT_TIMER, mcu->sched_clk + timers_due(mcu));
+            mcu->sched_due = MIN(s->at[s->heap[0]] - mcu->sched_clk, TIMER_SYNC_MAX);
+        }
+
+        const u64 left = mcu->clk - mcu->sched_clk;
+        if (left < mcu->sched_due) {
+            sched_count(mcu, (u16)left);
+            mcu->sched_due -= left;
+            return;
+        }
+
+        sched_count(mcu, mcu->sched_due - 1);
+
+        const u64 clk  = mcu->clk;
+        mcu->clk       = mcu->sched_clk + 1;
+        mcu->sched_clk = mcu->clk;
+        timer0_tick(mcu);
+        timer1_tick(mcu);
+        timer2_tick(mcu);
+        mcu->clk  = clk;
+        mcu->irq |= IRQ_STALE;
+
+        while (s->count && s->at[s->heap[0]] <= mcu->sched_clk) {
+            const AVR_Event ev = s->heap[0];
+            sched_cancel(mcu, ev);
+            sched_fire(mcu, ev);
+        }
+
+        mcu->sched_due = 0;
+    }
+}
+
+// enter an interrupt service routine
+// this should be called after an execute call so we store current pc
+// takes 4 cycles just like a normal call instruction
+// iv : interrupt vector
+static inline int isr(AVR_MCU *restrict mcu, u16 iv) {
+    ASSERT_BOUNDS(iv, 0, sizeof(mcu->flash) - 1);
+
+    // SP <- PC - 2
+    *mcu->sp -= 2;
+
+    // STACK <- PC
+    *(u16 *)&mcu->data[*mcu->sp] = mcu->pc;
+
+    // PC <- iv
+    mcu->pc = iv;
+
+    mcu->observed += 1;
+
+    return 4;
+}
+
+// decode the flash word at pc into its predecoded instruction
+static void decode(AVR_MCU *restrict mcu, u16 pc) {
+    ASSERT_BOUNDS(pc, 0, AVR_MCU_FLASH_SIZE / 2 - 1);
+
+    AVR_Instr *const instr = &mcu->decoded[pc];
+    const u16 op           = mcu->flash[pc];
+    const u16 next         = pc + 1 < AVR_MCU_FLASH_SIZE / 2 ? mcu->flash[pc + 1] : 0; // second word of 32 bit ops
+
+    // handler id comes from the generated table, only operands are unpacked here
+    instr->op  = avr_optable[op];
+    instr->len = 1 + IS_32BIT_OP(op);
+    instr->d     = 0;
+    instr->r     = 0;
+    instr->k     = 0;
+    instr->fused = FUSE_NONE;
+    instr->run   = 0;
+
+    switch (instr->op) {
+    case OP_ID_SUBI:
+    case OP_ID_SBCI:
+    case OP_ID_ANDI:
+    case OP_ID_ORI:
+    case OP_ID_CPI:
+    case OP_ID_LDI:
+        instr->d = MSH(op, 0x00F0, 4) + 16;
+        instr->r = MSH(op, 0x0F00, 4) | MSK(op, 0x000F);
+        break;
+    case OP_ID_RJMP:
+    case OP_ID_RCALL:
+        instr->k = (u16)I12_TO_I16(MSK(op, 0x0FFF));
+        break;
+    case OP_ID_IN:
+        instr->d = MSH(op, 0x01F0, 4);
+        instr->r = MSH(op, 0x0600, 5) | MSK(op, 0x000F);
+        break;
+    case OP_ID_OUT:
+        instr->d = MSH(op, 0x0600, 5) | MSK(op, 0x000F);
+        instr->r = MSH(op, 0x01F0, 4);
+        break;
+    case OP_ID_ADD:
+    case OP_ID_ADC:
+    case OP_ID_SUB:
+    case OP_ID_SBC:
+    case OP_ID_AND:
+    case OP_ID_OR:
+    case OP_ID_EOR:
+    case OP_ID_MUL:
+    case OP_ID_CPSE:
+    case OP_ID_CP:
+    case OP_ID_CPC:
+    case OP_ID_MOV:
+        instr->d = MSH(op, 0x01F0, 4);
+        instr->r = MSH(op, 0x0200, 5) | MSK(op, 0x000F);
+        break;
+    case OP_ID_BRBC:
+    case OP_ID_BRBS:
+        instr->d = MSK(op, 0x0007);
+        instr->r = (u8)I7_TO_I16(MSH(op, 0x03F8, 3));
+        break;
+    case OP_ID_SBRC:
+    case OP_ID_SBRS:
+    case OP_ID_BST:
+    case OP_ID_BLD:
+        instr->d = MSH(op, 0x01F0, 4);
+        instr->r = MSK(op, 0x0007);
+        break;
+    case OP_ID_JMP:
+    case OP_ID_CALL:
+        instr->k = next; // works because address space fits in 16bits
+        break;
+    case OP_ID_COM:
+    case OP_ID_NEG:
+    case OP_ID_INC:
+    case OP_ID_DEC:
+    case OP_ID_LSR:
+    case OP_ID_ROR:
+    case OP_ID_ASR:
+    case OP_ID_SWAP:
+    case OP_ID_LD_X:
+    case OP_ID_LD_X_POSTINC:
+    case OP_ID_LD_X_PREDEC:
+    case OP_ID_LD_Y:
+    case OP_ID_LD_Y_POSTINC:
+    case OP_ID_LD_Y_PREDEC:
+    case OP_ID_LD_Z:
+    case OP_ID_LD_Z_POSTINC:
+    case OP_ID_LD_Z_PREDEC:
+    case OP_ID_ST_X:
+    case OP_ID_ST_X_POSTINC:
+    case OP_ID_ST_X_PREDEC:
+    case OP_ID_ST_Y:
+    case OP_ID_ST_Y_POSTINC:
+    case OP_ID_ST_Y_PREDEC:
+    case OP_ID_ST_Z:
+    case OP_ID_ST_Z_POSTINC:
+    case OP_ID_ST_Z_PREDEC:
+    case OP_ID_LPM:
+    case OP_ID_LPM_POSTINC:
+    case OP_ID_PUSH:
+    case OP_ID_POP:
+        instr->d = MSH(op, 0x01F0, 4);
+        break;
+    case OP_ID_LDS:
+    case OP_ID_STS:
+        instr->d = MSH(op, 0x01F0, 4);
+        instr->k = next; // works because address space fits in 16bits
+        break;
+    case OP_ID_ADIW:
+        instr->d = MSH(op, 0x0030, 4);
+        instr->r = MSH(op, 0x00C0, 2) | MSK(op, 0x000F);
+        break;
+    case OP_ID_SBIW:
+        instr->d = MSH(op, 0x0030, 4) * 2 + 24;
+        instr->r = MSH(op, 0x00C0, 2) | MSK(op, 0x000F);
+        break;
+    case OP_ID_MULS:
+        instr->d = MSH(op, 0x00F0, 4) + 16;
+        instr->r = MSK(op, 0x000F) + 16;
+        break;
+    case OP_ID_SBIC:
+    case OP_ID_SBIS:
+    case OP_ID_SBI:
+    case OP_ID_CBI:
+        instr->d = MSH(op, 0x00F8, 3);
+        instr->r = MSK(op, 0x0007);
+        break;
+    case OP_ID_MOVW:
+        instr->d = MSH(op, 0x00F0, 4) * 2;
+        instr->r = MSK(op, 0x000F) * 2;
+        break;
+    case OP_ID_SER:
+        instr->d = MSH(op, 0x00F0, 4) + 16;
+        break;
+    case OP_ID_MULSU:
+    case OP_ID_FMUL:
+    case OP_ID_FMULS:
+    case OP_ID_FMULSU:
+        instr->d = MSH(op, 0x0070, 4) + 16;
+        instr->r = MSK(op, 0x0007) + 16;
+        break;
+    case OP_ID_BSET:
+    case OP_ID_BCLR:
+        instr->d = MSH(op, 0x0070, 4);
+        break;
+    case OP_ID_LDD_Y:
+    case OP_ID_LDD_Z:
+        instr->d = MSH(op, 0x01F0, 4);
+        instr->r = MSH(op, 0x2000, 8) | MSH(op, 0x0C00, 7) | MSK(op, 0x0007);
+        break;
+    case OP_ID_STD_Y:
+    case OP_ID_STD_Z:
+        instr->d = MSH(op, 0x2000, 8) | MSH(op, 0x0C00, 7) | MSK(op, 0x0007);
+        instr->r = MSH(op, 0x01F0, 4);
+        break;
+    }
+}
+
+// cycles of an instruction that may run inside a block, zero if it must be stepped
+// blocks only hold instructions that cannot touch peripherals, change control flow, or toggle interrupts
+static u8 block_cycles(const AVR_Instr *restrict instr) {
+    switch (instr->op) {
+    case OP_ID_SUBI:
+    case OP_ID_SBCI:
+    case OP_ID_ANDI:
+    case OP_ID_ORI:
+    case OP_ID_CPI:
+    case OP_ID_LDI:
+    case OP_ID_ADD:
+    case OP_ID_ADC:
+    case OP_ID_SUB:
+    case OP_ID_SBC:
+    case OP_ID_AND:
+    case OP_ID_OR:
+    case OP_ID_EOR:
+    case OP_ID_CP:
+    case OP_ID_CPC:
+    case OP_ID_MOV:
+    case OP_ID_COM:
+    case OP_ID_NEG:
+    case OP_ID_INC:
+    case OP_ID_DEC:
+    case OP_ID_LSR:
+    case OP_ID_ROR:
+    case OP_ID_ASR:
+    case OP_ID_SWAP:
+    case OP_ID_BST:
+    case OP_ID_BLD:
+    case OP_ID_MOVW:
+    case OP_ID_SER:
+    case OP_ID_NOP:
+    case OP_ID_WDR:
+        return 1;
+    case OP_ID_BSET:
+        return instr->d != SREG_I;
+    case OP_ID_BCLR: // clearing the global interrupt flag can only hold interrupts off
+        return 1;
+    case OP_ID_IN: // stack pointer and status register
+        return instr->r >= AVR_MCU_SP_OFFSET - AVR_MCU_IO_REG_OFFSET;
+    case OP_ID_OUT: // stack pointer
+        return instr->d == AVR_MCU_SP_OFFSET - AVR_MCU_IO_REG_OFFSET ||
+               instr->d == AVR_MCU_SP_OFFSET - AVR_MCU_IO_REG_OFFSET + 1;
+    case OP_ID_MUL:
+    case OP_ID_MULS:
+    case OP_ID_MULSU:
+    case OP_ID_FMUL:
+    case OP_ID_FMULS:
+    case OP_ID_FMULSU:
+    case OP_ID_ADIW:
+    case OP_ID_SBIW:
+    case OP_ID_PUSH:
+    case OP_ID_POP:
+        return 2;
+    case OP_ID_LDS:
+    case OP_ID_STS:
+        return instr->k >= AVR_MCU_SRAM_OFFSET ? 2 : 0;
+    case OP_ID_LPM:
+    case OP_ID_LPM_POSTINC:
+    case OP_ID_LPM_R0:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+// worst case cycles of a control flow instruction that may end a block, zero if it must be stepped
+// only register, sreg, and stack reads qualify, sbic/sbis read io and reti sets the global interrupt flag
+static u8 branch_cycles(const AVR_MCU *restrict mcu, u16 pc) {
+    switch (mcu->decoded[pc].op) {
+    case OP_ID_RJMP:
+    case OP_ID_IJMP:
+    case OP_ID_BRBC:
+    case OP_ID_BRBS:
+        return 2;
+    case OP_ID_JMP:
+    case OP_ID_RCALL:
+    case OP_ID_ICALL:
+        return 3;
+    case OP_ID_CALL:
+    case OP_ID_RET:
+        return 4;
+    case OP_ID_CPSE:
+    case OP_ID_SBRC:
+    case OP_ID_SBRS:
+        return pc + 1 < AVR_MCU_FLASH_SIZE / 2 ? 1 + mcu->decoded[pc + 1].len : 0;
+    default:
+        return 0;
+    }
+}
+
+// link the blocks starting at pc and every address before it, a block is its first instruction plus the block
+// after it, ending with the control flow instruction that follows if there is one
+static void link_blocks(AVR_MCU *restrict mcu, u16 pc) {
+    ASSERT_BOUNDS(pc, 0, AVR_MCU_FLASH_SIZE / 2 - 1);
+
+    for (i32 i = pc; i >= 0; i--) {
+        const AVR_Instr *const instr = &mcu->decoded[i];
+        AVR_Block *const block       = &mcu->blocks[i];
+        const u8 cycles              = block_cycles(instr);
+
+        if (cycles == 0) {
+            block->count  = 0;
+            block->cycles = 0;
+            block->span   = branch_cycles(mcu, i);
+            continue;
+        }
+
+        const u32 next              = i + instr->len;
+        const AVR_Block *const tail = next < AVR_MCU_FLASH_SIZE / 2 ? &mcu->blocks[next] : NULL;
+
+        // start over when the counters would overflow
+        if (tail && tail->count < UINT8_MAX && tail->span + cycles <= UINT8_MAX) {
+            block->count  = tail->count + 1;
+            block->cycles = tail->cycles + cycles;
+            block->span   = tail->span + cycles;
+        } else {
+            block->count  = 1;
+            block->cycles = cycles;
+            block->span   = cycles;
+        }
+    }
+}
+
+static inline bool is_branch(const AVR_Instr *restrict instr) {
+    return instr->op == OP_ID_BRBC || instr->op == OP_ID_BRBS;
+}
+
+// find the fused sequence starting at every address from hi down to lo, runs extend into the addresses after them
+static void fuse(AVR_MCU *restrict mcu, u16 lo, u16 hi) {
+    ASSERT_BOUNDS(hi, 0, AVR_MCU_FLASH_SIZE / 2 - 1);
+
+    for (i32 i = hi; i >= lo; i--) {
+        AVR_Instr *const instr = &mcu->decoded[i];
+        const AVR_Instr *next  = i + 1 < AVR_MCU_FLASH_SIZE / 2 ? &mcu->decoded[i + 1] : NULL;
+
+        instr->fused = FUSE_NONE;
+        instr->run   = 0;
+
+        if (next == NULL) {
+            continue;
+        }
+
+        switch (instr->op) {
+        case OP_ID_LDI:
+            if (next->op == OP_ID_LDI) {
+                instr->fused = FUSE_LDI_LDI;
+                instr->run   = 2;
+            }
+            break;
+        case OP_ID_CP:
+        case OP_ID_CPI: {
+            u8 n = 1;
+            while (n < 4 && i + n < AVR_MCU_FLASH_SIZE / 2 && mcu->decoded[i + n].op == OP_ID_CPC) {
+                n += 1;
+            }
+            if (n > 1 && i + n < AVR_MCU_FLASH_SIZE / 2 && is_branch(&mcu->decoded[i + n])) {
+                instr->fused = FUSE_CMP_BR;
+                instr->run   = n + 1;
+            }
+            break;
+        }
+        case OP_ID_PUSH:
+        case OP_ID_POP:
+            if (next->op == instr->op) {
+                instr->fused = instr->op == OP_ID_PUSH ? FUSE_PUSH : FUSE_POP;
+                instr->run   = next->fused == instr->fused && next->run < FUSE_MAX_RUN ? next->run + 1 : 2;
+            }
+            break;
+        case OP_ID_IN:
+            if (instr->r == AVR_MCU_SREG_OFFSET - AVR_MCU_IO_REG_OFFSET && next->op == OP_ID_BCLR &&
+                next->d == SREG_I) {
+                instr->fused = FUSE_IN_CLI;
+                instr->run   = 2;
+            }
+            break;
+        case OP_ID_SBIW:
+            if (is_branch(next)) {
+                instr->fused = FUSE_SBIW_BR;
+                instr->run   = 2;
+            }
+            break;
+        }
+    }
+}
+
+// mark the target of every backward branch or jump from lo to hi as a loop head, marks are only cleared by predecode
+// since a stale one costs a check in avr_run and nothing else
+static void mark_heads(AVR_MCU *restrict mcu, u16 lo, u16 hi) {
+    ASSERT_BOUNDS(hi, 0, AVR_MCU_FLASH_SIZE / 2 - 1);
+
+    for (u32 i = lo; i <= hi; i++) {
+        const AVR_Instr *const instr = &mcu->decoded[i];
+        u16 target;
+
+        switch (instr->op) {
+        case OP_ID_RJMP:
+            target = i + 1 + (i16)instr->k;
+            break;
+        case OP_ID_BRBC:
+        case OP_ID_BRBS:
+            target = i + 1 + (i8)instr->r;
+            break;
+        case OP_ID_JMP:
+            target = instr->k;
+            break;
+        default:
+            continue;
+        }
+
+        if (target <= i) {
+            mcu->blocks[target].head = true;
+        }
+    }
+}
+
+/*******************************************************************************
+ * Runtime Routines
+ ******************************************************************************/
+
+#ifndef AVR_NO_HLE
+// exact words of each routine from its entry to its ret, every branch inside is relative
+static const u16 hle_udivmodsi4[] = {
+    0xE2A1, 0x2E1A, 0x1BAA, 0x1BBB, 0x01FD, 0xC00D, 0x1FAA, 0x1FBB, 0x1FEE, 0x1FFF, 0x17A2, 0x07B3,
+    0x07E4, 0x07F5, 0xF020, 0x1BA2, 0x0BB3, 0x0BE4, 0x0BF5, 0x1F66, 0x1F77, 0x1F88, 0x1F99, 0x941A,
+    0xF769, 0x9560, 0x9570, 0x9580, 0x9590, 0x019B, 0x01AC, 0x01BD, 0x01CF, 0x9508,
+};
+static const u16 hle_udivmodhi4[] = {
+    0x1BAA, 0x1BBB, 0xE151, 0xC007, 0x1FAA, 0x1FBB, 0x17A6, 0x07B7, 0xF010, 0x1BA6,
+    0x0BB7, 0x1F88, 0x1F99, 0x955A, 0xF7A9, 0x9580, 0x9590, 0x01BC, 0x01CD, 0x9508,
+};
+static const u16 hle_memcpy[] = {0x01FB, 0x01DC, 0xC002, 0x9001, 0x920D, 0x5041, 0x4050, 0xF7D8, 0x9508};
+static const u16 hle_memset[] = {0x01DC, 0xC001, 0x936D, 0x5041, 0x4050, 0xF7E0, 0x9508};
+static const u16 hle_strcpy[] = {0x01FB, 0x01DC, 0x9001, 0x920D, 0x2000, 0xF7E1, 0x9508};
+static const u16 hle_strlen[] = {0x01FC, 0x9001, 0x2000, 0xF7E9, 0x9580, 0x9590, 0x0F8E, 0x1F9F, 0x9508};
+
+static const struct {
+    const u16 *words;
+    u8 len;
+} hle_sigs[HLE_COUNT] = {
+    [HLE_UDIVMODSI4] = {hle_udivmodsi4, sizeof(hle_udivmodsi4) / sizeof(u16)},
+    [HLE_UDIVMODHI4] = {hle_udivmodhi4, sizeof(hle_udivmodhi4) / sizeof(u16)},
+    [HLE_MEMCPY]     = {hle_memcpy, sizeof(hle_memcpy) / sizeof(u16)},
+    [HLE_MEMSET]     = {hle_memset, sizeof(hle_memset) / sizeof(u16)},
+    [HLE_STRCPY]     = {hle_strcpy, sizeof(hle_strcpy) / sizeof(u16)},
+    [HLE_STRLEN]     = {hle_strlen, sizeof(hle_strlen) / sizeof(u16)},
+};
+#endif
+
+// find the runtime routine entered at every address from lo to hi
+static void hle_scan(AVR_MCU *restrict mcu, u16 lo, u16 hi) {
+    ASSERT_BOUNDS(hi, 0, AVR_MCU_FLASH_SIZE / 2 - 1);
+
+    for (u32 i = lo; i <= hi; i++) {
+        mcu->blocks[i].hle = HLE_NONE;
+
+#ifndef AVR_NO_HLE
+        for (u8 id = HLE_NONE + 1; id < HLE_COUNT; id++) {
+            if (i + hle_sigs[id].len <= AVR_MCU_FLASH_SIZE / 2 &&
+                memcmp(&mcu->flash[i], hle_sigs[id].words, hle_sigs[id].len * sizeof(u16)) == 0) {
+                mcu->blocks[i].hle = id;
+                break;
+            }
+        }
+#endif
+    }
+}
+
+static inline u8 popcount(u32 x) {
+    u8 n = 0;
+    for (; x; x &= x - 1) {
+        n += 1;
+    }
+    return n;
+}
+
+// [addr, addr + n) lies in internal sram, where loads and stores have no side effects
+static inline bool in_sram(u32 addr, u32 n) {
+    return addr >= AVR_MCU_SRAM_OFFSET && addr + n <= AVR_MCU_DATA_SIZE;
+}
+
+// run the routine entered at pc through its ret, leaving registers, flags, memory, and the stack exactly as the
+// interpreted routine does, returns its cycles or zero to have it interpreted when it takes more than room cycles or
+// touches memory outside sram
+static u32 hle(AVR_MCU *restrict mcu, u8 id, u64 room) {
+    u8 *const reg = mcu->reg;
+    u32 cycles    = 0;
+
+    switch (id) {
+    case HLE_UDIVMODSI4: {
+        u32 a, b;
+        memcpy(&a, &reg[22], sizeof(a));
+        memcpy(&b, &reg[18], sizeof(b));
+
+        // dividing by zero sets every quotient bit and leaves the dividend as remainder
+        const u32 q = b ? a / b : UINT32_MAX;
+        const u32 r = b ? a % b : a;
+        const u32 n = ~q;
+
+        // a 33 step shift and subtract loop, a subtract for every set quotient bit costs 3 more than skipping it
+        cycles = 569 + 3 * popcount(q);
+        if (cycles > room) {
+            return 0;
+        }
+
+        // state at the end of the loop, H is left by adc r25 shifting in the last quotient bit
+        memcpy(&reg[22], &n, sizeof(n));
+        reg[26] = r, reg[27] = r >> 8, reg[30] = r >> 16, reg[31] = r >> 24;
+        reg[1]  = 0;
+        sreg_sync(mcu);
+        SET_BIT(*mcu->sreg, SREG_H, GET_BIT(n, 28));
+
+        com(mcu, 22), com(mcu, 23), com(mcu, 24), com(mcu, 25);
+        movw(mcu, 18, 22), movw(mcu, 20, 24), movw(mcu, 22, 26), movw(mcu, 24, 30);
+        break;
+    }
+    case HLE_UDIVMODHI4: {
+        const u16 a = *(u16 *)&reg[24];
+        const u16 b = *(u16 *)&reg[22];
+
+        const u16 q = b ? a / b : UINT16_MAX;
+        const u16 r = b ? a % b : a;
+        const u16 n = ~q;
+
+        // a 17 step shift and subtract loop, a subtract for every set quotient bit costs 1 more than skipping it
+        cycles = 193 + popcount(q);
+        if (cycles > room) {
+            return 0;
+        }
+
+        *(u16 *)&reg[24] = n;
+        *(u16 *)&reg[26] = r;
+        reg[21]          = 0;
+        sreg_sync(mcu);
+        SET_BIT(*mcu->sreg, SREG_H, GET_BIT(n, 12));
+
+        com(mcu, 24), com(mcu, 25);
+        movw(mcu, 22, 24), movw(mcu, 24, 26);
+        break;
+    }
+    case HLE_MEMCPY: {
+        const u16 dst = *(u16 *)&reg[24];
+        const u16 src = *(u16 *)&reg[22];
+        const u16 len = *(u16 *)&reg[20];
+
+        cycles = 11 + 7 * (u32)len;
+        if (cycles > room || !in_sram(dst, len) || !in_sram(src, len)) {
+            return 0;
+        }
+
+        // byte by byte like ld Z+; st X+ so overlapping copies come out the same
+        for (u16 i = 0; i < len; i++) {
+            mcu->data[dst + i] = mcu->data[src + i];
+        }
+        if (len) {
+            reg[0] = mcu->data[src + len - 1];
+        }
+        *(u16 *)&reg[REG_X] = dst + len;
+        *(u16 *)&reg[REG_Z] = src + len;
+
+        // count down that ends the loop
+        *(u16 *)&reg[20] = 0;
+        subi(mcu, 20, 1), sbci(mcu, 21, 0);
+        break;
+    }
+    case HLE_MEMSET: {
+        const u16 dst = *(u16 *)&reg[24];
+        const u16 len = *(u16 *)&reg[20];
+
+        cycles = 10 + 5 * (u32)len;
+        if (cycles > room || !in_sram(dst, len)) {
+            return 0;
+        }
+
+        memset(&mcu->data[dst], reg[22], len);
+        *(u16 *)&reg[REG_X] = dst + len;
+
+        *(u16 *)&reg[20] = 0;
+        subi(mcu, 20, 1), sbci(mcu, 21, 0);
+        break;
+    }
+    case HLE_STRCPY: {
+        const u16 dst = *(u16 *)&reg[24];
+        const u16 src = *(u16 *)&reg[22];
+
+        if (!in_sram(src, 1)) {
+            return 0;
+        }
+        const u8 *const end = memchr(&mcu->data[src], 0, AVR_MCU_DATA_SIZE - src);
+        if (end == NULL) {
+            return 0;
+        }
+
+        // bytes copied including the terminator, an overlapping copy may run into its own output so it is stepped
+        const u16 len = end - &mcu->data[src] + 1;
+        cycles        = 5 + 6 * (u32)len;
+        if (cycles > room || !in_sram(dst, len) || (dst < src + len && src < dst + len)) {
+            return 0;
+        }
+
+        memcpy(&mcu->data[dst], &mcu->data[src], len);
+        reg[0]              = 0;
+        *(u16 *)&reg[REG_X] = dst + len;
+        *(u16 *)&reg[REG_Z] = src + len;
+
+        // tst of the terminator that ends the loop
+        and(mcu, 0, 0);
+        break;
+    }
+    case HLE_STRLEN: {
+        const u16 src = *(u16 *)&reg[24];
+
+        if (!in_sram(src, 1)) {
+            return 0;
+        }
+        const u8 *const end = memchr(&mcu->data[src], 0, AVR_MCU_DATA_SIZE - src);
+        if (end == NULL) {
+            return 0;
+        }
+
+        // bytes loaded including the terminator
+        const u16 len = end - &mcu->data[src] + 1;
+        cycles        = 8 + 5 * (u32)len;
+        if (cycles > room) {
+            return 0;
+        }
+
+        reg[0]              = 0;
+        *(u16 *)&reg[REG_Z] = src + len;
+
+        // length is ~src + Z
+        com(mcu, 24), com(mcu, 25);
+        add(mcu, 24, 30), adc(mcu, 25, 31);
+        break;
+    }
+    default:
+        return 0;
+    }
+
+    (void)ret(mcu);
+
+    return cycles;
+}
+
+/*******************************************************************************
+ * Delay Loops
+ ******************************************************************************/
+
+// find the countdown loop starting at every address from lo to hi, a brne back to its first instruction ends it
+static void delay_scan(AVR_MCU *restrict mcu, u16 lo, u16 hi) {
+    ASSERT_BOUNDS(hi, 0, AVR_MCU_FLASH_SIZE / 2 - 1);
+
+    for (u32 i = lo; i <= hi; i++) {
+        const AVR_Instr *const instr = &mcu->decoded[i];
+        u8 id                        = DELAY_NONE;
+        u8 len                       = 1;
+
+        mcu->blocks[i].delay = DELAY_NONE;
+
+        switch (instr->op) {
+        case OP_ID_SBIW:
+            id = instr->r == 1 ? DELAY_SBIW : DELAY_NONE;
+            break;
+        case OP_ID_DEC:
+            id = DELAY_DEC;
+            break;
+        case OP_ID_SUBI:
+            // each sbci borrows into its own more significant byte
+            while (len < 3 && i + len < AVR_MCU_FLASH_SIZE / 2 && mcu->decoded[i + len].op == OP_ID_SBCI &&
+                   mcu->decoded[i + len].r == 0 && mcu->decoded[i + len].d != instr->d &&
+                   (len == 1 || mcu->decoded[i + len].d != mcu->decoded[i + 1].d)) {
+                len += 1;
+            }
+            id = instr->r == 1 ? DELAY_SUBI : DELAY_NONE;
+            break;
+        }
+
+        if (id == DELAY_NONE || i + len >= AVR_MCU_FLASH_SIZE / 2) {
+            continue;
+        }
+
+        const AVR_Instr *const brne = &mcu->decoded[i + len];
+        if (brne->op == OP_ID_BRBC && brne->d == SREG_Z && (i8)brne->r == -(len + 1)) {
+            mcu->blocks[i].delay = id;
+        }
+    }
+}
+
+// run the countdown loop at pc for as many iterations as end within room cycles, the last of them through its
+// instructions so flags and pc are exactly those of the interpreted loop, returns its cycles or zero to have it
+// interpreted when fewer than two iterations fit
+static u32 delay_loop(AVR_MCU *restrict mcu, u8 id, u64 room) {
+    const AVR_Instr *const instr = &mcu->decoded[mcu->pc];
+    u8 *counter[3];
+    u8 bytes;
+
+    switch (id) {
+    case DELAY_SBIW:
+        counter[0] = &mcu->reg[instr->d];
+        counter[1] = &mcu->reg[instr->d + 1];
+        bytes      = 2;
+        break;
+    case DELAY_DEC:
+        counter[0] = &mcu->reg[instr->d];
+        bytes      = 1;
+        break;
+    default:
+        for (bytes = 0; bytes < 3 && (bytes == 0 || instr[bytes].op == OP_ID_SBCI); bytes++) {
+            counter[bytes] = &mcu->reg[instr[bytes].d];
+        }
+        break;
+    }
+
+    // instructions before the brne and the cycles of an iteration that branches back
+    const u8 len  = id == DELAY_SUBI ? bytes : 1;
+    const u32 per = (id == DELAY_SBIW ? 2 : len) + 2;
+
+    u32 value = 0;
+    for (u8 i = 0; i < bytes; i++) {
+        value |= (u32)*counter[i] << (8 * i);
+    }
+
+    // a counter starting at zero wraps and runs every value
+    const u32 left = value ? value : 1u << (8 * bytes);
+    const u32 iter = (u32)MIN(left, room / per);
+    if (iter < 2) {
+        return 0;
+    }
+
+    value -= iter - 1;
+    for (u8 i = 0; i < bytes; i++) {
+        *counter[i] = value >> (8 * i);
+    }
+
+    u32 cycles = (iter - 1) * per;
+    switch (id) {
+    case DELAY_SBIW:
+        cycles += sbiw(mcu, instr->d, 1);
+        break;
+    case DELAY_DEC:
+        cycles += dec(mcu, instr->d);
+        break;
+    default:
+        cycles += subi(mcu, instr->d, 1);
+        for (u8 i = 1; i < len; i++) {
+            cycles += sbci(mcu, instr[i].d, 0);
+        }
+        break;
+    }
+    cycles += brbc(mcu, SREG_Z, (i8)instr[len].r);
+
+    return cycles;
+}
+
+// decode all of flash, used after flash is (re)written
+static void predecode(AVR_MCU *restrict mcu) {
+    for (u16 pc = 0; pc < AVR_MCU_FLASH_SIZE / 2; pc++) {
+        decode(mcu, pc);
+    }
+
+    link_blocks(mcu, AVR_MCU_FLASH_SIZE / 2 - 1);
+    fuse(mcu, 0, AVR_MCU_FLASH_SIZE / 2 - 1);
+    hle_scan(mcu, 0, AVR_MCU_FLASH_SIZE / 2 - 1);
+    delay_scan(mcu, 0, AVR_MCU_FLASH_SIZE / 2 - 1);
+    mcu->native = NULL;
+
+    for (u32 pc = 0; pc < AVR_MCU_FLASH_SIZE / 2; pc++) {
+        mcu->blocks[pc].head = false;
+        mcu->blocks[pc].heat = 0;
+    }
+    mark_heads(mcu, 0, AVR_MCU_FLASH_SIZE / 2 - 1);
+    mcu->hot_blocks = 0;
+
+    mcu->hle_sites   = 0;
+    mcu->delay_sites = 0;
+    for (u32 pc = 0; pc < AVR_MCU_FLASH_SIZE / 2; pc++) {
+        mcu->hle_sites += mcu->blocks[pc].hle != HLE_NONE;
+        mcu->delay_sites += mcu->blocks[pc].delay != DELAY_NONE;
+    }
+
+    // count sites walking instruction by instruction, a run covers the instructions after it
+    mcu->fused_sites = 0;
+    for (u32 pc = 0; pc < AVR_MCU_FLASH_SIZE / 2;) {
+        const AVR_Instr *const instr = &mcu->decoded[pc];
+
+        if (instr->fused) {
+            mcu->fused_sites += 1;
+            pc += instr->run;
+        } else {
+            pc += instr->len;
+        }
+    }
+}
+
+void avr_mcu_init(AVR_MCU *restrict mcu) {
+    memset(mcu, 0, sizeof(*mcu));
+
+    mcu->sreg       = &mcu->data[AVR_MCU_SREG_OFFSET];
+    mcu->sp         = (u16 *)&mcu->data[AVR_MCU_SP_OFFSET];
+    mcu->reg        = &mcu->data[AVR_MCU_REG_OFFSET];
+    mcu->io_reg     = &mcu->data[AVR_MCU_IO_REG_OFFSET];
+    mcu->ext_io_reg = &mcu->data[AVR_MCU_EXT_IO_REG_OFFSET];
+    mcu->sram       = &mcu->data[AVR_MCU_SRAM_OFFSET];
+
+    *mcu->sp    = AVR_MCU_RAMEND;
+    mcu->osc_hz = AVR_MCU_CLK_SPEED;
+
+    memset(mcu->schedule.pos, AVR_EVENT_COUNT, sizeof(mcu->schedule.pos));
+    mcu->irq = IRQ_STALE;
+
+    // read only bits that reset to one, io_hooks keeps stores from clearing them
+    mcu->data[REG_UCSR0A] |= 0x20; // 0010 0000
+    mcu->data[REG_UCSR0C] |= 0x06; // 0000 0110
+
+    predecode(mcu);
+}
+
+void avr_set_clock(AVR_MCU *restrict mcu, uint32_t hz) {
+    mcu->ns     = emulated_ns(mcu);
+    mcu->ns_clk = mcu->clk;
+    mcu->osc_hz = hz < OSC_HZ_MIN ? OSC_HZ_MIN : hz;
+}
+
+void avr_set_callbacks(AVR_MCU *restrict mcu, const AVR_Callbacks *restrict callbacks) {
+    mcu->callbacks = callbacks ? *callbacks : (AVR_Callbacks){0};
+}
+
+AVR_Result avr_program(AVR_MCU *restrict mcu, const char *restrict hex) {
+    while (*hex) {
+        if (*hex != ':') {
+            hex += 1;
+            continue;
+        }
+
+        hex += 1;
+
+        const u8 len = xstr2byte(hex);
+        hex += 2;
+
+        const u16 addr = (xstr2byte(hex) << 8) | xstr2byte(hex + 2);
+        hex += 4;
+
+        const u8 type = xstr2byte(hex);
+        hex += 2;
+
+        switch (type) {
+        case DATA_RECORD: {
+            u8 checksum = len + (addr >> 8) + (addr & 0xFF) + type;
+
+            for (u8 i = 0; i < len; i++) {
+                const u8 b = xstr2byte(hex);
+                hex += 2;
+
+                ((u8 *)mcu->flash)[addr + i] = b;
+                checksum += b;
+            }
+
+            checksum = TWO_COMP(checksum);
 
             if (checksum != xstr2byte(hex)) {
                 LOG_ERROR("checksum failure: real %#x, expected %#x", checksum, xstr2byte(hex));
@@ -2177,6 +3517,9 @@ AVR_Result avr_program(AVR_MCU *restrict mcu, const char *restrict hex) {
             LOG_DEBUG("record %d encountered", type);
             break;
         case EOF_RECORD:
+            predecode(mcu);
+            LOG_DEBUG("fused %u sites, %u runtime routines, %u delay loops", mcu->fused_sites, mcu->hle_sites,
+                      mcu->delay_sites);
             return AVR_OK;
         default:
             LOG_ERROR("unknown record type");
@@ -2187,704 +3530,964 @@ AVR_Result avr_program(AVR_MCU *restrict mcu, const char *restrict hex) {
     return AVR_ERROR;
 }
 
-int avr_execute(AVR_MCU *const restrict mcu) {
+// dispatch on handler id, direct threaded through a label table where the compiler supports computed goto
+#if defined(__GNUC__) && !defined(AVR_NO_COMPUTED_GOTO)
+#define OP_LABEL(NAME) __extension__ &&op_##NAME,
+#define OP_DISPATCH(ID)                                                             \
+    _Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wpedantic\"") \
+        goto *op_labels[(ID)];                                                      \
+    _Pragma("GCC diagnostic pop")
+#define OP_CASE(NAME) op_##NAME
+#else
+#define OP_DISPATCH(ID) switch (ID)
+#define OP_CASE(NAME)   case OP_ID_##NAME
+#endif
+
+static inline int execute(AVR_MCU *const restrict mcu) {
     ASSERT_BOUNDS(*mcu->sp, AVR_MCU_SRAM_OFFSET, AVR_MCU_DATA_SIZE - 1);
     ASSERT_BOUNDS(mcu->pc, 0, AVR_MCU_FLASH_SIZE - 1);
 
-    const u16 op = mcu->flash[mcu->pc];
-
-    /***************************************************************************
-     * 4 bit op
-     **************************************************************************/
-    switch (op & OP_MASK_4) {
-    case OP_SUBI: {
-        const u8 d = MSH(op, 0x00F0, 4) + 16;
-        const u8 K = MSH(op, 0x0F00, 4) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d %-8d", "subi", d, K);
-        return subi(mcu, d, K);
-    }
-    case OP_SBCI: {
-        const u8 d = MSH(op, 0x00F0, 4) + 16;
-        const u8 K = MSH(op, 0x0F00, 4) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d %-8d", "sbci", d, K);
-        return sbci(mcu, d, K);
-    }
-    case OP_ANDI: {
-        const u8 d = MSH(op, 0x00F0, 4) + 16;
-        const u8 K = MSH(op, 0x0F00, 4) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d %-8d", "andi", d, K);
-        return andi(mcu, d, K);
-    }
-    case OP_ORI: {
-        const u8 d = MSH(op, 0x00F0, 4) + 16;
-        const u8 K = MSH(op, 0x0F00, 4) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d %-8d", "ori", d, K);
-        return ori(mcu, d, K);
-    }
-    case OP_RJMP: {
-        const i16 k = I12_TO_I16(MSK(op, 0x0FFF));
-        PRINT_DEBUG("%-8s %-17d", "rjmp", k);
-        return rjmp(mcu, k);
-    }
-    case OP_RCALL: {
-        const i16 k = I12_TO_I16(MSK(op, 0x0FFF));
-        PRINT_DEBUG("%-8s %-17d", "rcall", k);
-        return rcall(mcu, k);
-    }
-    case OP_CPI: {
-        const u8 d = MSH(op, 0x00F0, 4) + 16;
-        const u8 K = MSH(op, 0x0F00, 4) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d %-8d", "cpi", d, K);
-        return cpi(mcu, d, K);
-    }
-    case OP_LDI: {
-        const u8 d = MSH(op, 0x00F0, 4) + 16;
-        const u8 K = MSH(op, 0x0F00, 4) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d %-8d", "ldi", d, K);
-        return ldi(mcu, d, K);
-    }
-    }
-
-    /***************************************************************************
-     * 5 bit op
-     **************************************************************************/
-    switch (op & OP_MASK_5) {
-    case OP_IN: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 A = MSH(op, 0x0600, 5) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d %-8d", "in", d, A);
-        return in(mcu, d, A);
-    }
-    case OP_OUT: {
-        const u8 A = MSH(op, 0x0600, 5) | MSK(op, 0x000F);
-        const u8 r = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s %-8d r%-7d", "out", A, r);
-        return out(mcu, A, r);
-    }
-    }
-
-    /***************************************************************************
-     * 6 bit op
-     **************************************************************************/
-    switch (op & OP_MASK_6) {
-    case OP_ADD: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 r = MSH(op, 0x0200, 5) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "add", d, r);
-        return add(mcu, d, r);
-    }
-    case OP_ADC: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 r = MSH(op, 0x0200, 5) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "adc", d, r);
-        return adc(mcu, d, r);
-    }
-    case OP_SUB: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 r = MSH(op, 0x0200, 5) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "sub", d, r);
-        return sub(mcu, d, r);
-    }
-    case OP_SBC: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 r = MSH(op, 0x0200, 5) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "sbc", d, r);
-        return sbc(mcu, d, r);
-    }
-    case OP_AND: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 r = MSH(op, 0x0200, 5) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "and", d, r);
-        return and(mcu, d, r);
-    }
-    case OP_OR: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 r = MSH(op, 0x0200, 5) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "or", d, r);
-        return or (mcu, d, r);
-    }
-    case OP_EOR: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 r = MSH(op, 0x0200, 5) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "eor", d, r);
-        return eor(mcu, d, r);
-    }
-    case OP_MUL: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 r = MSH(op, 0x0200, 5) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "mul", d, r);
-        return mul(mcu, d, r);
-    }
-    case OP_CPSE: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 r = MSH(op, 0x0200, 5) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "cpse", d, r);
-        return cpse(mcu, d, r);
-    }
-    case OP_CP: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 r = MSH(op, 0x0200, 5) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "cp", d, r);
-        return cp(mcu, d, r);
-    }
-    case OP_CPC: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 r = MSH(op, 0x0200, 5) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "cpc", d, r);
-        return cpc(mcu, d, r);
-    }
-    case OP_BRBC: {
-        const u8 s = MSK(op, 0x0007);
-        const i8 k = I7_TO_I16(MSH(op, 0x03F8, 3));
-        PRINT_DEBUG("%-8s %-8d %-8d", "brbc", s, k);
-        return brbc(mcu, s, k);
-    }
-    case OP_BRBS: {
-        const u8 s = MSK(op, 0x0007);
-        const i8 k = I7_TO_I16(MSH(op, 0x03F8, 3));
-        PRINT_DEBUG("%-8s %-8d %-8d", "brbs", s, k);
-        return brbs(mcu, s, k);
-    }
-    case OP_MOV: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 r = MSH(op, 0x0200, 5) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "mov", d, r);
-        return mov(mcu, d, r);
-    }
-    }
-
-    /***************************************************************************
-     * 7 bit op
-     **************************************************************************/
-    switch (op & OP_MASK_7_1) {
-    case OP_SBRC: {
-        const u8 r = MSH(op, 0x01F0, 4);
-        const u8 b = MSK(op, 0x0007);
-        PRINT_DEBUG("%-8s r%-7d %-8d", "sbrc", r, b);
-        return sbrc(mcu, r, b);
-    }
-    case OP_SBRS: {
-        const u8 r = MSH(op, 0x01F0, 4);
-        const u8 b = MSK(op, 0x0007);
-        PRINT_DEBUG("%-8s r%-7d %-8d", "sbrs", r, b);
-        return sbrs(mcu, r, b);
-    }
-    case OP_BST: {
-        const u8 r = MSH(op, 0x01F0, 4);
-        const u8 b = MSK(op, 0x0007);
-        PRINT_DEBUG("%-8s r%-7d %-8d", "bst", r, b);
-        return bst(mcu, r, b);
-    }
-    case OP_BLD: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 b = MSK(op, 0x0007);
-        PRINT_DEBUG("%-8s r%-7d %-8d", "bld", d, b);
-        return bld(mcu, d, b);
-    }
-    }
-
-    switch (op & OP_MASK_7_3) {
-    case OP_JMP: {
-        const u16 k = mcu->flash[mcu->pc + 1]; // works because address space fits in 16bits
-        PRINT_DEBUG("%-8s %-17d", "jmp", k);
-        return jmp(mcu, k);
-    }
-    case OP_CALL: {
-        const u16 k = mcu->flash[mcu->pc + 1]; // works because address space fits in 16bits
-        PRINT_DEBUG("%-8s %-17d", "call", k);
-        return call(mcu, k);
-    }
-    }
-
-    switch (op & OP_MASK_7_4) {
-    case OP_COM: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "com", d);
-        return com(mcu, d);
-    }
-    case OP_NEG: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "neg", d);
-        return neg(mcu, d);
-    }
-    case OP_INC: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "inc", d);
-        return inc(mcu, d);
-    }
-    case OP_DEC: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "dec", d);
-        return dec(mcu, d);
-    }
-    case OP_LSR: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "lsr", d);
-        return lsr(mcu, d);
-    }
-    case OP_ROR: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "ror", d);
-        return ror(mcu, d);
-    }
-    case OP_ASR: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "asr", d);
-        return asr(mcu, d);
-    }
-    case OP_SWAP: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "swap", d);
-        return swap(mcu, d);
-    }
-    case OP_LD_X: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "ld(X)", d);
-        return ld_x(mcu, d);
-    }
-    case OP_LD_X_POSTINC: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "ld(X+)", d);
-        return ld_x_postinc(mcu, d);
-    }
-    case OP_LD_X_PREDEC: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "ld(-X)", d);
-        return ld_x_predec(mcu, d);
-    }
-    case OP_LD_Y: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "ld(Y)", d);
-        return ld_y(mcu, d);
-    }
-    case OP_LD_Y_POSTINC: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "ld(Y+)", d);
-        return ld_y_postinc(mcu, d);
-    }
-    case OP_LD_Y_PREDEC: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "ld(-Y)", d);
-        return ld_y_predec(mcu, d);
-    }
-    case OP_LD_Z: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "ld(Z)", d);
-        return ld_z(mcu, d);
-    }
-    case OP_LD_Z_POSTINC: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "ld(Z+)", d);
-        return ld_z_postinc(mcu, d);
-    }
-    case OP_LD_Z_PREDEC: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "ld(-Z)", d);
-        return ld_z_predec(mcu, d);
-    }
-    case OP_LDS: {
-        const u8 d  = MSH(op, 0x01F0, 4);
-        const u16 k = mcu->flash[mcu->pc + 1];
-        PRINT_DEBUG("%-8s r%-16d", "lds", d);
-        return lds(mcu, d, k);
-    }
-    case OP_ST_X: {
-        const u8 r = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "st(X)", r);
-        return st_x(mcu, r);
-    }
-    case OP_ST_X_POSTINC: {
-        const u8 r = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "st(X+)", r);
-        return st_x_postinc(mcu, r);
-    }
-    case OP_ST_X_PREDEC: {
-        const u8 r = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "st(-X)", r);
-        return st_x_predec(mcu, r);
-    }
-    case OP_ST_Y: {
-        const u8 r = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "st(Y)", r);
-        return st_y(mcu, r);
-    }
-    case OP_ST_Y_POSTINC: {
-        const u8 r = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "st(Y+)", r);
-        return st_y_postinc(mcu, r);
-    }
-    case OP_ST_Y_PREDEC: {
-        const u8 r = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "st(-Y)", r);
-        return st_y_predec(mcu, r);
-    }
-    case OP_ST_Z: {
-        const u8 r = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "st(Z)", r);
-        return st_z(mcu, r);
-    }
-    case OP_ST_Z_POSTINC: {
-        const u8 r = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "st(Z+)", r);
-        return st_z_postinc(mcu, r);
-    }
-    case OP_ST_Z_PREDEC: {
-        const u8 r = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "st(-Z)", r);
-        return st_z_predec(mcu, r);
-    }
-    case OP_STS: {
-        const u16 k = mcu->flash[mcu->pc + 1];
-        const u8 r  = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "sts", r);
-        return sts(mcu, k, r);
-    }
-    case OP_LPM: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "lpm", d);
-        return lpm(mcu, d);
-    }
-    case OP_LPM_POSTINC: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "lpm(+)", d);
-        return lpm_postinc(mcu, d);
-    }
-    case OP_PUSH: {
-        const u8 r = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "push", r);
-        return push(mcu, r);
-    }
-    case OP_POP: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s r%-16d", "pop", d);
-        return pop(mcu, d);
-    }
-    }
-
-    /***************************************************************************
-     * 8 bit op
-     **************************************************************************/
-    switch (op & OP_MASK_8) {
-    case OP_ADIW: {
-        const u8 d = MSH(op, 0x0030, 4);
-        const u8 K = MSH(op, 0x00C0, 2) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d %-8d", "adiw", d, K);
-        return adiw(mcu, d, K);
-    }
-    case OP_SBIW: {
-        const u8 d = MSH(op, 0x0030, 4) * 2 + 24;
-        const u8 K = MSH(op, 0x00C0, 2) | MSK(op, 0x000F);
-        PRINT_DEBUG("%-8s r%-7d %-8d", "sbiw", d, K);
-        return sbiw(mcu, d, K);
-    }
-    case OP_MULS: {
-        const u8 d = MSH(op, 0x00F0, 4) + 16;
-        const u8 r = MSK(op, 0x000F) + 16;
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "muls", d, r);
-        return muls(mcu, d, r);
-    }
-    case OP_SBIC: {
-        const u8 A = MSH(op, 0x00F8, 3);
-        const u8 b = MSK(op, 0x0007);
-        PRINT_DEBUG("%-8s %-8d %-8d", "sbic", A, b);
-        return sbic(mcu, A, b);
-    }
-    case OP_SBIS: {
-        const u8 A = MSH(op, 0x00F8, 3);
-        const u8 b = MSK(op, 0x0007);
-        PRINT_DEBUG("%-8s %-8d %-8d", "sbis", A, b);
-        return sbis(mcu, A, b);
-    }
-    case OP_SBI: {
-        const u8 A = MSH(op, 0x00F8, 3);
-        const u8 b = MSK(op, 0x0007);
-        PRINT_DEBUG("%-8s %-8d %-8d", "sbi", A, b);
-        return sbi(mcu, A, b);
-    }
-    case OP_CBI: {
-        const u8 A = MSH(op, 0x00F8, 3);
-        const u8 b = MSK(op, 0x0007);
-        PRINT_DEBUG("%-8s %-8d %-8d", "cbi", A, b);
-        return cbi(mcu, A, b);
-    }
-    case OP_MOVW: {
-        const u8 d = MSH(op, 0x00F0, 4) * 2;
-        const u8 r = MSK(op, 0x000F) * 2;
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "movw", d, r);
-        return movw(mcu, d, r);
-    }
-    }
-
-    switch (op & OP_MASK_8_4) {
-    case OP_SER: {
-        const u8 d = MSH(op, 0x00F0, 4) + 16;
-        PRINT_DEBUG("%-8s r%-7d", "ser", d);
-        return ser(mcu, d);
-    }
-    }
-
-    /***************************************************************************
-     * 9 bit op
-     **************************************************************************/
-    switch (op & OP_MASK_9_1) {
-    case OP_MULSU: {
-        const u8 d = MSH(op, 0x0070, 4) + 16;
-        const u8 r = MSK(op, 0x0007) + 16;
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "mulsu", d, r);
-        return mulsu(mcu, d, r);
-    }
-    case OP_FMUL: {
-        const u8 d = MSH(op, 0x0070, 4) + 16;
-        const u8 r = MSK(op, 0x0007) + 16;
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "fmul", d, r);
-        return fmul(mcu, d, r);
-    }
-    case OP_FMULS: {
-        const u8 d = MSH(op, 0x0070, 4) + 16;
-        const u8 r = MSK(op, 0x0007) + 16;
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "fmuls", d, r);
-        return fmuls(mcu, d, r);
-    }
-    case OP_FMULSU: {
-        const u8 d = MSH(op, 0x0070, 4) + 16;
-        const u8 r = MSK(op, 0x0007) + 16;
-        PRINT_DEBUG("%-8s r%-7d r%-7d", "fmulsu", d, r);
-        return fmulsu(mcu, d, r);
-    }
-    }
-
-    switch (op & OP_MASK_9_4) {
-    case OP_BSET: {
-        const u8 s = MSH(op, 0x0070, 4);
-        PRINT_DEBUG("%-8s %-17d", "bset", s);
-        return bset(mcu, s);
-    }
-    case OP_BCLR: {
-        const u8 s = MSH(op, 0x0070, 4);
-        PRINT_DEBUG("%-8s %-17d", "bclr", s);
-        return bclr(mcu, s);
-    }
-    }
-
-    /***************************************************************************
-     * 16 bit op
-     **************************************************************************/
-    switch (op) {
-    case OP_IJMP:
+    const AVR_Instr *const instr = &mcu->decoded[mcu->pc];
+
+#if defined(__GNUC__) && !defined(AVR_NO_COMPUTED_GOTO)
+    static const void *const op_labels[OP_ID_COUNT] = {OP_ID_LIST(OP_LABEL)};
+#endif
+
+    OP_DISPATCH(instr->op) {
+    OP_CASE(SUBI):
+        PRINT_DEBUG("%-8s r%-7d %-8d", "subi", instr->d, instr->r);
+        return subi(mcu, instr->d, instr->r);
+    OP_CASE(SBCI):
+        PRINT_DEBUG("%-8s r%-7d %-8d", "sbci", instr->d, instr->r);
+        return sbci(mcu, instr->d, instr->r);
+    OP_CASE(ANDI):
+        PRINT_DEBUG("%-8s r%-7d %-8d", "andi", instr->d, instr->r);
+        return andi(mcu, instr->d, instr->r);
+    OP_CASE(ORI):
+        PRINT_DEBUG("%-8s r%-7d %-8d", "ori", instr->d, instr->r);
+        return ori(mcu, instr->d, instr->r);
+    OP_CASE(RJMP):
+        PRINT_DEBUG("%-8s %-17d", "rjmp", (i16)instr->k);
+        return rjmp(mcu, (i16)instr->k);
+    OP_CASE(RCALL):
+        PRINT_DEBUG("%-8s %-17d", "rcall", (i16)instr->k);
+        return rcall(mcu, (i16)instr->k);
+    OP_CASE(CPI):
+        PRINT_DEBUG("%-8s r%-7d %-8d", "cpi", instr->d, instr->r);
+        return cpi(mcu, instr->d, instr->r);
+    OP_CASE(LDI):
+        PRINT_DEBUG("%-8s r%-7d %-8d", "ldi", instr->d, instr->r);
+        return ldi(mcu, instr->d, instr->r);
+    OP_CASE(IN):
+        PRINT_DEBUG("%-8s r%-7d %-8d", "in", instr->d, instr->r);
+        return in(mcu, instr->d, instr->r);
+    OP_CASE(OUT):
+        PRINT_DEBUG("%-8s %-8d r%-7d", "out", instr->d, instr->r);
+        return out(mcu, instr->d, instr->r);
+    OP_CASE(ADD):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "add", instr->d, instr->r);
+        return add(mcu, instr->d, instr->r);
+    OP_CASE(ADC):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "adc", instr->d, instr->r);
+        return adc(mcu, instr->d, instr->r);
+    OP_CASE(SUB):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "sub", instr->d, instr->r);
+        return sub(mcu, instr->d, instr->r);
+    OP_CASE(SBC):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "sbc", instr->d, instr->r);
+        return sbc(mcu, instr->d, instr->r);
+    OP_CASE(AND):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "and", instr->d, instr->r);
+        return and(mcu, instr->d, instr->r);
+    OP_CASE(OR):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "or", instr->d, instr->r);
+        return or(mcu, instr->d, instr->r);
+    OP_CASE(EOR):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "eor", instr->d, instr->r);
+        return eor(mcu, instr->d, instr->r);
+    OP_CASE(MUL):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "mul", instr->d, instr->r);
+        return mul(mcu, instr->d, instr->r);
+    OP_CASE(CPSE):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "cpse", instr->d, instr->r);
+        return cpse(mcu, instr->d, instr->r);
+    OP_CASE(CP):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "cp", instr->d, instr->r);
+        return cp(mcu, instr->d, instr->r);
+    OP_CASE(CPC):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "cpc", instr->d, instr->r);
+        return cpc(mcu, instr->d, instr->r);
+    OP_CASE(BRBC):
+        PRINT_DEBUG("%-8s %-8d %-8d", "brbc", instr->d, (i8)instr->r);
+        return brbc(mcu, instr->d, (i8)instr->r);
+    OP_CASE(BRBS):
+        PRINT_DEBUG("%-8s %-8d %-8d", "brbs", instr->d, (i8)instr->r);
+        return brbs(mcu, instr->d, (i8)instr->r);
+    OP_CASE(MOV):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "mov", instr->d, instr->r);
+        return mov(mcu, instr->d, instr->r);
+    OP_CASE(SBRC):
+        PRINT_DEBUG("%-8s r%-7d %-8d", "sbrc", instr->d, instr->r);
+        return sbrc(mcu, instr->d, instr->r);
+    OP_CASE(SBRS):
+        PRINT_DEBUG("%-8s r%-7d %-8d", "sbrs", instr->d, instr->r);
+        return sbrs(mcu, instr->d, instr->r);
+    OP_CASE(BST):
+        PRINT_DEBUG("%-8s r%-7d %-8d", "bst", instr->d, instr->r);
+        return bst(mcu, instr->d, instr->r);
+    OP_CASE(BLD):
+        PRINT_DEBUG("%-8s r%-7d %-8d", "bld", instr->d, instr->r);
+        return bld(mcu, instr->d, instr->r);
+    OP_CASE(JMP):
+        PRINT_DEBUG("%-8s %-17d", "jmp", instr->k);
+        return jmp(mcu, instr->k);
+    OP_CASE(CALL):
+        PRINT_DEBUG("%-8s %-17d", "call", instr->k);
+        return call(mcu, instr->k);
+    OP_CASE(COM):
+        PRINT_DEBUG("%-8s r%-16d", "com", instr->d);
+        return com(mcu, instr->d);
+    OP_CASE(NEG):
+        PRINT_DEBUG("%-8s r%-16d", "neg", instr->d);
+        return neg(mcu, instr->d);
+    OP_CASE(INC):
+        PRINT_DEBUG("%-8s r%-16d", "inc", instr->d);
+        return inc(mcu, instr->d);
+    OP_CASE(DEC):
+        PRINT_DEBUG("%-8s r%-16d", "dec", instr->d);
+        return dec(mcu, instr->d);
+    OP_CASE(LSR):
+        PRINT_DEBUG("%-8s r%-16d", "lsr", instr->d);
+        return lsr(mcu, instr->d);
+    OP_CASE(ROR):
+        PRINT_DEBUG("%-8s r%-16d", "ror", instr->d);
+        return ror(mcu, instr->d);
+    OP_CASE(ASR):
+        PRINT_DEBUG("%-8s r%-16d", "asr", instr->d);
+        return asr(mcu, instr->d);
+    OP_CASE(SWAP):
+        PRINT_DEBUG("%-8s r%-16d", "swap", instr->d);
+        return swap(mcu, instr->d);
+    OP_CASE(LD_X):
+        PRINT_DEBUG("%-8s r%-16d", "ld(X)", instr->d);
+        return ld_x(mcu, instr->d);
+    OP_CASE(LD_X_POSTINC):
+        PRINT_DEBUG("%-8s r%-16d", "ld(X+)", instr->d);
+        return ld_x_postinc(mcu, instr->d);
+    OP_CASE(LD_X_PREDEC):
+        PRINT_DEBUG("%-8s r%-16d", "ld(-X)", instr->d);
+        return ld_x_predec(mcu, instr->d);
+    OP_CASE(LD_Y):
+        PRINT_DEBUG("%-8s r%-16d", "ld(Y)", instr->d);
+        return ld_y(mcu, instr->d);
+    OP_CASE(LD_Y_POSTINC):
+        PRINT_DEBUG("%-8s r%-16d", "ld(Y+)", instr->d);
+        return ld_y_postinc(mcu, instr->d);
+    OP_CASE(LD_Y_PREDEC):
+        PRINT_DEBUG("%-8s r%-16d", "ld(-Y)", instr->d);
+        return ld_y_predec(mcu, instr->d);
+    OP_CASE(LD_Z):
+        PRINT_DEBUG("%-8s r%-16d", "ld(Z)", instr->d);
+        return ld_z(mcu, instr->d);
+    OP_CASE(LD_Z_POSTINC):
+        PRINT_DEBUG("%-8s r%-16d", "ld(Z+)", instr->d);
+        return ld_z_postinc(mcu, instr->d);
+    OP_CASE(LD_Z_PREDEC):
+        PRINT_DEBUG("%-8s r%-16d", "ld(-Z)", instr->d);
+        return ld_z_predec(mcu, instr->d);
+    OP_CASE(LDS):
+        PRINT_DEBUG("%-8s r%-16d", "lds", instr->d);
+        return lds(mcu, instr->d, instr->k);
+    OP_CASE(ST_X):
+        PRINT_DEBUG("%-8s r%-16d", "st(X)", instr->d);
+        return st_x(mcu, instr->d);
+    OP_CASE(ST_X_POSTINC):
+        PRINT_DEBUG("%-8s r%-16d", "st(X+)", instr->d);
+        return st_x_postinc(mcu, instr->d);
+    OP_CASE(ST_X_PREDEC):
+        PRINT_DEBUG("%-8s r%-16d", "st(-X)", instr->d);
+        return st_x_predec(mcu, instr->d);
+    OP_CASE(ST_Y):
+        PRINT_DEBUG("%-8s r%-16d", "st(Y)", instr->d);
+        return st_y(mcu, instr->d);
+    OP_CASE(ST_Y_POSTINC):
+        PRINT_DEBUG("%-8s r%-16d", "st(Y+)", instr->d);
+        return st_y_postinc(mcu, instr->d);
+    OP_CASE(ST_Y_PREDEC):
+        PRINT_DEBUG("%-8s r%-16d", "st(-Y)", instr->d);
+        return st_y_predec(mcu, instr->d);
+    OP_CASE(ST_Z):
+        PRINT_DEBUG("%-8s r%-16d", "st(Z)", instr->d);
+        return st_z(mcu, instr->d);
+    OP_CASE(ST_Z_POSTINC):
+        PRINT_DEBUG("%-8s r%-16d", "st(Z+)", instr->d);
+        return st_z_postinc(mcu, instr->d);
+    OP_CASE(ST_Z_PREDEC):
+        PRINT_DEBUG("%-8s r%-16d", "st(-Z)", instr->d);
+        return st_z_predec(mcu, instr->d);
+    OP_CASE(STS):
+        PRINT_DEBUG("%-8s r%-16d", "sts", instr->d);
+        return sts(mcu, instr->k, instr->d);
+    OP_CASE(LPM):
+        PRINT_DEBUG("%-8s r%-16d", "lpm", instr->d);
+        return lpm(mcu, instr->d);
+    OP_CASE(LPM_POSTINC):
+        PRINT_DEBUG("%-8s r%-16d", "lpm(+)", instr->d);
+        return lpm_postinc(mcu, instr->d);
+    OP_CASE(PUSH):
+        PRINT_DEBUG("%-8s r%-16d", "push", instr->d);
+        return push(mcu, instr->d);
+    OP_CASE(POP):
+        PRINT_DEBUG("%-8s r%-16d", "pop", instr->d);
+        return pop(mcu, instr->d);
+    OP_CASE(ADIW):
+        PRINT_DEBUG("%-8s r%-7d %-8d", "adiw", instr->d, instr->r);
+        return adiw(mcu, instr->d, instr->r);
+    OP_CASE(SBIW):
+        PRINT_DEBUG("%-8s r%-7d %-8d", "sbiw", instr->d, instr->r);
+        return sbiw(mcu, instr->d, instr->r);
+    OP_CASE(MULS):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "muls", instr->d, instr->r);
+        return muls(mcu, instr->d, instr->r);
+    OP_CASE(SBIC):
+        PRINT_DEBUG("%-8s %-8d %-8d", "sbic", instr->d, instr->r);
+        return sbic(mcu, instr->d, instr->r);
+    OP_CASE(SBIS):
+        PRINT_DEBUG("%-8s %-8d %-8d", "sbis", instr->d, instr->r);
+        return sbis(mcu, instr->d, instr->r);
+    OP_CASE(SBI):
+        PRINT_DEBUG("%-8s %-8d %-8d", "sbi", instr->d, instr->r);
+        return sbi(mcu, instr->d, instr->r);
+    OP_CASE(CBI):
+        PRINT_DEBUG("%-8s %-8d %-8d", "cbi", instr->d, instr->r);
+        return cbi(mcu, instr->d, instr->r);
+    OP_CASE(MOVW):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "movw", instr->d, instr->r);
+        return movw(mcu, instr->d, instr->r);
+    OP_CASE(SER):
+        PRINT_DEBUG("%-8s r%-7d", "ser", instr->d);
+        return ser(mcu, instr->d);
+    OP_CASE(MULSU):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "mulsu", instr->d, instr->r);
+        return mulsu(mcu, instr->d, instr->r);
+    OP_CASE(FMUL):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "fmul", instr->d, instr->r);
+        return fmul(mcu, instr->d, instr->r);
+    OP_CASE(FMULS):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "fmuls", instr->d, instr->r);
+        return fmuls(mcu, instr->d, instr->r);
+    OP_CASE(FMULSU):
+        PRINT_DEBUG("%-8s r%-7d r%-7d", "fmulsu", instr->d, instr->r);
+        return fmulsu(mcu, instr->d, instr->r);
+    OP_CASE(BSET):
+        PRINT_DEBUG("%-8s %-17d", "bset", instr->d);
+        return bset(mcu, instr->d);
+    OP_CASE(BCLR):
+        PRINT_DEBUG("%-8s %-17d", "bclr", instr->d);
+        return bclr(mcu, instr->d);
+    OP_CASE(IJMP):
         PRINT_DEBUG("%-26s", "ijmp");
         return ijmp(mcu);
-    case OP_ICALL:
+    OP_CASE(ICALL):
         PRINT_DEBUG("%-26s", "icall");
         return icall(mcu);
-    case OP_RET:
+    OP_CASE(RET):
         PRINT_DEBUG("%-26s", "ret");
         return ret(mcu);
-    case OP_RETI:
+    OP_CASE(RETI):
         PRINT_DEBUG("%-26s", "reti");
         return reti(mcu);
-    case OP_LPM_R0:
+    OP_CASE(LPM_R0):
         PRINT_DEBUG("%-26s", "lpm(r0)");
         return lpm(mcu, 0);
-    case OP_SPM:
+    OP_CASE(SPM):
         PRINT_DEBUG("%-26s", "spm");
         return spm(mcu);
-    case OP_NOP:
+    OP_CASE(NOP):
         PRINT_DEBUG("%-26s", "nop");
         return nop(mcu);
-    case OP_SLEEP:
+    OP_CASE(SLEEP):
         PRINT_DEBUG("%-26s", "sleep");
         return sleep(mcu);
-    case OP_WDR:
+    OP_CASE(WDR):
         PRINT_DEBUG("%-26s", "wdr");
         return wdr(mcu);
-    case OP_BREAK:
+    OP_CASE(BREAK):
         PRINT_DEBUG("%-26s", "break");
         return break_(mcu);
+    OP_CASE(LDD_Y):
+        PRINT_DEBUG("%-8s r%-7d %-8d", "ldd(Y)", instr->d, instr->r);
+        return ldd_y(mcu, instr->d, instr->r);
+    OP_CASE(LDD_Z):
+        PRINT_DEBUG("%-8s r%-7d %-8d", "ldd(Z)", instr->d, instr->r);
+        return ldd_z(mcu, instr->d, instr->r);
+    OP_CASE(STD_Y):
+        PRINT_DEBUG("%-8s %-8d r%-7d", "std(Y)", instr->d, instr->r);
+        return std_y(mcu, instr->d, instr->r);
+    OP_CASE(STD_Z):
+        PRINT_DEBUG("%-8s %-8d r%-7d", "std(Z)", instr->d, instr->r);
+        return std_z(mcu, instr->d, instr->r);
+    OP_CASE(UNKNOWN):
+        LOG_ERROR("unknown op: %#x pc: %u sp: %u", mcu->flash[mcu->pc], mcu->pc, *mcu->sp);
+        exit(EXIT_FAILURE);
     }
 
-    /***************************************************************************
-     * Edge case
-     **************************************************************************/
-    switch (op & OP_MASK_Q) {
-    case OP_LDD_Y: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 q = MSH(op, 0x2000, 8) | MSH(op, 0x0C00, 7) | MSK(op, 0x0007);
-        PRINT_DEBUG("%-8s r%-7d %-8d", "ldd(Y)", d, q);
-        return ldd_y(mcu, d, q);
-    }
-    case OP_LDD_Z: {
-        const u8 d = MSH(op, 0x01F0, 4);
-        const u8 q = MSH(op, 0x2000, 8) | MSH(op, 0x0C00, 7) | MSK(op, 0x0007);
-        PRINT_DEBUG("%-8s r%-7d %-8d", "ldd(Z)", d, q);
-        return ldd_z(mcu, d, q);
+    LOG_ERROR("bad op id: %u pc: %u", instr->op, mcu->pc);
+    exit(EXIT_FAILURE);
+}
+
+// vectors whose flag and enable bits are both set, by vector number
+static u32 irq_flags(const AVR_MCU *restrict mcu) {
+    const u8 t0 = mcu->data[REG_TIFR0] & mcu->data[REG_TIMSK0];
+    const u8 t1 = mcu->data[REG_TIFR1] & mcu->data[REG_TIMSK1];
+    const u8 t2 = mcu->data[REG_TIFR2] & mcu->data[REG_TIMSK2];
+    const u8 a  = mcu->data[REG_UCSR0A] & mcu->data[REG_UCSR0B];
+    u32 irq     = 0;
+
+    // reset
+    irq |= (u32)(mcu->data[REG_MCUSR] != 0) << (IV_RESET / 2);
+
+    // int0, int1, pcint0, pcint1, pcint2, wdt (UNUSED)
+
+    // timers are ordered compa, compb, ovf in the vector table and ovf, compa, compb in their flags
+    irq |= (u32)MSH(t2, 0x06, 1) << (IV_TIMER2_COMPA / 2) | (u32)GET_BIT(t2, BIT_TOV2) << (IV_TIMER2_OVF / 2);
+    irq |= (u32)MSH(t1, 0x06, 1) << (IV_TIMER1_COMPA / 2) | (u32)GET_BIT(t1, BIT_TOV1) << (IV_TIMER1_OVF / 2);
+    irq |= (u32)MSH(t0, 0x06, 1) << (IV_TIMER0_COMPA / 2) | (u32)GET_BIT(t0, BIT_TOV0) << (IV_TIMER0_OVF / 2);
+
+    // usart rx, udre, and tx enable bits sit at the positions of their flags
+    irq |= (u32)GET_BIT(a, BIT_RXC0) << (IV_USART_RX / 2);
+    irq |= (u32)GET_BIT(a, BIT_UDRE0) << (IV_USART_UDRE / 2);
+    irq |= (u32)GET_BIT(a, BIT_TXC0) << (IV_USART_TX / 2);
+
+    // ee ready
+    irq |= (u32)GET_BIT(mcu->data[REG_EECR], BIT_EERIE) << (IV_EE_READY / 2);
+
+    return irq;
+}
+
+// the interrupt with the lowest vector pending and enabled, zero if none, works out stale pending vectors first
+static inline u32 irq_next(AVR_MCU *restrict mcu) {
+    if (mcu->irq & IRQ_STALE) {
+        mcu->irq = irq_flags(mcu);
     }
-    case OP_STD_Y: {
-        const u8 q = MSH(op, 0x2000, 8) | MSH(op, 0x0C00, 7) | MSK(op, 0x0007);
-        const u8 r = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s %-8d r%-7d", "std(Y)", q, r);
-        return std_y(mcu, q, r);
+
+    return mcu->irq & -mcu->irq;
+}
+
+// bit of a vector in irq
+#define IRQ_BIT(IV) (1u << ((IV) / 2))
+
+// interrupts that wake the mcu from the sleep mode it is in, a reset wakes it from any
+static inline u32 sleep_wakes(const AVR_MCU *restrict mcu) {
+    const u32 timer2 = IRQ_BIT(IV_TIMER2_COMPA) | IRQ_BIT(IV_TIMER2_COMPB) | IRQ_BIT(IV_TIMER2_OVF);
+
+    switch (mcu->sleep) {
+    case SLEEP_IDLE:
+        return ~IRQ_STALE;
+    case SLEEP_ADC_NR:
+        return IRQ_BIT(IV_RESET) | timer2 | IRQ_BIT(IV_ADC) | IRQ_BIT(IV_EE_READY);
+    case SLEEP_POWER_SAVE:
+        return IRQ_BIT(IV_RESET) | timer2;
+    default:
+        return IRQ_BIT(IV_RESET);
     }
-    case OP_STD_Z: {
-        const u8 q = MSH(op, 0x2000, 8) | MSH(op, 0x0C00, 7) | MSK(op, 0x0007);
-        const u8 r = MSH(op, 0x01F0, 4);
-        PRINT_DEBUG("%-8s %-8d r%-7d", "std(Z)", q, r);
-        return std_z(mcu, q, r);
+}
+
+// wake the mcu once an interrupt its sleep mode wakes on is pending, enabled globally or not, returns the cycles it is
+// halted for waking up, zero if it sleeps on
+static int sleep_wake(AVR_MCU *restrict mcu) {
+    if (mcu->irq & IRQ_STALE) {
+        mcu->irq = irq_flags(mcu);
     }
+
+    if ((mcu->irq & sleep_wakes(mcu)) == 0) {
+        return 0;
     }
 
-    LOG_ERROR("unknown op: %#x pc: %u sp: %u", op, mcu->pc, *mcu->sp);
-    exit(EXIT_FAILURE);
+    // timers are brought up to the wake up before their clocks start again
+    sched_sync(mcu);
+    mcu->sleep     = 0;
+    mcu->sched_due = 0;
+
+    return 4;
 }
 
-int avr_interrupt(AVR_MCU *restrict mcu) {
-    int ret;
+static inline int interrupt(AVR_MCU *restrict mcu) {
+    // nothing is pending, the common case
+    if (mcu->irq == 0) {
+        return 0;
+    }
+
+    const u32 irq = irq_next(mcu);
 
     // global interrupts are disabled
-    if (GET_BIT(*mcu->sreg, SREG_I) == 0) {
+    if (irq == 0 || GET_BIT(*mcu->sreg, SREG_I) == 0) {
         return 0;
     }
 
     // clear global interrupt before calling one
     CLR_BIT(*mcu->sreg, SREG_I);
 
-    // reset
-    if (mcu->data[REG_MCUSR]) {
-        mcu->data[REG_MCUSR] = 0;
+    const u16 iv  = (u16)__builtin_ctz(irq) * 2;
+    const int ret = isr(mcu, iv);
+
+    // flags of the vector taken are cleared by hardware, udre stays set until udr is written
+    switch (iv) {
+    case IV_RESET:
         PRINT_DEBUG("int reset");
-        return isr(mcu, IV_RESET);
-    }
-
-    // int0
-    // int1
-    // pcint0
-    // pcint1
-    // pcint2
-
-    // wdt (UNUSED)
-
-    if (mcu->data[REG_TIMSK2]) {
-        // timer2 compa
-        if (GET_BIT(mcu->data[REG_TIFR2], BIT_OCF2A) && GET_BIT(mcu->data[REG_TIMSK2], 1)) {
-            PRINT_DEBUG("int timer2 compa");
-            ret = isr(mcu, IV_TIMER2_COMPA);
-            CLR_BIT(mcu->data[REG_TIFR2], BIT_OCF2A);
-            return ret;
-        }
-        // timer2 compb
-        if (GET_BIT(mcu->data[REG_TIFR2], BIT_OCF2B) && GET_BIT(mcu->data[REG_TIMSK2], 2)) {
-            PRINT_DEBUG("int timer2 compb");
-            ret = isr(mcu, IV_TIMER2_COMPB);
-            CLR_BIT(mcu->data[REG_TIFR2], BIT_OCF2B);
-            return ret;
-        }
-        // timer2 ovf
-        if (GET_BIT(mcu->data[REG_TIFR2], BIT_TOV2) && GET_BIT(mcu->data[REG_TIMSK2], 0)) {
-            PRINT_DEBUG("int timer2 ovf");
-            ret = isr(mcu, IV_TIMER2_OVF);
-            CLR_BIT(mcu->data[REG_TIFR2], BIT_TOV2);
-            return ret;
-        }
-    }
-
-    if (mcu->data[REG_TIMSK1]) {
-        // timer1 capt (TODO)
-        // timer1 compa
-        if (GET_BIT(mcu->data[REG_TIFR1], BIT_OCF1A) && GET_BIT(mcu->data[REG_TIMSK1], 1)) {
-            PRINT_DEBUG("int timer1 compa");
-            ret = isr(mcu, IV_TIMER1_COMPA);
-            CLR_BIT(mcu->data[REG_TIFR1], BIT_OCF1A);
-            return ret;
-        }
-        // timer1 compb
-        if (GET_BIT(mcu->data[REG_TIFR1], BIT_OCF1B) && GET_BIT(mcu->data[REG_TIMSK1], 2)) {
-            PRINT_DEBUG("int timer1 compb");
-            ret = isr(mcu, IV_TIMER1_COMPB);
-            CLR_BIT(mcu->data[REG_TIFR1], BIT_OCF1B);
-            return ret;
-        }
-        // timer1 ovf
-        if (GET_BIT(mcu->data[REG_TIFR1], BIT_TOV1) && GET_BIT(mcu->data[REG_TIMSK1], 0)) {
-            PRINT_DEBUG("int timer1 ovf");
-            ret = isr(mcu, IV_TIMER1_OVF);
-            CLR_BIT(mcu->data[REG_TIFR1], BIT_TOV1);
-            return ret;
-        }
-    }
-
-    if (mcu->data[REG_TIMSK0]) {
-        // timer0 compa
-        if (GET_BIT(mcu->data[REG_TIFR0], BIT_OCF0A) && GET_BIT(mcu->data[REG_TIMSK0], 1)) {
-            PRINT_DEBUG("int timer0 compa");
-            ret = isr(mcu, IV_TIMER0_COMPA);
-            CLR_BIT(mcu->data[REG_TIFR0], BIT_OCF0A);
-            return ret;
-        }
-        // timer0 compb
-        if (GET_BIT(mcu->data[REG_TIFR0], BIT_OCF0B) && GET_BIT(mcu->data[REG_TIMSK0], 2)) {
-            PRINT_DEBUG("int timer0 compb");
-            ret = isr(mcu, IV_TIMER0_COMPB);
-            CLR_BIT(mcu->data[REG_TIFR0], BIT_OCF0B);
-            return ret;
-        }
-        // timer0 ovf
-        if (GET_BIT(mcu->data[REG_TIFR0], BIT_TOV0) && GET_BIT(mcu->data[REG_TIMSK0], 0)) {
-            PRINT_DEBUG("int timer0 ovf");
-            ret = isr(mcu, IV_TIMER0_OVF);
-            CLR_BIT(mcu->data[REG_TIFR0], BIT_TOV0);
-            return ret;
-        }
-    }
-
-    // spi stc
-
-    // usart rx
-    if (GET_BIT(mcu->data[REG_UCSR0B], BIT_RXCIE0) && GET_BIT(mcu->data[REG_UCSR0A], BIT_RXC0)) {
+        mcu->data[REG_MCUSR] = 0;
+        break;
+    case IV_TIMER2_COMPA:
+        PRINT_DEBUG("int timer2 compa");
+        CLR_BIT(mcu->data[REG_TIFR2], BIT_OCF2A);
+        break;
+    case IV_TIMER2_COMPB:
+        PRINT_DEBUG("int timer2 compb");
+        CLR_BIT(mcu->data[REG_TIFR2], BIT_OCF2B);
+        break;
+    case IV_TIMER2_OVF:
+        PRINT_DEBUG("int timer2 ovf");
+        CLR_BIT(mcu->data[REG_TIFR2], BIT_TOV2);
+        break;
+    case IV_TIMER1_COMPA:
+        PRINT_DEBUG("int timer1 compa");
+        CLR_BIT(mcu->data[REG_TIFR1], BIT_OCF1A);
+        break;
+    case IV_TIMER1_COMPB:
+        PRINT_DEBUG("int timer1 compb");
+        CLR_BIT(mcu->data[REG_TIFR1], BIT_OCF1B);
+        break;
+    case IV_TIMER1_OVF:
+        PRINT_DEBUG("int timer1 ovf");
+        CLR_BIT(mcu->data[REG_TIFR1], BIT_TOV1);
+        break;
+    case IV_TIMER0_COMPA:
+        PRINT_DEBUG("int timer0 compa");
+        CLR_BIT(mcu->data[REG_TIFR0], BIT_OCF0A);
+        break;
+    case IV_TIMER0_COMPB:
+        PRINT_DEBUG("int timer0 compb");
+        CLR_BIT(mcu->data[REG_TIFR0], BIT_OCF0B);
+        break;
+    case IV_TIMER0_OVF:
+        PRINT_DEBUG("int timer0 ovf");
+        CLR_BIT(mcu->data[REG_TIFR0], BIT_TOV0);
+        break;
+    case IV_USART_RX:
         PRINT_DEBUG("int usart rx");
-        ret = isr(mcu, IV_USART_RX);
         CLR_BIT(mcu->data[REG_UCSR0A], BIT_RXC0);
-        return ret;
+        break;
+    case IV_USART_UDRE:
+        PRINT_DEBUG("int usart udre");
+        break;
+    case IV_USART_TX:
+        PRINT_DEBUG("int usart tx");
+        CLR_BIT(mcu->data[REG_UCSR0A], BIT_TXC0);
+        break;
+    case IV_EE_READY:
+        PRINT_DEBUG("int ee ready");
+        CLR_BIT(mcu->data[REG_EECR], BIT_EERIE);
+        break;
     }
 
-    // usart udre
-    if (GET_BIT(mcu->data[REG_UCSR0B], BIT_UDRIE0) && GET_BIT(mcu->data[REG_UCSR0A], BIT_UDRE0)) {
-        PRINT_DEBUG("int usart udre");
-        ret = isr(mcu, IV_EE_READY);
-        return ret;
+    mcu->irq |= IRQ_STALE;
+
+    return ret;
+}
+
+static inline void cycle(AVR_MCU *restrict mcu) {
+    mcu->clk += 1;
+
+    // timers only need the cycle when one of them does more than count
+    if (mcu->clk - mcu->sched_clk >= mcu->sched_due) {
+        sched_sync(mcu);
     }
+}
 
-    // usart tx
-    if (GET_BIT(mcu->data[REG_UCSR0B], BIT_TXCIE0) && GET_BIT(mcu->data[REG_UCSR0A], BIT_TXC0)) {
-        PRINT_DEBUG("int usart tx");
-        ret = isr(mcu, IV_USART_TX);
-        CLR_BIT(mcu->data[REG_UCSR0A], BIT_TXC0);
-        return ret;
+// conditional branch ending a fused sequence
+static inline int branch(AVR_MCU *restrict mcu, const AVR_Instr *restrict instr) {
+    return instr->op == OP_ID_BRBC ? brbc(mcu, instr->d, (i8)instr->r) : brbs(mcu, instr->d, (i8)instr->r);
+}
+
+// run the fused sequence starting at pc as one handler, same results and cycles as running it instruction by
+// instruction, only used inside blocks where no cycle in between can be observed
+static inline int execute_fused(AVR_MCU *restrict mcu, const AVR_Instr *restrict instr) {
+    int cycles = 0;
+
+    PRINT_DEBUG("%-8s %-8d %-8d", "fused", instr->fused, instr->run);
+
+    switch (instr->fused) {
+    case FUSE_LDI_LDI:
+        cycles += ldi(mcu, instr[0].d, instr[0].r);
+        cycles += ldi(mcu, instr[1].d, instr[1].r);
+        break;
+    case FUSE_CMP_BR:
+        cycles += instr[0].op == OP_ID_CP ? cp(mcu, instr[0].d, instr[0].r) : cpi(mcu, instr[0].d, instr[0].r);
+        for (u8 i = 1; i + 1 < instr->run; i++) {
+            cycles += cpc(mcu, instr[i].d, instr[i].r);
+        }
+        cycles += branch(mcu, &instr[instr->run - 1]);
+        break;
+    case FUSE_PUSH:
+        for (u8 i = 0; i < instr->run; i++) {
+            cycles += push(mcu, instr[i].d);
+        }
+        break;
+    case FUSE_POP:
+        for (u8 i = 0; i < instr->run; i++) {
+            cycles += pop(mcu, instr[i].d);
+        }
+        break;
+    case FUSE_IN_CLI:
+        cycles += in(mcu, instr[0].d, instr[0].r);
+        cycles += bclr(mcu, instr[1].d);
+        break;
+    case FUSE_SBIW_BR:
+        cycles += sbiw(mcu, instr[0].d, instr[0].r);
+        cycles += branch(mcu, &instr[1]);
+        break;
     }
 
-    // adc
+    return cycles;
+}
 
-    // ee ready
-    if (GET_BIT(mcu->data[REG_EECR], BIT_EERIE)) {
-        PRINT_DEBUG("int ee ready");
-        ret = isr(mcu, IV_EE_READY);
-        CLR_BIT(mcu->data[REG_EECR], BIT_EERIE);
-        return ret;
+// an interrupt would fire on the next call to interrupt
+static inline bool irq_pending(AVR_MCU *restrict mcu) {
+    return mcu->irq && irq_next(mcu) && GET_BIT(*mcu->sreg, SREG_I);
+}
+
+// cycles that pass before the next event, zero if that has to be worked out first
+static inline u16 next_event(const AVR_MCU *restrict mcu) {
+    const u64 elapsed = mcu->clk - mcu->sched_clk;
+    return mcu->sched_due > elapsed ? (u16)(mcu->sched_due - elapsed) : 0;
+}
+
+// cycles that pass before the next event or an interrupt fires, a block shorter than this gives the same result
+// whether peripherals are clocked per cycle or once after it
+static inline u16 horizon(AVR_MCU *restrict mcu) {
+    return irq_pending(mcu) ? 0 : next_event(mcu);
+}
+
+// registers only timers write once a loop idles, io_hooks counts every access the program makes to them, ports
+// while compare outputs are enabled
+static const u16 timer_owned[] = {REG_TCNT0, REG_TCNT1L, REG_TCNT1H, REG_TCNT2, REG_PORTB, REG_PORTD};
+
+// pass the loop head at pc now cycles into avr_run, returns the cycles of a pass once two passes in a row left
+// registers and data memory unchanged without observing the clock, else zero
+static u64 idle_probe(AVR_MCU *restrict mcu, u64 now) {
+    AVR_Idle *const idle = &mcu->idle;
+    const u8 slot        = mcu->pc % AVR_IDLE_HEADS;
+    u64 period           = 0;
+
+    // avr_run came back to the head without running it
+    if (idle->pc[slot] == mcu->pc && idle->at[slot] == now) {
+        return 0;
+    }
+
+    // registers first, most loops change one every pass
+    if (idle->pc[slot] != mcu->pc || idle->observed[slot] != mcu->observed ||
+        memcmp(idle->reg[slot], mcu->reg, AVR_MCU_IO_REG_OFFSET) != 0) {
+        memcpy(idle->reg[slot], mcu->reg, AVR_MCU_IO_REG_OFFSET);
+        if (idle->recorded == mcu->pc) {
+            idle->recorded = AVR_IDLE_NONE;
+        }
+    } else {
+        sreg_sync(mcu);
+
+        if (idle->recorded == mcu->pc) {
+            const u8 owned = sizeof(timer_owned) / sizeof(timer_owned[0]) - (compare_outputs(mcu) ? 0 : 2);
+
+            for (u8 i = 0; i < owned; i++) {
+                idle->data[timer_owned[i]] = mcu->data[timer_owned[i]];
+            }
+
+            if (memcmp(idle->data, mcu->data, sizeof(idle->data)) == 0) {
+                period = now - idle->at[slot];
+            }
+        }
+
+        // the head that got there first keeps data memory until its registers change
+        if (period == 0 && (idle->recorded == mcu->pc || idle->recorded == AVR_IDLE_NONE)) {
+            memcpy(idle->data, mcu->data, sizeof(idle->data));
+            idle->recorded = mcu->pc;
+        }
     }
 
-    // analong comp
-    // twi
-    // spm ready
+    idle->pc[slot]       = mcu->pc;
+    idle->observed[slot] = mcu->observed;
+    idle->at[slot]       = now;
 
-    // no interrupts were actually trigged so reset flag
-    PUT_BIT(*mcu->sreg, SREG_I);
+    return period;
+}
 
-    return 0;
+// clock whole passes of an idle loop for up to room cycles, peripherals are brought up to each event, stops at the
+// last pass before one that raises an interrupt flag so stepping reaches it at its exact cycle, returns the cycles
+// clocked
+static u64 idle_skip(AVR_MCU *restrict mcu, u64 period, u64 room) {
+    // timers and io registers at the last pass clocked
+    u8 io[AVR_MCU_SRAM_OFFSET - AVR_MCU_IO_REG_OFFSET];
+    AVR_Schedule schedule;
+    bool invert   = mcu->pwm_invert;
+    u64 clk       = mcu->clk;
+    u16 sched_due = 0;
+    u64 pass      = 0;
+    u64 at        = 0; // timers are up to date through this cycle
+
+    sched_sync(mcu);
+    memcpy(io, mcu->io_reg, sizeof(io));
+    schedule  = mcu->schedule;
+    sched_due = mcu->sched_due;
+
+    for (;;) {
+        const u64 event = at + mcu->sched_due;
+        if (event > room) {
+            const u64 end = room / period * period;
+            if (end < at) {
+                break;
+            }
+
+            mcu->clk += end - at;
+            sched_sync(mcu);
+            return end;
+        }
+
+        // passes in between only count the timers
+        const u64 last = (event - 1) / period * period;
+        if (last >= at) {
+            mcu->clk += last - at;
+            at        = last;
+            sched_sync(mcu);
+
+            pass      = last;
+            invert    = mcu->pwm_invert;
+            clk       = mcu->clk;
+            schedule  = mcu->schedule;
+            sched_due = mcu->sched_due;
+            memcpy(io, mcu->io_reg, sizeof(io));
+        }
+
+        const u8 tifr0                = mcu->data[REG_TIFR0];
+        const u8 tifr1                = mcu->data[REG_TIFR1];
+        const u8 tifr2                = mcu->data[REG_TIFR2];
+        const u8 portb                = mcu->data[REG_PORTB];
+        const u8 portd                = mcu->data[REG_PORTD];
+        const AVR_Callbacks callbacks = mcu->callbacks;
+
+        // the host hears of pins the event drives only once it is kept
+        mcu->callbacks  = (AVR_Callbacks){0};
+        mcu->clk       += event - at;
+        at              = event;
+        sched_sync(mcu);
+        mcu->callbacks = callbacks;
+
+        // the loop may enable interrupts partway through a pass, any raised flag ends the skip
+        if (mcu->data[REG_TIFR0] != tifr0 || mcu->data[REG_TIFR1] != tifr1 || mcu->data[REG_TIFR2] != tifr2) {
+            break;
+        }
+
+        gpio_notify(mcu, REG_PORTB, portb);
+        gpio_notify(mcu, REG_PORTD, portd);
+    }
+
+    // wind the timers back to the last pass
+    memcpy(mcu->io_reg, io, sizeof(io));
+    mcu->pwm_invert = invert;
+    mcu->clk        = clk;
+    mcu->sched_clk  = clk;
+    mcu->sched_due  = sched_due;
+    mcu->schedule   = schedule;
+    mcu->irq       |= IRQ_STALE;
+
+    return pass;
+}
+
+// ops after which avr_run may have to return to the host, stores that can reach io space plus sleep and break
+static const u8 op_exit[OP_ID_COUNT] = {
+    [OP_ID_OUT]          = AVR_EXIT_IO,
+    [OP_ID_SBI]          = AVR_EXIT_IO,
+    [OP_ID_CBI]          = AVR_EXIT_IO,
+    [OP_ID_STS]          = AVR_EXIT_IO,
+    [OP_ID_ST_X]         = AVR_EXIT_IO,
+    [OP_ID_ST_X_POSTINC] = AVR_EXIT_IO,
+    [OP_ID_ST_X_PREDEC]  = AVR_EXIT_IO,
+    [OP_ID_ST_Y]         = AVR_EXIT_IO,
+    [OP_ID_ST_Y_POSTINC] = AVR_EXIT_IO,
+    [OP_ID_ST_Y_PREDEC]  = AVR_EXIT_IO,
+    [OP_ID_ST_Z]         = AVR_EXIT_IO,
+    [OP_ID_ST_Z_POSTINC] = AVR_EXIT_IO,
+    [OP_ID_ST_Z_PREDEC]  = AVR_EXIT_IO,
+    [OP_ID_STD_Y]        = AVR_EXIT_IO,
+    [OP_ID_STD_Z]        = AVR_EXIT_IO,
+    [OP_ID_SLEEP]        = AVR_EXIT_SLEEP,
+    [OP_ID_BREAK]        = AVR_EXIT_BREAK,
+};
+
+int avr_execute(AVR_MCU *restrict mcu) {
+    // asleep nothing runs until an interrupt wakes the mcu
+    if (mcu->sleep) {
+        const int wake = sleep_wake(mcu);
+        return wake ? wake : 1;
+    }
+
+    const int cycles = execute(mcu);
+
+    // the host may read sreg between calls
+    sreg_sync(mcu);
+
+    return cycles;
+}
+
+int avr_interrupt(AVR_MCU *restrict mcu) {
+    // the host may have raised or enabled an interrupt between calls
+    mcu->irq |= IRQ_STALE;
+
+    return interrupt(mcu);
 }
 
 void avr_cycle(AVR_MCU *restrict mcu) {
-    mcu->clk += 1;
+    cycle(mcu);
+
+    // the host may read the counters between calls
+    sched_sync(mcu);
+}
+
+uint64_t avr_sleep_cycles(AVR_MCU *restrict mcu) {
+    if (mcu->sleep == 0 || mcu->stall) {
+        return 0;
+    }
+
+    // the host may have raised an interrupt between calls
+    mcu->irq = irq_flags(mcu);
+    if (mcu->irq & sleep_wakes(mcu)) {
+        return 0;
+    }
+
+    // works out the next event if it is not known yet
+    sched_sync(mcu);
+
+    return next_event(mcu);
+}
+
+uint32_t avr_clock(const AVR_MCU *restrict mcu) {
+    return system_clock(mcu);
+}
+
+uint64_t avr_ns(const AVR_MCU *restrict mcu) {
+    return emulated_ns(mcu);
+}
+
+uint64_t avr_cycles_to_ns(const AVR_MCU *restrict mcu, uint64_t cycles) {
+    return cycles_ns(cycles, system_clock(mcu));
+}
+
+uint64_t avr_ns_to_cycles(const AVR_MCU *restrict mcu, uint64_t ns) {
+    const uint32_t hz = system_clock(mcu);
+    const uint64_t s  = ns / NS_PER_S;
+    return s * hz + (ns - s * NS_PER_S) * hz / NS_PER_S;
+}
+
+AVR_Exit avr_run(AVR_MCU *restrict mcu, uint64_t budget, uint64_t *restrict cycles) {
+    AVR_Exit ret = AVR_EXIT_BUDGET;
+    u64 n        = 0;
+    int stall    = mcu->stall;
+
+    // pins, ddrs, and ports of b, c, and d as last seen by the host, and the system clock prescaler it paces by
+    u8 gpio[REG_PORTD - REG_PINB + 1];
+    memcpy(gpio, &mcu->data[REG_PINB], sizeof(gpio));
+    const u8 clkpr = mcu->data[REG_CLKPR];
+
+    memset(mcu->idle.pc, 0xFF, sizeof(mcu->idle.pc));
+    mcu->idle.recorded = AVR_IDLE_NONE;
+
+    // the host may have changed timer, flag, or enable registers between calls
+    mcu->sched_due  = 0;
+    mcu->irq       |= IRQ_STALE;
+    sched_sync(mcu);
+
+    while (n < budget) {
+        // asleep the peripherals run from one event to the next until one wakes the mcu
+        if (stall == 0 && mcu->sleep) {
+            stall = sleep_wake(mcu);
+            if (stall == 0) {
+                const u16 event = next_event(mcu);
+                const u64 c     = MIN(event ? event : 1u, budget - n);
+
+                mcu->clk += c;
+                n        += c;
+                sched_sync(mcu);
+                continue;
+            }
+        }
+
+        // execute when the previous instruction and any isr it triggered have been clocked
+        if (stall == 0) {
+            // run whole blocks, chained through the control flow that ends them, for as long as they end before
+            // anything could observe the cycles in between
+            const u16 h   = horizon(mcu);
+            const u64 clk = mcu->clk;
+            u32 ran       = 0;
+            u64 period    = 0;
+
+            for (;;) {
+                AVR_Block *const block = &mcu->blocks[mcu->pc];
+
+                // loops that idle skip their passes
+                if (block->head && ran < h && (period = idle_probe(mcu, n + ran)) != 0) {
+                    break;
+                }
+
+                // runtime routines run natively and delay loops in closed form when they end before the horizon, else
+                // through their blocks
+                if ((block->hle || block->delay) && ran < h) {
+                    const u64 room = MIN(h - 1 - ran, budget - n - ran);
+                    const u32 c    = block->hle ? hle(mcu, block->hle, room) : delay_loop(mcu, block->delay, room);
+                    if (c) {
+                        mcu->clk += c;
+                        ran      += c;
+                        continue;
+                    }
+                }
+
+                if (block->span == 0 || ran + block->span >= h || ran + block->span > budget - n) {
+                    break;
+                }
+
+                // clk is kept current for timers read in the block
+                const u32 start = ran;
+                if (mcu->native && mcu->native[mcu->pc]) {
+                    // blocks it chains to end before the horizon and within the budget as this one does
+                    const u64 room = MIN((u64)h - 1, budget - n);
+
+                    mcu->native[mcu->pc](mcu, clk + room);
+                    ran = (u32)(mcu->clk - clk);
+                    ASSERT_BOUNDS(ran, start + block->cycles, room);
+                } else {
+                    // instructions of the block plus the control flow ending it
+                    const u32 count = block->count + (block->span != block->cycles ? 1u : 0u);
+
+                    if (block->heat < AVR_JIT_HOT && ++block->heat == AVR_JIT_HOT) {
+                        mcu->hot_blocks += 1;
+                    }
+
+                    for (u32 i = 0; i < count;) {
+                        const AVR_Instr *const instr = &mcu->decoded[mcu->pc];
+
+                        if (instr->fused && instr->run <= count - i) {
+                            mcu->clk += execute_fused(mcu, instr);
+                            i        += instr->run;
+                        } else {
+                            mcu->clk += execute(mcu);
+                            i        += 1;
+                        }
+                    }
+                    ran = (u32)(mcu->clk - clk);
+                    ASSERT_BOUNDS(ran - start, block->cycles, block->span);
+                }
+                (void)start;
+            }
+
+            n += ran;
+
+            u64 skipped = 0;
+            if (period) {
+                skipped  = idle_skip(mcu, period, budget - n);
+                n       += skipped;
+
+                // the next pass is the first after the skip
+                mcu->idle.at[mcu->pc % AVR_IDLE_HEADS] = n;
+            }
 
-    set_readonly(mcu);
-    timer0_tick(mcu);
-    timer1_tick(mcu);
-    timer2_tick(mcu);
+            if (ran || skipped) {
+                continue;
+            }
+
+            const u8 op  = mcu->decoded[mcu->pc].op;
+            const u8 txc = GET_BIT(mcu->data[REG_UCSR0A], BIT_TXC0);
+
+            stall = execute(mcu);
+
+            // a program setting TXC0 signals tx to a host polling it, once per set so a flag left set does not exit
+            // again
+            switch (op_exit[op]) {
+            case AVR_EXIT_IO:
+                if (memcmp(gpio, &mcu->data[REG_PINB], sizeof(gpio)) != 0 || mcu->data[REG_CLKPR] != clkpr ||
+                    GET_BIT(mcu->data[REG_UCSR0A], BIT_TXC0) > txc) {
+                    ret = AVR_EXIT_IO;
+                }
+                break;
+            case AVR_EXIT_SLEEP:
+                ret = AVR_EXIT_SLEEP;
+                break;
+            case AVR_EXIT_BREAK:
+                ret = AVR_EXIT_BREAK;
+                break;
+            }
+
+            if (ret != AVR_EXIT_BUDGET) {
+                break;
+            }
+        }
+
+        cycle(mcu);
+        stall += interrupt(mcu);
+        stall -= 1;
+        n += 1;
+    }
+
+    mcu->stall = stall;
+    sreg_sync(mcu);
+    sched_sync(mcu);
+
+    if (cycles) {
+        *cycles = n;
+    }
+
+    return ret;
+}
+
+// log linear bucket of a value, values below 2^AVR_TIMING_SUB_BITS have one each
+static inline uint32_t timing_bucket(uint64_t v) {
+    if (v < (1u << AVR_TIMING_SUB_BITS)) {
+        return (uint32_t)v;
+    }
+    if (v >> AVR_TIMING_BITS) {
+        return AVR_TIMING_BUCKETS - 1;
+    }
+
+    const uint32_t msb = 63 - __builtin_clzll(v);
+    const uint32_t sub = (uint32_t)(v >> (msb - AVR_TIMING_SUB_BITS)) & ((1u << AVR_TIMING_SUB_BITS) - 1);
+    return ((msb - AVR_TIMING_SUB_BITS + 1) << AVR_TIMING_SUB_BITS) | sub;
+}
+
+void avr_timing_record(AVR_Timing *restrict timing, int64_t overrun, int64_t error) {
+    timing->quanta += 1;
+    timing->missed += overrun > 0;
+    if (overrun > timing->overrun) {
+        timing->overrun = overrun;
+    }
+    timing->error[timing_bucket(error < 0 ? -(uint64_t)error : (uint64_t)error)] += 1;
+}
+
+uint64_t avr_timing_value(uint32_t bucket) {
+    if (bucket < (1u << AVR_TIMING_SUB_BITS)) {
+        return bucket;
+    }
+
+    const uint32_t shift = (bucket >> AVR_TIMING_SUB_BITS) - 1;
+    const uint64_t sub   = bucket & ((1u << AVR_TIMING_SUB_BITS) - 1);
+    return (((1ull << AVR_TIMING_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+uint64_t avr_timing_percentile(const AVR_Timing *restrict timing, double percentile) {
+    const double rank = timing->quanta * percentile / 100.0;
+    uint64_t seen     = 0;
+
+    for (uint32_t i = 0; i < AVR_TIMING_BUCKETS && timing->quanta; i++) {
+        seen += timing->error[i];
+        if (seen > 0 && seen >= rank) {
+            return avr_timing_value(i);
+        }
+    }
+
+    return 0;
 }
@@ -221,6 +221,165 @@
 #define OP_MASK_9_4 0xFF8F // 1111 1111 1... 1111
 #define OP_MASK_Q   0xD208 // 11.1 ..1. .... 1...
 
+/*******************************************************************************
+ * Op IDs
+ * Handler index stored in predecoded instructions, UNKNOWN must be first (0)
+ ******************************************************************************/
+#define OP_ID_LIST(X) \
+    X(UNKNOWN)        \
+    X(SUBI)           \
+    X(SBCI)           \
+    X(ANDI)           \
+    X(ORI)            \
+    X(RJMP)           \
+    X(RCALL)          \
+    X(CPI)            \
+    X(LDI)            \
+    X(IN)             \
+    X(OUT)            \
+    X(ADD)            \
+    X(ADC)            \
+    X(SUB)            \
+    X(SBC)            \
+    X(AND)            \
+    X(OR)             \
+    X(EOR)            \
+    X(MUL)            \
+    X(CPSE)           \
+    X(CP)             \
+    X(CPC)            \
+    X(BRBC)           \
+    X(BRBS)           \
+    X(MOV)            \
+    X(SBRC)           \
+    X(SBRS)           \
+    X(BST)            \
+    X(BLD)            \
+    X(JMP)            \
+    X(CALL)           \
+    X(COM)            \
+    X(NEG)            \
+    X(INC)            \
+    X(DEC)            \
+    X(LSR)            \
+    X(ROR)            \
+    X(ASR)            \
+    X(SWAP)           \
+    X(LD_X)           \
+    X(LD_X_POSTINC)   \
+    X(LD_X_PREDEC)    \
+    X(LD_Y)           \
+    X(LD_Y_POSTINC)   \
+    X(LD_Y_PREDEC)    \
+    X(LD_Z)           \
+    X(LD_Z_POSTINC)   \
+    X(LD_Z_PREDEC)    \
+    X(LDS)            \
+    X(ST_X)           \
+    X(ST_X_POSTINC)   \
+    X(ST_X_PREDEC)    \
+    X(ST_Y)           \
+    X(ST_Y_POSTINC)   \
+    X(ST_Y_PREDEC)    \
+    X(ST_Z)           \
+    X(ST_Z_POSTINC)   \
+    X(ST_Z_PREDEC)    \
+    X(STS)            \
+    X(LPM)            \
+    X(LPM_POSTINC)    \
+    X(PUSH)           \
+    X(POP)            \
+    X(ADIW)           \
+    X(SBIW)           \
+    X(MULS)           \
+    X(SBIC)           \
+    X(SBIS)           \
+    X(SBI)            \
+    X(CBI)            \
+    X(MOVW)           \
+    X(SER)            \
+    X(MULSU)          \
+    X(FMUL)           \
+    X(FMULS)          \
+    X(FMULSU)         \
+    X(BSET)           \
+    X(BCLR)           \
+    X(IJMP)           \
+    X(ICALL)          \
+    X(RET)            \
+    X(RETI)           \
+    X(LPM_R0)         \
+    X(SPM)            \
+    X(NOP)            \
+    X(SLEEP)          \
+    X(WDR)            \
+    X(BREAK)          \
+    X(LDD_Y)          \
+    X(LDD_Z)          \
+    X(STD_Y)          \
+    X(STD_Z)
+
+#define OP_ID_ENUM(NAME) OP_ID_##NAME,
+enum { OP_ID_LIST(OP_ID_ENUM) OP_ID_COUNT };
+#undef OP_ID_ENUM
+
+/*******************************************************************************
+ * Fused Sequences
+ * avr-gcc idioms that run as one handler inside blocks, all single word ops
+ ******************************************************************************/
+#define FUSE_NONE    0
+#define FUSE_LDI_LDI 1 // ldi; ldi
+#define FUSE_CMP_BR  2 // cp or cpi; 1 to 3 cpc; brbc or brbs
+#define FUSE_PUSH    3 // push; push; ...
+#define FUSE_POP     4 // pop; pop; ...
+#define FUSE_IN_CLI  5 // in Rd, SREG; cli
+#define FUSE_SBIW_BR 6 // sbiw; brbc or brbs
+
+#define FUSE_MAX_RUN 32 // longest push or pop run
+
+/*******************************************************************************
+ * Runtime Routines
+ * libgcc and avr-libc routines avr_run runs natively, matched by their exact words in flash
+ ******************************************************************************/
+#define HLE_NONE       0
+#define HLE_UDIVMODSI4 1 // __udivmodsi4
+#define HLE_UDIVMODHI4 2 // __udivmodhi4
+#define HLE_MEMCPY     3 // memcpy
+#define HLE_MEMSET     4 // memset
+#define HLE_STRCPY     5 // strcpy
+#define HLE_STRLEN     6 // strlen
+#define HLE_COUNT      7
+
+#define HLE_MAX_LEN 34 // longest signature in words
+
+/*******************************************************************************
+ * Delay Loops
+ * countdown loops of _delay_us, _delay_ms, and delayMicroseconds that avr_run runs in closed form
+ ******************************************************************************/
+#define DELAY_NONE 0
+#define DELAY_SBIW 1 // 1: sbiw Rd, 1; brne 1b
+#define DELAY_DEC  2 // 1: dec Rd; brne 1b
+#define DELAY_SUBI 3 // 1: subi Rd, 1; 0 to 2 sbci Rd, 0; brne 1b
+
+#define DELAY_MAX_LEN 4 // longest loop in words
+
+/*******************************************************************************
+ * Deferred Flags
+ * AVR_Flags kinds, instructions sharing a flag formula share a kind
+ ******************************************************************************/
+#define FLAGS_NONE  0
+#define FLAGS_ADD   1  // add, adc: H S V N Z C
+#define FLAGS_SUB   2  // sub, subi, sbc, sbci, cp, cpc, cpi: H S V N Z C
+#define FLAGS_LOGIC 3  // and, andi, or, ori, eor: S V N Z
+#define FLAGS_COM   4  // com: S V N Z C
+#define FLAGS_NEG   5  // neg: H S V N Z C
+#define FLAGS_INC   6  // inc: S V N Z
+#define FLAGS_DEC   7  // dec: S V N Z
+#define FLAGS_ADIW  8  // adiw: S V N Z C
+#define FLAGS_SBIW  9  // sbiw: S V N Z C
+#define FLAGS_MUL   10 // mul, muls, mulsu, fmul, fmuls, fmulsu: Z C
+#define FLAGS_SHIFT 11 // lsr, ror, asr: S V N Z C
+
 /*******************************************************************************
  * Op Utils
  ******************************************************************************/
@@ -385,6 +544,14 @@
 #define BIT_RXB80  1
 #define BIT_TXB80  0
 
+// GTCCR
+#define BIT_PSRSYNC 0
+#define BIT_PSRASY  1
+#define BIT_TSM     7
+
+// CLKPR
+#define BIT_CLKPCE 7
+
 /*******************************************************************************
  * Sleep Modes
  *
@@ -393,6 +560,7 @@
  * Bit 2 : SM1
  * Bit 3 : SM2
  ******************************************************************************/
+#define BIT_SE                 0
 #define SLEEP_IDLE             0x01 // 0001
 #define SLEEP_ADC_NR           0x03 // 0011
 #define SLEEP_POWER_DOWN       0x05 // 0101
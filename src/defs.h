@@ -61,6 +61,9 @@
 // convert a 7bit number to i16
 #define I7_TO_I16(X) ((X) | (GET_BIT((X), 6) * 0xFF80))
 
+// smaller of X and Y
+#define MIN(X, Y) ((X) < (Y) ? (X) : (Y))
+
 // assert X is equal to or between LO and HI
 #define ASSERT_BOUNDS(X, LO, HI) assert((X) >= (LO) && (X) <= (HI))
 
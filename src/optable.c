@@ -0,0 +1,350 @@
+/**
+ * avr-pi
+ * Copyright (C) 2024 Jonathan Forhan <jonathan.forhan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// avr-pi-optable, build time generator of the opcode to handler id table used by decode.
+//
+// Every 16 bit word is classified once here so decoding flash at runtime is a single table lookup, opcodes that
+// classify as UNKNOWN (and would exit through avr_execute) are listed in the generated header and reported.
+//
+// usage: avr-pi-optable <avr_optable.h>
+
+#include <stdlib.h>
+#include "avr_defs.h"
+#include "defs.h"
+
+#define OP_ID_NAME(NAME) #NAME,
+static const char *const op_names[OP_ID_COUNT] = {OP_ID_LIST(OP_ID_NAME)};
+#undef OP_ID_NAME
+
+// classify an opcode by handler id, first match in order of mask width wins
+static u8 classify(u16 op) {
+    /***************************************************************************
+     * 4 bit op
+     **************************************************************************/
+    switch (op & OP_MASK_4) {
+    case OP_SUBI:
+        return OP_ID_SUBI;
+    case OP_SBCI:
+        return OP_ID_SBCI;
+    case OP_ANDI:
+        return OP_ID_ANDI;
+    case OP_ORI:
+        return OP_ID_ORI;
+    case OP_RJMP:
+        return OP_ID_RJMP;
+    case OP_RCALL:
+        return OP_ID_RCALL;
+    case OP_CPI:
+        return OP_ID_CPI;
+    case OP_LDI:
+        return OP_ID_LDI;
+    }
+
+    /***************************************************************************
+     * 5 bit op
+     **************************************************************************/
+    switch (op & OP_MASK_5) {
+    case OP_IN:
+        return OP_ID_IN;
+    case OP_OUT:
+        return OP_ID_OUT;
+    }
+
+    /***************************************************************************
+     * 6 bit op
+     **************************************************************************/
+    switch (op & OP_MASK_6) {
+    case OP_ADD:
+        return OP_ID_ADD;
+    case OP_ADC:
+        return OP_ID_ADC;
+    case OP_SUB:
+        return OP_ID_SUB;
+    case OP_SBC:
+        return OP_ID_SBC;
+    case OP_AND:
+        return OP_ID_AND;
+    case OP_OR:
+        return OP_ID_OR;
+    case OP_EOR:
+        return OP_ID_EOR;
+    case OP_MUL:
+        return OP_ID_MUL;
+    case OP_CPSE:
+        return OP_ID_CPSE;
+    case OP_CP:
+        return OP_ID_CP;
+    case OP_CPC:
+        return OP_ID_CPC;
+    case OP_BRBC:
+        return OP_ID_BRBC;
+    case OP_BRBS:
+        return OP_ID_BRBS;
+    case OP_MOV:
+        return OP_ID_MOV;
+    }
+
+    /***************************************************************************
+     * 7 bit op
+     **************************************************************************/
+    switch (op & OP_MASK_7_1) {
+    case OP_SBRC:
+        return OP_ID_SBRC;
+    case OP_SBRS:
+        return OP_ID_SBRS;
+    case OP_BST:
+        return OP_ID_BST;
+    case OP_BLD:
+        return OP_ID_BLD;
+    }
+
+    switch (op & OP_MASK_7_3) {
+    case OP_JMP:
+        return OP_ID_JMP;
+    case OP_CALL:
+        return OP_ID_CALL;
+    }
+
+    switch (op & OP_MASK_7_4) {
+    case OP_COM:
+        return OP_ID_COM;
+    case OP_NEG:
+        return OP_ID_NEG;
+    case OP_INC:
+        return OP_ID_INC;
+    case OP_DEC:
+        return OP_ID_DEC;
+    case OP_LSR:
+        return OP_ID_LSR;
+    case OP_ROR:
+        return OP_ID_ROR;
+    case OP_ASR:
+        return OP_ID_ASR;
+    case OP_SWAP:
+        return OP_ID_SWAP;
+    case OP_LD_X:
+        return OP_ID_LD_X;
+    case OP_LD_X_POSTINC:
+        return OP_ID_LD_X_POSTINC;
+    case OP_LD_X_PREDEC:
+        return OP_ID_LD_X_PREDEC;
+    case OP_LD_Y:
+        return OP_ID_LD_Y;
+    case OP_LD_Y_POSTINC:
+        return OP_ID_LD_Y_POSTINC;
+    case OP_LD_Y_PREDEC:
+        return OP_ID_LD_Y_PREDEC;
+    case OP_LD_Z:
+        return OP_ID_LD_Z;
+    case OP_LD_Z_POSTINC:
+        return OP_ID_LD_Z_POSTINC;
+    case OP_LD_Z_PREDEC:
+        return OP_ID_LD_Z_PREDEC;
+    case OP_LDS:
+        return OP_ID_LDS;
+    case OP_ST_X:
+        return OP_ID_ST_X;
+    case OP_ST_X_POSTINC:
+        return OP_ID_ST_X_POSTINC;
+    case OP_ST_X_PREDEC:
+        return OP_ID_ST_X_PREDEC;
+    case OP_ST_Y:
+        return OP_ID_ST_Y;
+    case OP_ST_Y_POSTINC:
+        return OP_ID_ST_Y_POSTINC;
+    case OP_ST_Y_PREDEC:
+        return OP_ID_ST_Y_PREDEC;
+    case OP_ST_Z:
+        return OP_ID_ST_Z;
+    case OP_ST_Z_POSTINC:
+        return OP_ID_ST_Z_POSTINC;
+    case OP_ST_Z_PREDEC:
+        return OP_ID_ST_Z_PREDEC;
+    case OP_STS:
+        return OP_ID_STS;
+    case OP_LPM:
+        return OP_ID_LPM;
+    case OP_LPM_POSTINC:
+        return OP_ID_LPM_POSTINC;
+    case OP_PUSH:
+        return OP_ID_PUSH;
+    case OP_POP:
+        return OP_ID_POP;
+    }
+
+    /***************************************************************************
+     * 8 bit op
+     **************************************************************************/
+    switch (op & OP_MASK_8) {
+    case OP_ADIW:
+        return OP_ID_ADIW;
+    case OP_SBIW:
+        return OP_ID_SBIW;
+    case OP_MULS:
+        return OP_ID_MULS;
+    case OP_SBIC:
+        return OP_ID_SBIC;
+    case OP_SBIS:
+        return OP_ID_SBIS;
+    case OP_SBI:
+        return OP_ID_SBI;
+    case OP_CBI:
+        return OP_ID_CBI;
+    case OP_MOVW:
+        return OP_ID_MOVW;
+    }
+
+    switch (op & OP_MASK_8_4) {
+    case OP_SER:
+        return OP_ID_SER;
+    }
+
+    /***************************************************************************
+     * 9 bit op
+     **************************************************************************/
+    switch (op & OP_MASK_9_1) {
+    case OP_MULSU:
+        return OP_ID_MULSU;
+    case OP_FMUL:
+        return OP_ID_FMUL;
+    case OP_FMULS:
+        return OP_ID_FMULS;
+    case OP_FMULSU:
+        return OP_ID_FMULSU;
+    }
+
+    switch (op & OP_MASK_9_4) {
+    case OP_BSET:
+        return OP_ID_BSET;
+    case OP_BCLR:
+        return OP_ID_BCLR;
+    }
+
+    /***************************************************************************
+     * 16 bit op
+     **************************************************************************/
+    switch (op) {
+    case OP_IJMP:
+        return OP_ID_IJMP;
+    case OP_ICALL:
+        return OP_ID_ICALL;
+    case OP_RET:
+        return OP_ID_RET;
+    case OP_RETI:
+        return OP_ID_RETI;
+    case OP_LPM_R0:
+        return OP_ID_LPM_R0;
+    case OP_SPM:
+        return OP_ID_SPM;
+    case OP_NOP:
+        return OP_ID_NOP;
+    case OP_SLEEP:
+        return OP_ID_SLEEP;
+    case OP_WDR:
+        return OP_ID_WDR;
+    case OP_BREAK:
+        return OP_ID_BREAK;
+    }
+
+    /***************************************************************************
+     * Edge case
+     **************************************************************************/
+    switch (op & OP_MASK_Q) {
+    case OP_LDD_Y:
+        return OP_ID_LDD_Y;
+    case OP_LDD_Z:
+        return OP_ID_LDD_Z;
+    case OP_STD_Y:
+        return OP_ID_STD_Y;
+    case OP_STD_Z:
+        return OP_ID_STD_Z;
+    }
+
+    return OP_ID_UNKNOWN;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        LOG_ERROR("usage: %s <avr_optable.h>", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    static u8 table[0x10000];
+    u32 count[OP_ID_COUNT] = {0};
+
+    for (u32 op = 0; op <= 0xFFFF; op++) {
+        const u8 id = classify((u16)op);
+
+        table[op]  = id;
+        count[id] += 1;
+    }
+
+    FILE *f = fopen(argv[1], "w");
+    if (!f) {
+        LOG_ERROR("could not open %s", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(f, "// generated by avr-pi-optable, do not edit\n\n");
+    fprintf(f, "#ifndef _AVR__AVR_OPTABLE_H_\n#define _AVR__AVR_OPTABLE_H_\n\n#include <stdint.h>\n\n");
+
+    // opcodes per handler
+    fprintf(f, "/*\n * Opcodes per handler\n *\n");
+    for (u32 id = 0; id < OP_ID_COUNT; id++) {
+        fprintf(f, " * %-14s %5u\n", op_names[id], count[id]);
+    }
+
+    // unknown opcodes as inclusive ranges
+    u32 ranges = 0;
+    fprintf(f, " *\n * Unknown opcodes\n *\n");
+    for (u32 op = 0; op <= 0xFFFF; op++) {
+        if (table[op] != OP_ID_UNKNOWN) {
+            continue;
+        }
+
+        u32 end = op;
+        while (end < 0xFFFF && table[end + 1] == OP_ID_UNKNOWN) {
+            end += 1;
+        }
+
+        fprintf(f, " * %#06x - %#06x\n", op, end);
+        ranges += 1;
+        op = end;
+    }
+    fprintf(f, " */\n\n");
+
+    fprintf(f, "static const uint8_t avr_optable[0x10000] = {\n");
+    for (u32 op = 0; op <= 0xFFFF; op += 16) {
+        fprintf(f, "   ");
+        for (u32 i = 0; i < 16; i++) {
+            fprintf(f, " %3u,", table[op + i]);
+        }
+        fprintf(f, " // %#06x\n", op);
+    }
+    fprintf(f, "};\n\n#endif // _AVR__AVR_OPTABLE_H_\n");
+
+    if (fclose(f) != 0) {
+        LOG_ERROR("could not write %s", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    // surface unhandled encodings in the build log
+    printf("avr-pi-optable: %u of 65536 opcodes unknown in %u ranges, see %s\n", count[OP_ID_UNKNOWN], ranges, argv[1]);
+
+    return EXIT_SUCCESS;
+}
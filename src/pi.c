@@ -45,14 +45,24 @@
  * PD7  23    7
  */
 
+#define _GNU_SOURCE // ppoll
+
+#include <dlfcn.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -64,31 +74,217 @@
 #include <pigpio.h>
 #endif
 
-#define VERSION  "0.0.0"
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
 #define MAX_PATH 260
 #define LOG_NAME "avr-pi.log"
 
-// can only be used when times are within +/- 1sec (our clk period will never be that long)
-#define diff_timespec(T0, T1) (1000000000L * ((T1).tv_sec - (T0).tv_sec) + ((T1).tv_nsec - (T0).tv_nsec))
+#define NSEC_PER_SEC 1000000000LL
+
+// ahead of time compiler --jit runs, CMake sets the one built alongside
+#ifndef AVR_PI_AOT
+#define AVR_PI_AOT "avr-pi-aot"
+#endif
+
+// states of a --jit compile, handed between the emulation and the jit thread
+#define JIT_OFF   0 // not running, or given up
+#define JIT_IDLE  1 // nothing asked for
+#define JIT_BUSY  2 // the jit thread is compiling jit.pcs
+#define JIT_READY 3 // jit.attach waits to be attached by the emulation
+
+// emulated time run between waits in us, default and bounds of --quantum
+#define PACE_QUANTUM     10
+#define PACE_QUANTUM_MIN 1
+#define PACE_QUANTUM_MAX 100
+
+// bounds of --speed as a ratio of real time
+#define SPEED_MIN 0.001
+#define SPEED_MAX 1000.0
+
+// bounds of --f-cpu in Hz, a watch crystal up to the fastest the ATmega328P is rated for
+#define F_CPU_MIN 32768
+#define F_CPU_MAX 20000000
+
+// ns left to spin out before each deadline on top of the wake latency the controller learns
+#define PACE_SPIN 2000
+
+// most ns woken before a deadline
+#define PACE_MARGIN_MAX 1000000
+
+// ns behind a deadline before the lag is dropped instead of caught up
+#define PACE_LAG_MAX 10000000
+
+// gains of the wake margin controller, as divisors
+#define PACE_KP 2
+#define PACE_KI 8
+
+// emulated ns between takes of stdin and input pin levels from housekeeping
+#define RX_NS 625000
+
+// ms housekeeping waits on stdin before draining tx and sampling input pins again
+#define HOUSEKEEPING_MS 1
+
+// bytes of tx held for housekeeping, a power of 2
+#define TX_RING 4096
+
+// bounds of --ahead in ms, the window has to cover the chunks queued for playback and a housekeeping period
+#define AHEAD_MIN 20
+#define AHEAD_MAX 1000
+
+// output edges held for playback, a power of 2
+#define EDGE_RING 16384
+
+// ns of wall time a playback chunk covers, most edges played in one, and pigpio waves queued at once
+#define PLAY_CHUNK 5000000
+#define PLAY_EDGES 2048
+#define PLAY_WAVES 2
+
+// bytes of stack touched by --mlock so the emulation never faults one in
+#define PREFAULT_STACK 65536
+
+// bounds of --fifo
+#define FIFO_MIN 1
+#define FIFO_MAX 99
+
+// fraction bits of a timebase's ns per tick
+#define TIMEBASE_SHIFT 24
+
+// ns counted to calibrate a timebase at startup, and between recalibrations
+#define TIMEBASE_CALIBRATE   100000000
+#define TIMEBASE_RECALIBRATE NSEC_PER_SEC
+
+// reads timed by --bench-clock, and ns waited to measure drift
+#define BENCH_READS 1000000
+#define BENCH_DRIFT TIMEBASE_RECALIBRATE
+
+// real time pacing, cycles run a quantum at a time as fast as possible then wait for the quantum's deadline, time is
+// kept by the mcu's clock and counted from the last change of the system clock at its rate
+typedef struct Pace {
+    int64_t start;     // wall time the run started at in ns
+    int64_t base;      // wall time anchor is due at in ns
+    int64_t lag;       // ns of lag dropped
+    uint64_t anchor;   // clock the system clock last changed at
+    uint32_t clock;    // system clock in Hz the cycle counts below are for
+    uint64_t take;     // clock of the next take from housekeeping
+    uint64_t rx;       // cycles between takes
+    uint64_t quantum;  // cycles run between waits
+    uint64_t hz;       // cycles run per wall second, 0 runs them as fast as the host can
+    int64_t ahead;     // ns output plays behind the emulation, 0 drives pins as the emulation changes them
+    int64_t margin;    // ns woken before a deadline, the rest is spun out
+    int64_t integral;  // accumulated error of the margin controller
+    AVR_Timing timing; // pacing accuracy
+} Pace;
 
-// error range / 2
-#define ERR_RANGE_2 4
+// output pin change held for playback
+typedef struct Edge {
+    int64_t at;     // wall time it plays at in ns
+    uint64_t clk;   // clock it was made at
+    uint32_t set;   // GPIO 0..31 driven high
+    uint32_t clear; // GPIO 0..31 driven low
+} Edge;
+
+// plays out edges a chunk of PLAY_CHUNK ns of wall time at a time, chunks are handed over in order before they start
+typedef struct Player {
+    bool (*open)(void);
+    bool (*ready)(int64_t t0);                                   // whether the chunk starting at t0 can be taken yet
+    void (*play)(int64_t t0, const Edge *edges, uint32_t count); // edges due in the chunk, in order
+    void (*close)(void);
+} Player;
+
+// host time source, ticks of a source that needs calibration are converted to ns against CLOCK_MONOTONIC
+typedef struct Timebase {
+    const char *name;
+    bool (*probe)(void);    // whether the source is usable on this host
+    uint64_t (*read)(void); // ticks
+    bool calibrate;         // ticks are not ns
+} Timebase;
+
+// avr_aot_attach of a shared object compiled by avr-pi-aot
+typedef AVR_Result (*Attach)(AVR_MCU *restrict mcu);
 
 static AVR_MCU mcu;
+static Pace pace;
 static volatile sig_atomic_t sigint = 0;
+static volatile sig_atomic_t usr1   = 0;
 
-// want to avoid as many syscalls as possible so state is cached
-static uint8_t ddrb_state, portb_state; // b
-static uint8_t ddrc_state, portc_state; // c
-static uint8_t ddrd_state, portd_state; // d
 static int stdin_fd;
+static long quantum_us = PACE_QUANTUM;
+static double speed    = 1.0;               // ratio of real time, 0 is as fast as the host can
+static uint64_t limit  = UINT64_MAX;        // emulated ns to run before exiting
+static long f_cpu      = AVR_MCU_CLK_SPEED; // clock source frequency in Hz
+static long cpu        = -1;                // core the emulation is pinned to, -1 is not pinned
+static long io_cpu     = -1;                // core housekeeping is pinned to, -1 picks one other than cpu
+static long fifo       = 0;                 // SCHED_FIFO priority of the emulation, 0 keeps the default policy
+static bool lock       = false;             // lock memory and prefault the mcu and stack
+static long ahead_ms   = 0;                 // ms output plays behind the emulation, 0 drives pins as it runs
+
+// stdin, stdout, and input pins are serviced by a housekeeping thread off the emulation's core
+static struct {
+    pthread_t thread;
+    int stop;               // set to end housekeeping
+    int rx;                 // byte read from stdin the emulation has not taken, -1 when empty
+    int wake[2];            // pipe written on each rx, wakes the emulation while it dozes
+    uint32_t levels;        // last sampled levels of GPIO 0..31
+    uint32_t head, tail;    // tx bytes written by the emulation, and written out by housekeeping
+    uint8_t tx[TX_RING];
+} hk = {.rx = -1};
+
+// with --ahead output edges are stamped with the wall time they are due and played out by housekeeping
+static struct {
+    const Player *player; // NULL drives pins as the emulation changes them
+    const char *path;     // file --record writes to
+    FILE *file;
+    int64_t start;       // wall time clock 0 plays at, published once pacing starts
+    int64_t horizon;     // wall time before which the emulation has made every edge
+    int64_t t0;          // wall time the next chunk starts at
+    uint64_t played;     // edges handed to the player
+    uint64_t late;       // edges played after they were due
+    uint64_t dropped;    // edges that never reached the pins
+    uint32_t head, tail; // edges made by the emulation, and taken by housekeeping
+    Edge edges[EDGE_RING];
+} play;
+
+// with --jit blocks that turn hot are compiled by avr-pi-aot on a thread of their own, and attached between quanta
+static struct {
+    const char *hex; // program avr-pi-aot reads
+    char dir[32];    // private directory shared objects are compiled in
+    bool started;    // the jit thread runs
+    pthread_t thread;
+    int request[2];  // pipe written once pcs are ready to compile, closed to stop the thread
+    int state;       // JIT_*
+    pid_t child;     // avr-pi-aot while it runs
+    uint16_t hot;    // mcu.hot_blocks when the last compile was asked for
+    uint32_t count;  // blocks in pcs
+    uint32_t passes; // compiles attached
+    uint32_t blocks; // hot blocks in the last compile attached
+    Attach attach;   // of the last compile
+    uint16_t pcs[AVR_MCU_FLASH_SIZE / 2];
+    char names[AVR_MCU_FLASH_SIZE / 2][8];
+    char *args[AVR_MCU_FLASH_SIZE / 2 + 4];
+} jit;
+
+// timebase in use and its calibration
+static struct {
+    const Timebase *source;
+    uint64_t t0;     // ticks at the last calibration
+    int64_t ns0;     // CLOCK_MONOTONIC at t0
+    uint64_t rate;   // ns per tick << TIMEBASE_SHIFT
+    uint64_t period; // ticks between recalibrations
+} timebase;
 
 static void signal_handler(int sig) {
-    sigint = sig;
+    if (sig == SIGUSR1) {
+        usr1 = 1;
+    } else {
+        sigint = sig;
+    }
 }
 
 static void print_version(void) {
-    printf("avr-pi v%s\n", VERSION);
+    printf("avr-pi v%s\n", AVR_VERSION);
 }
 
 static void print_help(void) {
@@ -96,60 +292,939 @@ static void print_help(void) {
         "avr-pi usage:\n"
         "\tavr-pi --version \tGet avr-pi version info.\n"
         "\tavr-pi --help    \tGet avr-pi help.\n"
-        "\tavr-pi {file}.hex\tExecute a compiled AVR hex file.\n");
+        "\tavr-pi {file}.hex\tExecute a compiled AVR hex file.\n"
+        "\tavr-pi {file}.hex {file}.so\tExecute with blocks compiled by avr-pi-aot.\n"
+        "\tavr-pi --bench-clock\tTime reads of each host clock source.\n"
+        "options, before the hex file:\n"
+        "\t--quantum={us}\tEmulated time run between waits, %d..%d, default %d.\n"
+        "\t--clock={counter,monotonic}\tHost clock source, default counter when the cpu has an invariant one.\n"
+        "\t--speed={ratio,max}\tRatio of real time to run at, %g..%g, max runs unpaced, default 1.\n"
+        "\t--time={s}\tEmulated seconds to run before exiting, default until interrupted.\n"
+        "\t--f-cpu={hz}\tClock source frequency, %d..%d, default %ld, the program may divide it with CLKPR.\n"
+        "\t--cpu={n}\tPin the emulation to core n, ideally one isolated with isolcpus.\n"
+        "\t--io-cpu={n}\tPin stdin, stdout, and input pin housekeeping to core n, default a core other than --cpu.\n"
+        "\t--fifo={prio}\tRun the emulation SCHED_FIFO at priority %d..%d, only with a core left for housekeeping.\n"
+        "\t--mlock\tLock memory and prefault the mcu and stack.\n"
+        "\t--ahead={ms}\tRun up to ms ahead of the output, played as pigpio waves at the cycles it was made, %d..%d.\n"
+        "\t--record={file}\tWith --ahead, record the output edges to file instead of playing them.\n"
+        "\t--jit\tCompile blocks that turn hot with avr-pi-aot while running, and run them natively.\n",
+        PACE_QUANTUM_MIN,
+        PACE_QUANTUM_MAX,
+        PACE_QUANTUM,
+        SPEED_MIN,
+        SPEED_MAX,
+        F_CPU_MIN,
+        F_CPU_MAX,
+        AVR_MCU_CLK_SPEED,
+        FIFO_MIN,
+        FIFO_MAX,
+        AHEAD_MIN,
+        AHEAD_MAX);
+}
+
+static bool monotonic_probe(void) {
+    return true;
+}
+
+static uint64_t monotonic_read(void) {
+    struct timespec t;
+    (void)clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * NSEC_PER_SEC + t.tv_nsec;
+}
+
+#if defined(__x86_64__)
+// the tsc only keeps time when invariant, ticking at one rate through frequency and power state changes
+static bool counter_probe(void) {
+    unsigned a, b, c, d;
+    return __get_cpuid(0x80000007, &a, &b, &c, &d) && GET_BIT(d, 8);
+}
+
+static uint64_t counter_read(void) {
+    return __rdtsc();
+}
+#elif defined(__aarch64__)
+// the generic timer's virtual count ticks at one fixed rate and linux lets EL0 read it
+static bool counter_probe(void) {
+    return true;
+}
+
+static uint64_t counter_read(void) {
+    uint64_t t;
+    __asm__ volatile("isb\n\tmrs %0, cntvct_el0" : "=r"(t)::"memory");
+    return t;
+}
+#else
+static bool counter_probe(void) {
+    return false;
+}
+
+static uint64_t counter_read(void) {
+    return 0;
+}
+#endif
+
+// sources in order of preference
+static const Timebase timebases[] = {
+    {"counter", counter_probe, counter_read, true},
+    {"monotonic", monotonic_probe, monotonic_read, false},
+};
+
+// anchor the timebase to CLOCK_MONOTONIC, the rate is measured over the time since the last anchor
+static void timebase_anchor(void) {
+    const uint64_t a = timebase.source->read();
+    const int64_t ns = (int64_t)monotonic_read();
+    const uint64_t t = a + (timebase.source->read() - a) / 2;
+
+    if (timebase.ns0 != 0 && t > timebase.t0 && ns - timebase.ns0 < (INT64_MAX >> TIMEBASE_SHIFT)) {
+        timebase.rate   = ((uint64_t)(ns - timebase.ns0) << TIMEBASE_SHIFT) / (t - timebase.t0);
+        timebase.period = timebase.rate ? ((uint64_t)TIMEBASE_RECALIBRATE << TIMEBASE_SHIFT) / timebase.rate : 0;
+    }
+
+    timebase.t0  = t;
+    timebase.ns0 = ns;
+}
+
+// start keeping time with source, a source that needs calibration is counted against CLOCK_MONOTONIC first
+static void timebase_open(const Timebase *source) {
+    const struct timespec wait = {.tv_nsec = TIMEBASE_CALIBRATE};
+
+    timebase.source = source;
+    timebase.ns0    = 0;
+
+    if (source->calibrate) {
+        timebase_anchor();
+        (void)nanosleep(&wait, NULL);
+        timebase_anchor();
+    }
+}
+
+// ns on the timebase, recalibrates once per TIMEBASE_RECALIBRATE so counter drift never builds up
+static inline int64_t now(void) {
+    if (!timebase.source->calibrate) {
+        return (int64_t)monotonic_read();
+    }
+
+    const uint64_t t = timebase.source->read();
+    if (t - timebase.t0 > timebase.period) {
+        timebase_anchor();
+        return timebase.ns0;
+    }
+
+    return timebase.ns0 + (int64_t)(((t - timebase.t0) * timebase.rate) >> TIMEBASE_SHIFT);
+}
+
+// report the cost of a read and the drift from CLOCK_MONOTONIC between calibrations of every source
+static void bench_clock(void) {
+    const struct timespec wait = {.tv_sec = BENCH_DRIFT / NSEC_PER_SEC, .tv_nsec = BENCH_DRIFT % NSEC_PER_SEC};
+    volatile int64_t sink;
+
+    for (size_t i = 0; i < sizeof(timebases) / sizeof(timebases[0]); i++) {
+        if (!timebases[i].probe()) {
+            printf("%-10s unavailable\n", timebases[i].name);
+            continue;
+        }
+
+        timebase_open(&timebases[i]);
+        if (timebases[i].calibrate) {
+            // recalibrate once so the rate is counted over as long as it is at run time
+            (void)nanosleep(&wait, NULL);
+            timebase_anchor();
+        }
+        timebase.period = UINT64_MAX; // drift is measured uncorrected
+
+        int64_t m0 = (int64_t)monotonic_read();
+        for (int j = 0; j < BENCH_READS; j++) {
+            sink = now();
+        }
+        const double cost = (double)((int64_t)monotonic_read() - m0) / BENCH_READS;
+
+        const int64_t t0 = now();
+        m0               = (int64_t)monotonic_read();
+        (void)nanosleep(&wait, NULL);
+        sink = now() - t0 - ((int64_t)monotonic_read() - m0);
+
+        printf("%-10s %6.1f ns/read %+8lld ns drift over %lld ms\n",
+               timebases[i].name,
+               cost,
+               (long long)sink,
+               BENCH_DRIFT / 1000000);
+    }
+}
+
+// wall time the mcu's clock reaches clk at
+static inline int64_t pace_deadline(const Pace *p, uint64_t clk) {
+    const uint64_t cycles = clk - p->anchor;
+    const uint64_t s      = cycles / p->hz;
+    return p->base + (int64_t)(s * NSEC_PER_SEC + (cycles - s * p->hz) * NSEC_PER_SEC / p->hz);
+}
+
+// hand an output change to playback, due ahead of the wall time the clock it was made at is paced to
+static void edge_push(uint32_t set, uint32_t clear) {
+    const uint32_t head = play.head;
+
+    // full only when playback falls behind, the emulation waits on it so it stays within the window
+    while (head - __atomic_load_n(&play.tail, __ATOMIC_ACQUIRE) == EDGE_RING) {
+        (void)sched_yield();
+    }
+
+    play.edges[head % EDGE_RING] = (Edge){
+        .at    = pace_deadline(&pace, mcu.clk) + pace.ahead,
+        .clk   = mcu.clk,
+        .set   = set,
+        .clear = clear,
+    };
+    __atomic_store_n(&play.head, head + 1, __ATOMIC_RELEASE);
+}
+
+// mock player, records each edge with the ns after clock 0 it plays at instead of driving pins
+static bool record_open(void) {
+    play.file = fopen(play.path, "w");
+    if (play.file == NULL) {
+        return false;
+    }
+
+    (void)fprintf(play.file, "# ns clk set clear\n");
+    return true;
+}
+
+static bool record_ready(int64_t t0) {
+    (void)t0;
+    return true;
+}
+
+static void record_play(int64_t t0, const Edge *edges, uint32_t count) {
+    (void)t0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        (void)fprintf(play.file,
+                      "%lld %llu %08x %08x\n",
+                      (long long)(edges[i].at - play.start),
+                      (unsigned long long)edges[i].clk,
+                      edges[i].set,
+                      edges[i].clear);
+    }
+}
+
+static void record_close(void) {
+    (void)fclose(play.file);
 }
 
+static const Player record_player = {record_open, record_ready, record_play, record_close};
+
 #ifndef AVR_NO_PI
-// update ddr on GPIO
-// reg: AVR reg
-// state: global state ptr
-// offset: offset of GPIO DCM
-// return: true if state changed
-static inline bool update_ddr(uint8_t reg, uint8_t *state, uint8_t offset) {
-    if (mcu.data[reg] != *state) {
-        for (int i = 0; i < 8; i++) {
-            if (GET_BIT(mcu.data[reg], i) != GET_BIT(*state, i)) {
-                gpioSetMode(i + offset, GET_BIT(mcu.data[reg], i) ? PI_OUTPUT : PI_INPUT);
+// pigpio waves sent and not yet finished, oldest first
+static struct {
+    int ids[PLAY_WAVES];
+    int count;
+    bool started; // a wave has been sent, nothing playing after that is an underrun
+} wave;
+
+static bool wave_open(void) {
+    return gpioWaveClear() == 0;
+}
+
+// delete the waves pigpio has finished, a chunk is taken while there is room for it and the first of a run only once
+// it is nearly due
+static bool wave_ready(int64_t t0) {
+    const int at = gpioWaveTxAt();
+    int done     = 0;
+
+    // every wave before the one transmitting has finished, all of them once none is
+    while (done < wave.count && wave.ids[done] != at) {
+        done++;
+    }
+    for (int i = 0; i < done; i++) {
+        (void)gpioWaveDelete(wave.ids[i]);
+    }
+    for (int i = done; i < wave.count; i++) {
+        wave.ids[i - done] = wave.ids[i];
+    }
+    wave.count -= done;
+
+    if (wave.count == 0) {
+        return t0 - (int64_t)monotonic_read() <= HOUSEKEEPING_MS * 1000000LL;
+    }
+    return wave.count < PLAY_WAVES;
+}
+
+// each chunk is a wave of pulses timed in us from its start, sent to start as the one before ends so chunks play back
+// to back
+static void wave_play(int64_t t0, const Edge *edges, uint32_t count) {
+    static gpioPulse_t pulses[PLAY_EDGES + 1];
+    uint32_t n  = 1;
+    uint32_t us = 0;
+
+    // a delay up to the first edge, each edge then holds until the next and the last until the chunk ends
+    pulses[0] = (gpioPulse_t){0};
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t e      = (uint32_t)((edges[i].at - t0) / 1000);
+        pulses[n - 1].usDelay = e - us;
+        pulses[n++]           = (gpioPulse_t){.gpioOn = edges[i].set, .gpioOff = edges[i].clear};
+        us                    = e;
+    }
+    pulses[n - 1].usDelay = PLAY_CHUNK / 1000 - us;
+
+    (void)gpioWaveAddNew();
+    (void)gpioWaveAddGeneric(n, pulses);
+    const int id = gpioWaveCreate();
+    if (id < 0) {
+        play.played  -= count;
+        play.dropped += count;
+        return;
+    }
+
+    if (wave.count == 0) {
+        // nothing playing, the chunk starts at t0 itself, after an underrun its edges are late
+        const struct timespec until = {.tv_sec = t0 / NSEC_PER_SEC, .tv_nsec = t0 % NSEC_PER_SEC};
+        (void)clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+        play.late += wave.started ? count : 0;
+    }
+
+    (void)gpioWaveTxSend(id, PI_WAVE_MODE_ONE_SHOT_SYNC);
+    wave.ids[wave.count++] = id;
+    wave.started           = true;
+}
+
+// the waves queued play out before pigpio lets go of the pins
+static void wave_close(void) {
+    const struct timespec wait = {.tv_nsec = HOUSEKEEPING_MS * 1000000L};
+
+    while (gpioWaveTxBusy()) {
+        (void)nanosleep(&wait, NULL);
+    }
+
+    (void)gpioWaveTxStop();
+    (void)gpioWaveClear();
+}
+
+static const Player wave_player = {wave_open, wave_ready, wave_play, wave_close};
+#endif
+
+// hand the player each chunk the emulation has made every edge of, or that is nearly due whether it has or not
+// flush: hand over every chunk the emulation has run into, waiting on the player as long as it takes
+static void playback(bool flush) {
+    const struct timespec wait = {.tv_nsec = HOUSEKEEPING_MS * 1000000L};
+    static Edge edges[PLAY_EDGES];
+
+    if (play.t0 == 0 && (play.t0 = __atomic_load_n(&play.start, __ATOMIC_ACQUIRE)) == 0) {
+        return; // pacing has not started
+    }
+
+    for (;;) {
+        const int64_t end     = play.t0 + PLAY_CHUNK;
+        const int64_t horizon = __atomic_load_n(&play.horizon, __ATOMIC_ACQUIRE);
+        const bool due        = (int64_t)monotonic_read() >= play.t0 - PLAY_CHUNK;
+
+        if (flush ? horizon <= play.t0 : horizon < end && !due) {
+            return;
+        }
+        if (!play.player->ready(play.t0)) {
+            if (!flush) {
+                return;
+            }
+            (void)nanosleep(&wait, NULL);
+            continue;
+        }
+
+        const uint32_t head = __atomic_load_n(&play.head, __ATOMIC_ACQUIRE);
+        uint32_t tail       = play.tail;
+        uint32_t n          = 0;
+        int64_t at          = play.t0;
+
+        // an edge made after its chunk was handed over plays at the start of this one
+        while (tail != head && n < PLAY_EDGES && play.edges[tail % EDGE_RING].at < end) {
+            edges[n] = play.edges[tail % EDGE_RING];
+            if (edges[n].at < at) {
+                play.late   += edges[n].at < play.t0;
+                edges[n].at  = at;
             }
+            at    = edges[n].at;
+            n    += 1;
+            tail += 1;
         }
-        *state = mcu.data[reg];
-        return true;
+        __atomic_store_n(&play.tail, tail, __ATOMIC_RELEASE);
+
+        play.played += n;
+        play.player->play(play.t0, edges, n);
+        play.t0 = end;
+    }
+}
+
+// parse a whole decimal number between lo and hi
+static bool number(const char *s, long lo, long hi, long *n) {
+    char *end;
+    *n = strtol(s, &end, 10);
+    return end != s && *end == '\0' && *n >= lo && *n <= hi;
+}
+
+// parse the options before the hex file
+// return: index of the first argument that is not an option, -1 on an invalid option
+static int options(int argc, char *argv[]) {
+    int i = 1;
+
+    for (; i < argc; i++) {
+        if (strncmp(argv[i], "--quantum=", 10) == 0) {
+            if (!number(argv[i] + 10, PACE_QUANTUM_MIN, PACE_QUANTUM_MAX, &quantum_us)) {
+                LOG_ERROR("invalid quantum %s", argv[i] + 10);
+                return -1;
+            }
+        } else if (strncmp(argv[i], "--cpu=", 6) == 0) {
+            if (!number(argv[i] + 6, 0, CPU_SETSIZE - 1, &cpu)) {
+                LOG_ERROR("invalid cpu %s", argv[i] + 6);
+                return -1;
+            }
+        } else if (strncmp(argv[i], "--io-cpu=", 9) == 0) {
+            if (!number(argv[i] + 9, 0, CPU_SETSIZE - 1, &io_cpu)) {
+                LOG_ERROR("invalid io cpu %s", argv[i] + 9);
+                return -1;
+            }
+        } else if (strncmp(argv[i], "--fifo=", 7) == 0) {
+            if (!number(argv[i] + 7, FIFO_MIN, FIFO_MAX, &fifo)) {
+                LOG_ERROR("invalid fifo priority %s", argv[i] + 7);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--mlock") == 0) {
+            lock = true;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            jit.state = JIT_IDLE;
+        } else if (strncmp(argv[i], "--speed=", 8) == 0) {
+            char *end;
+            speed = strcmp(argv[i] + 8, "max") == 0 ? 0.0 : strtod(argv[i] + 8, &end);
+            if (speed != 0.0 && (*end != '\0' || !(speed >= SPEED_MIN && speed <= SPEED_MAX))) {
+                LOG_ERROR("invalid speed %s", argv[i] + 8);
+                return -1;
+            }
+        } else if (strncmp(argv[i], "--time=", 7) == 0) {
+            char *end;
+            const double s = strtod(argv[i] + 7, &end);
+            if (*end != '\0' || !(s > 0.0 && s < (double)(UINT64_MAX / NSEC_PER_SEC))) {
+                LOG_ERROR("invalid time %s", argv[i] + 7);
+                return -1;
+            }
+            limit = (uint64_t)(s * NSEC_PER_SEC);
+        } else if (strncmp(argv[i], "--f-cpu=", 8) == 0) {
+            if (!number(argv[i] + 8, F_CPU_MIN, F_CPU_MAX, &f_cpu)) {
+                LOG_ERROR("invalid clock frequency %s", argv[i] + 8);
+                return -1;
+            }
+        } else if (strncmp(argv[i], "--ahead=", 8) == 0) {
+            if (!number(argv[i] + 8, AHEAD_MIN, AHEAD_MAX, &ahead_ms)) {
+                LOG_ERROR("invalid run ahead %s", argv[i] + 8);
+                return -1;
+            }
+        } else if (strncmp(argv[i], "--record=", 9) == 0) {
+            play.path = argv[i] + 9;
+        } else if (strncmp(argv[i], "--clock=", 8) == 0) {
+            timebase.source = NULL;
+            for (size_t j = 0; j < sizeof(timebases) / sizeof(timebases[0]); j++) {
+                if (strcmp(argv[i] + 8, timebases[j].name) == 0 && timebases[j].probe()) {
+                    timebase.source = &timebases[j];
+                }
+            }
+            if (timebase.source == NULL) {
+                LOG_ERROR("invalid or unavailable clock %s", argv[i] + 8);
+                return -1;
+            }
+        } else {
+            break;
+        }
+    }
+
+    // buffered output is played against the wall clock, by pigpio waves unless it is recorded
+    if (play.path != NULL) {
+        play.player = &record_player;
+    }
+#ifndef AVR_NO_PI
+    else if (ahead_ms != 0) {
+        play.player = &wave_player;
+    }
+#endif
+    if ((ahead_ms != 0) != (play.player != NULL) || (ahead_ms != 0 && speed == 0.0)) {
+        LOG_ERROR("--ahead needs a paced --speed and a player, --record needs --ahead");
+        return -1;
+    }
+
+    return i;
+}
+
+// GPIO of bit 0 of each port
+static const uint8_t gpio_offset[] = {[AVR_PORT_B] = 0, [AVR_PORT_C] = 8, [AVR_PORT_D] = 16};
+
+#ifndef AVR_NO_PI
+// copy the input pin levels housekeeping last sampled into the PINx bits of pins the ddrs make inputs
+static inline void inputs(void) {
+    const uint32_t levels = __atomic_load_n(&hk.levels, __ATOMIC_RELAXED);
+
+    for (int port = AVR_PORT_B; port <= AVR_PORT_D; port++) {
+        const uint8_t ddr = mcu.data[REG_DDRB + port * 3];
+        uint8_t *pin      = &mcu.data[REG_PINB + port * 3];
+        *pin              = (*pin & ddr) | ((levels >> gpio_offset[port]) & ~ddr);
     }
-    return false;
 }
 
-// update pin in AVR
-// reg: AVR reg
-// ddr: AVR ddr
-// offset: offset of GPIO DCM
-static inline void update_pin(uint8_t reg, uint8_t ddr, uint8_t offset) {
+#endif
+
+// drive output pins whose port bit changed, or with --ahead hand the change to playback
+static void on_port(void *user, AVR_Port port, uint8_t old, uint8_t val) {
+    const uint8_t ddr     = mcu.data[REG_DDRB + port * 3];
+    const uint8_t changed = (old ^ val) & ddr;
+    (void)user;
+
+    if (play.player != NULL) {
+        if (changed) {
+            edge_push((uint32_t)(val & changed) << gpio_offset[port], (uint32_t)(~val & changed) << gpio_offset[port]);
+        }
+        return;
+    }
+
+#ifndef AVR_NO_PI
     for (int i = 0; i < 8; i++) {
-        if (GET_BIT(mcu.data[ddr], i) == 0) {
-            SET_BIT(mcu.data[reg], i, gpioRead(i + offset));
+        if (GET_BIT(changed, i)) {
+            gpioWrite(i + gpio_offset[port], GET_BIT(val, i));
         }
     }
+#endif
 }
 
-// update port in AVR
-// reg: AVR reg
-// ddr: AVR ddr
-// offset: offset of GPIO DCM
-static inline void update_port(uint8_t reg, uint8_t ddr, uint8_t *state, uint8_t offset) {
-    if (mcu.data[reg] != *state) {
-        for (int i = 0; i < 8; i++) {
-            if (GET_BIT(mcu.data[ddr], i) == 1) {
-                gpioWrite(i + offset, GET_BIT(mcu.data[reg], i));
+// switch GPIO direction of pins whose ddr bit changed, pins turned to outputs take their port bit, with --ahead when
+// the edge plays, the direction still changes right away
+static void on_ddr(void *user, AVR_Port port, uint8_t old, uint8_t val) {
+    const uint8_t bits = mcu.data[REG_PORTB + port * 3];
+    const uint8_t outs = ~old & val;
+    (void)user;
+
+#ifndef AVR_NO_PI
+    for (int i = 0; i < 8; i++) {
+        if (GET_BIT(old ^ val, i)) {
+            gpioSetMode(i + gpio_offset[port], GET_BIT(val, i) ? PI_OUTPUT : PI_INPUT);
+            if (GET_BIT(outs, i) && play.player == NULL) {
+                gpioWrite(i + gpio_offset[port], GET_BIT(bits, i));
             }
         }
-        *state = mcu.data[reg];
+    }
+#endif
+
+    if (play.player != NULL && outs) {
+        edge_push((uint32_t)(bits & outs) << gpio_offset[port], (uint32_t)(~bits & outs) << gpio_offset[port]);
     }
 }
+
+// link tx to stdout, bytes are handed to housekeeping so the emulation never blocks in write
+static void on_uart_tx(void *user, uint8_t byte) {
+    const uint32_t head = hk.head;
+    (void)user;
+
+    // full only when stdout stalls, wait on it as a write would have
+    while (head - __atomic_load_n(&hk.tail, __ATOMIC_ACQUIRE) == TX_RING) {
+        (void)sched_yield();
+    }
+
+    hk.tx[head % TX_RING] = byte;
+    __atomic_store_n(&hk.head, head + 1, __ATOMIC_RELEASE);
+}
+
+// write out the tx bytes the emulation handed over, bytes stdout refuses are dropped
+static void tx_drain(void) {
+    const uint32_t head = __atomic_load_n(&hk.head, __ATOMIC_ACQUIRE);
+    uint32_t tail       = hk.tail;
+
+    while (tail != head) {
+        const ssize_t n = write(STDOUT_FILENO, &hk.tx[tail % TX_RING], MIN(head - tail, TX_RING - tail % TX_RING));
+        tail            = n > 0 ? tail + (uint32_t)n : head;
+    }
+
+    __atomic_store_n(&hk.tail, tail, __ATOMIC_RELEASE);
+}
+
+// service stdin, stdout, and input pins until stopped
+static void *housekeeping(void *arg) {
+    struct pollfd fd = {.fd = stdin_fd, .events = POLLIN};
+    ssize_t woke;
+    char c;
+    (void)arg;
+
+    while (!__atomic_load_n(&hk.stop, __ATOMIC_ACQUIRE)) {
+        // stdin is only watched while the last byte read has been taken
+        const nfds_t watch = __atomic_load_n(&hk.rx, __ATOMIC_ACQUIRE) < 0;
+        if (poll(&fd, watch, HOUSEKEEPING_MS) > 0) {
+            switch (read(stdin_fd, &c, 1)) {
+            case 1:
+                __atomic_store_n(&hk.rx, (uint8_t)c, __ATOMIC_RELEASE);
+                woke = write(hk.wake[1], &c, 1); // a full pipe wakes the emulation all the same
+                break;
+            case 0:
+                fd.fd = -1; // end of input, stop watching
+                break;
+            default:
+                break;
+            }
+        }
+
+        tx_drain();
+
+        if (play.player != NULL) {
+            playback(false);
+        }
+
+#ifndef AVR_NO_PI
+        __atomic_store_n(&hk.levels, gpioRead_Bits_0_31(), __ATOMIC_RELAXED);
 #endif
+    }
+
+    (void)woke;
+    return NULL;
+}
+
+// load a shared object compiled by avr-pi-aot, it stays loaded until exit
+// return: its avr_aot_attach, NULL if it could not be loaded or was compiled by another build
+static Attach aot_load(const char *path) {
+    void *so = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (so == NULL) {
+        LOG_ERROR("could not load %s: %s", path, dlerror());
+        return NULL;
+    }
+
+    // blocks of another build would run against a different layout of the mcu
+    const AVR_AotStamp stamp     = AVR_AOT_STAMP;
+    const AVR_AotStamp *so_stamp = dlsym(so, "avr_aot_stamp");
+
+    if (so_stamp == NULL || strncmp(so_stamp->version, stamp.version, sizeof(stamp.version)) != 0 ||
+        so_stamp->mcu != stamp.mcu || so_stamp->instr != stamp.instr) {
+        LOG_ERROR("%s was compiled by another build of avr-pi-aot, compile it again", path);
+        dlclose(so);
+        return NULL;
+    }
+
+    Attach aot_attach;
+    *(void **)&aot_attach = dlsym(so, "avr_aot_attach");
+
+    if (aot_attach == NULL) {
+        dlclose(so);
+    }
+    return aot_attach;
+}
+
+// attach blocks compiled ahead of time by avr-pi-aot
+static AVR_Result attach(const char *path) {
+    const Attach aot_attach = aot_load(path);
+
+    if (aot_attach == NULL || aot_attach(&mcu) != AVR_OK) {
+        LOG_ERROR("could not attach %s", path);
+        return AVR_ERROR;
+    }
+
+    return AVR_OK;
+}
+
+// compile the blocks in jit.pcs with avr-pi-aot and load them, runs on the jit thread
+// return: avr_aot_attach of the shared object, NULL if it could not be compiled
+static Attach jit_compile(void) {
+    static uint32_t n;
+    char so[sizeof(jit.dir) + 16];
+    char src[sizeof(so) + 2];
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    pid_t pid;
+    int status;
+
+    (void)snprintf(so, sizeof(so), "%s/%u.so", jit.dir, n++);
+    (void)snprintf(src, sizeof(src), "%s.c", so);
+
+    jit.args[0] = AVR_PI_AOT;
+    jit.args[1] = (char *)jit.hex;
+    jit.args[2] = so;
+    for (uint32_t i = 0; i < jit.count; i++) {
+        (void)snprintf(jit.names[i], sizeof(jit.names[i]), "%#x", jit.pcs[i]);
+        jit.args[3 + i] = jit.names[i];
+    }
+    jit.args[3 + jit.count] = NULL;
+
+    // stdout carries the program's tx, and a group of its own lets jit_stop stop the compiler avr-pi-aot runs too
+    if (posix_spawn_file_actions_init(&actions) != 0) {
+        return NULL;
+    }
+    if (posix_spawnattr_init(&attr) != 0) {
+        (void)posix_spawn_file_actions_destroy(&actions);
+        return NULL;
+    }
+    (void)posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    (void)posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    (void)posix_spawnattr_setpgroup(&attr, 0);
+
+    const int err = posix_spawnp(&pid, AVR_PI_AOT, &actions, &attr, jit.args, environ);
+    (void)posix_spawn_file_actions_destroy(&actions);
+    (void)posix_spawnattr_destroy(&attr);
+
+    if (err != 0) {
+        LOG_ERROR("could not run %s: %s", AVR_PI_AOT, strerror(err));
+        return NULL;
+    }
+
+    __atomic_store_n(&jit.child, pid, __ATOMIC_RELEASE);
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    __atomic_store_n(&jit.child, 0, __ATOMIC_RELEASE);
+
+    (void)unlink(src);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        // stopped by jit_stop at exit
+        if (!WIFSIGNALED(status)) {
+            LOG_ERROR("%s could not compile %u hot blocks", AVR_PI_AOT, jit.count);
+        }
+        (void)unlink(so);
+        return NULL;
+    }
+
+    // the shared object stays mapped
+    const Attach aot_attach = aot_load(so);
+    (void)unlink(so);
+    return aot_attach;
+}
+
+// compile what the emulation asks for until it closes the request pipe
+static void *jit_thread(void *arg) {
+    char c;
+    (void)arg;
+
+    while (read(jit.request[0], &c, 1) == 1) {
+        jit.attach = jit_compile();
+        __atomic_store_n(&jit.state, jit.attach != NULL ? JIT_READY : JIT_OFF, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+// attach the last compile, and ask for another once more blocks turned hot, between quanta
+static inline void jit_poll(void) {
+    switch (__atomic_load_n(&jit.state, __ATOMIC_ACQUIRE)) {
+    case JIT_READY:
+        // refused once spm rewrote flash away from the hex file
+        if (jit.attach(&mcu) != AVR_OK) {
+            __atomic_store_n(&jit.state, JIT_OFF, __ATOMIC_RELAXED);
+            break;
+        }
+        jit.passes += 1;
+        jit.blocks  = jit.count;
+        __atomic_store_n(&jit.state, JIT_IDLE, __ATOMIC_RELAXED);
+        break;
+    case JIT_IDLE:
+        // a compile costs the same for a few blocks or many, wait for a quarter more than the last had
+        if (mcu.hot_blocks - jit.hot < jit.hot / 4 + 1) {
+            break;
+        }
+
+        // every hot block, those compiled before are compiled again so they chain to the new ones
+        jit.hot   = mcu.hot_blocks;
+        jit.count = 0;
+        for (uint32_t pc = 0; pc < AVR_MCU_FLASH_SIZE / 2; pc++) {
+            if (mcu.blocks[pc].heat == AVR_JIT_HOT) {
+                jit.pcs[jit.count++] = (uint16_t)pc;
+            }
+        }
+
+        __atomic_store_n(&jit.state, JIT_BUSY, __ATOMIC_RELEASE);
+        if (write(jit.request[1], "", 1) != 1) {
+            __atomic_store_n(&jit.state, JIT_OFF, __ATOMIC_RELAXED);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// start the jit thread off the emulation's core and policy
+// return: false if it could not be started, the emulation then only interprets
+static bool jit_start(void) {
+    int err;
+
+    (void)snprintf(jit.dir, sizeof(jit.dir), "/tmp/avr-pi-XXXXXX");
+    if (mkdtemp(jit.dir) == NULL) {
+        (void)fprintf(stderr, "avr-pi: could not create a directory for the jit: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (pipe(jit.request) != 0) {
+        (void)fprintf(stderr, "avr-pi: could not create the jit request pipe: %s\n", strerror(errno));
+        (void)rmdir(jit.dir);
+        return false;
+    }
+
+    if ((err = pthread_create(&jit.thread, NULL, jit_thread, NULL)) != 0) {
+        (void)fprintf(stderr, "avr-pi: could not start the jit: %s\n", strerror(err));
+        (void)close(jit.request[0]);
+        (void)close(jit.request[1]);
+        (void)rmdir(jit.dir);
+        return false;
+    }
+
+    jit.started = true;
+    return true;
+}
+
+// stop the jit thread, a compile still running is cut short
+static void jit_stop(void) {
+    const pid_t child = __atomic_load_n(&jit.child, __ATOMIC_ACQUIRE);
+    if (child > 0) {
+        (void)kill(-child, SIGTERM);
+    }
+
+    (void)close(jit.request[1]);
+    (void)pthread_join(jit.thread, NULL);
+    (void)close(jit.request[0]);
+    (void)rmdir(jit.dir);
+
+    (void)fprintf(stderr, "avr-pi: jit attached %u compiles, the last of %u hot blocks\n", jit.passes, jit.blocks);
+}
+
+// prefault so the emulation never takes a page fault, mlockall keeps the pages resident
+static void prefault(void) {
+    volatile uint8_t stack[PREFAULT_STACK];
+    volatile uint8_t *const m = (volatile uint8_t *)&mcu;
+
+    for (size_t i = 0; i < sizeof(stack); i += 4096) {
+        stack[i] = 0;
+    }
+    for (size_t i = 0; i < sizeof(mcu); i += 4096) {
+        m[i] = m[i];
+    }
+}
+
+// pin a thread to a core
+// return: 0 or an error number
+static int pin(pthread_t thread, long core) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+// start housekeeping and harden the emulation thread as the options ask, reporting what was obtained
+// return: false if housekeeping could not be started
+static bool harden(void) {
+    int err;
+
+    if (pipe(hk.wake) != 0) {
+        LOG_ERROR("could not create the housekeeping wake pipe: %s", strerror(errno));
+        return false;
+    }
+    (void)fcntl(hk.wake[0], F_SETFL, O_NONBLOCK);
+    (void)fcntl(hk.wake[1], F_SETFL, O_NONBLOCK);
+
+    // housekeeping is started first so it does not inherit the emulation's core or policy
+    if ((err = pthread_create(&hk.thread, NULL, housekeeping, NULL)) != 0) {
+        LOG_ERROR("could not start housekeeping: %s", strerror(err));
+        (void)close(hk.wake[0]);
+        (void)close(hk.wake[1]);
+        return false;
+    }
+
+    // as is the jit, and the compiler it runs
+    if (jit.state != JIT_OFF && !jit_start()) {
+        jit.state = JIT_OFF;
+    }
+
+    cpu_set_t set;
+    const int cores = sched_getaffinity(0, sizeof(set), &set) == 0 ? CPU_COUNT(&set) : 0;
+
+    if (io_cpu < 0 && cpu >= 0 && cores > 0) {
+        for (long i = 0; i < CPU_SETSIZE && io_cpu < 0; i++) {
+            io_cpu = i != cpu && CPU_ISSET(i, &set) ? i : -1;
+        }
+    }
+    if (io_cpu >= 0) {
+        if ((err = pin(hk.thread, io_cpu)) == 0) {
+            (void)fprintf(stderr, "avr-pi: housekeeping pinned to cpu %ld\n", io_cpu);
+        } else {
+            (void)fprintf(stderr, "avr-pi: could not pin housekeeping to cpu %ld: %s\n", io_cpu, strerror(err));
+        }
+        if (jit.started && (err = pin(jit.thread, io_cpu)) != 0) {
+            (void)fprintf(stderr, "avr-pi: could not pin the jit to cpu %ld: %s\n", io_cpu, strerror(err));
+        }
+    }
+
+    if (cpu >= 0) {
+        if ((err = pin(pthread_self(), cpu)) == 0) {
+            (void)fprintf(stderr, "avr-pi: emulation pinned to cpu %ld\n", cpu);
+        } else {
+            (void)fprintf(stderr, "avr-pi: could not pin emulation to cpu %ld: %s\n", cpu, strerror(err));
+        }
+    }
+
+    // SCHED_FIFO never yields the core to housekeeping, the emulation would spin forever waiting on a full ring for
+    // housekeeping sharing its core
+    if (fifo > 0 && (cores < 2 || (io_cpu >= 0 && io_cpu == cpu))) {
+        (void)fprintf(stderr, "avr-pi: not running SCHED_FIFO, housekeeping has no core of its own to run on\n");
+    } else if (fifo > 0) {
+        const struct sched_param param = {.sched_priority = (int)fifo};
+        if ((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) == 0) {
+            (void)fprintf(stderr, "avr-pi: emulation running SCHED_FIFO at priority %ld\n", fifo);
+        } else {
+            (void)fprintf(stderr, "avr-pi: could not run SCHED_FIFO at priority %ld: %s\n", fifo, strerror(err));
+        }
+    }
+
+    if (lock) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+            prefault();
+            (void)fprintf(stderr, "avr-pi: memory locked, mcu and stack prefaulted\n");
+        } else {
+            (void)fprintf(stderr, "avr-pi: could not lock memory: %s\n", strerror(errno));
+        }
+    }
+
+    return true;
+}
+
+// stop housekeeping and write out the tx it had left, and hand over the output the emulation made
+static void teardown(void) {
+    __atomic_store_n(&hk.stop, 1, __ATOMIC_RELEASE);
+    (void)pthread_join(hk.thread, NULL);
+    tx_drain();
+
+    if (jit.started) {
+        jit_stop();
+    }
+
+    if (play.player != NULL) {
+        playback(true);
+        play.player->close();
+
+        // edges only remain if pacing never started
+        play.dropped += play.head - play.tail;
+        (void)fprintf(stderr,
+                      "avr-pi: %llu edges played, %llu late, %llu dropped\n",
+                      (unsigned long long)play.played,
+                      (unsigned long long)play.late,
+                      (unsigned long long)play.dropped);
+    }
+}
 
 static inline void setup(void) {
-    setbuf(stdout, NULL); // unbuffered
+    AVR_Callbacks callbacks = {.uart_tx = on_uart_tx};
+#ifdef AVR_NO_PI
+    // there are no pins, only a recording of them
+    if (play.player != NULL)
+#endif
+    {
+        callbacks.port = on_port;
+        callbacks.ddr  = on_ddr;
+    }
+    avr_set_callbacks(&mcu, &callbacks);
+
+    // first source the host has unless --clock picked one
+    for (size_t i = 0; timebase.source == NULL; i++) {
+        if (timebases[i].probe()) {
+            timebase.source = &timebases[i];
+        }
+    }
+    timebase_open(timebase.source);
+
     stdin_fd = open("/dev/tty", O_NONBLOCK);
-    assert(!(stdin_fd < 0));
+    if (stdin_fd < 0) {
+        // no terminal, as under ci, read stdin itself
+        stdin_fd = STDIN_FILENO;
+        (void)fcntl(stdin_fd, F_SETFL, fcntl(stdin_fd, F_GETFL) | O_NONBLOCK);
+    }
 
 #ifndef AVR_NO_PI
     for (int i = 0; i < 8; i++) {
@@ -175,75 +1250,234 @@ static inline void setup(void) {
             SET_BIT(mcu.data[REG_PIND], i, gpioRead(i + 16));
         }
     }
+#endif
+}
+
+// service io after avr_run returns AVR_EXIT_IO, tx bytes, ports, and ddrs reach the host through callbacks
+static inline void io(void) {
+    // clear tx bit if tx interrupts are NOT enabled
+    if (GET_BIT(mcu.data[REG_UCSR0A], BIT_TXC0)) {
+        SET_BIT(mcu.data[REG_UCSR0A], BIT_TXC0, GET_BIT(mcu.data[REG_UCSR0B], BIT_TXCIE0));
+    }
+}
+
+// link rx to stdin
+static inline void rx(char c) {
+    // set rx bit if rx interrupts ARE enabled
+    PUT_BIT(mcu.data[REG_UCSR0A], BIT_RXC0);
+    mcu.data[REG_UDR0] = c;
+}
 
-    ddrb_state  = mcu.data[REG_DDRB];
-    ddrc_state  = mcu.data[REG_DDRC];
-    ddrd_state  = mcu.data[REG_DDRD];
-    portb_state = mcu.data[REG_PORTB];
-    portc_state = mcu.data[REG_PORTC];
-    portd_state = mcu.data[REG_PORTD];
+// take what housekeeping gathered, a byte of stdin and the input pin levels
+static inline void take(void) {
+    const int c = __atomic_exchange_n(&hk.rx, -1, __ATOMIC_ACQ_REL);
+    if (c >= 0) {
+        rx((char)c);
+    }
+
+#ifndef AVR_NO_PI
+    inputs();
 #endif
 }
 
-static inline void loop(void) {
-    struct timespec t0, t1;
-    int cycles;
+static inline int64_t clamp(int64_t x, int64_t lo, int64_t hi) {
+    return x < lo ? lo : x > hi ? hi : x;
+}
+
+// follow a change of the system clock, deadlines count on from the clock it changed at at the new rate and quanta
+// keep their length in emulated time
+static inline void pace_clock(Pace *p) {
+    const uint32_t clock = avr_clock(&mcu);
+    if (clock == p->clock) {
+        return;
+    }
+
+    if (speed != 0.0) {
+        if (p->hz != 0) {
+            p->base = pace_deadline(p, mcu.clk);
+        }
+        p->hz = (uint64_t)(speed * clock + 0.5);
+        p->hz = p->hz ? p->hz : 1;
+    }
+
+    p->anchor  = mcu.clk;
+    p->clock   = clock;
+    p->quantum = avr_ns_to_cycles(&mcu, quantum_us * 1000);
+    p->quantum = p->quantum ? p->quantum : 1;
+    p->rx      = avr_ns_to_cycles(&mcu, RX_NS);
+}
+
+// wait for the deadline of the cycles run, sleep until margin ns before it and spin out the rest
+// runs ahead of the wall clock by up to the margin and a quantum, io timing is good to about that
+static inline void pace_wait(Pace *p) {
+    const int64_t deadline = pace_deadline(p, mcu.clk);
+    const int64_t wake     = deadline - p->margin;
+    int64_t t              = now();
+    const int64_t overrun  = t - deadline;
+
+    if (overrun > PACE_LAG_MAX + p->ahead) {
+        // too far behind to catch up, drop the lag rather than run flat out until it is made up
+        p->base += overrun;
+        p->lag  += overrun;
+    } else if (wake > t) {
+        // the timebase is anchored to CLOCK_MONOTONIC, its ns can be slept until as they are
+        const struct timespec until = {.tv_sec = wake / NSEC_PER_SEC, .tv_nsec = wake % NSEC_PER_SEC};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) != 0 && !sigint) {
+        }
+        t = now();
+
+        // buffered output plays at its own times, the deadline then only bounds the window and is not spun out
+        if (p->ahead == 0) {
+            // PI controller on the wake latency, the margin settles at the latency plus PACE_SPIN
+            const int64_t e = t - wake + PACE_SPIN - p->margin;
+            p->integral     = clamp(p->integral + e, 0, PACE_MARGIN_MAX * PACE_KI);
+            p->margin       = clamp(e / PACE_KP + p->integral / PACE_KI, 0, PACE_MARGIN_MAX);
+
+            while (t < deadline) {
+                t = now();
+            }
+        }
+    }
+    // otherwise ahead by less than a wake takes, the next quantum runs rather than this one being spun out
+
+    avr_timing_record(&p->timing, overrun, t - deadline);
+    p->timing.drift = t - pace_deadline(p, mcu.clk) + p->lag;
+}
+
+// block the thread while the mcu sleeps, until it could wake or input arrives, then run the cycles slept
+// cycles: cycles the mcu sleeps at least
+static inline void pace_doze(Pace *p, uint64_t cycles) {
+    struct pollfd fd = {.fd = hk.wake[0], .events = POLLIN};
     char c;
-    long err       = 0; // measures accumulation of error each iteration
-    uint32_t iters = 0; // used for extended timings 0..999,999
 
-    while (!sigint) {
-        (void)clock_gettime(CLOCK_MONOTONIC, &t0);
+    const int64_t ns            = pace_deadline(p, mcu.clk + cycles) - now();
+    const struct timespec until = {.tv_sec = ns > 0 ? ns / NSEC_PER_SEC : 0, .tv_nsec = ns > 0 ? ns % NSEC_PER_SEC : 0};
+
+    const bool input = ppoll(&fd, 1, &until, NULL) > 0;
 
-        cycles = avr_execute(&mcu);
+    // input cuts the sleep short, the cycles up to it are all that passed
+    const int64_t slept = (now() - pace_deadline(p, mcu.clk)) * (int64_t)p->hz / NSEC_PER_SEC;
+    cycles              = (uint64_t)clamp(slept, 1, (int64_t)cycles);
 
-        // link tx to stdout
-        if (GET_BIT(mcu.data[REG_UCSR0A], BIT_TXC0)) {
-            // clear tx bit if tx interrupts are NOT enabled
-            SET_BIT(mcu.data[REG_UCSR0A], BIT_TXC0, GET_BIT(mcu.data[REG_UCSR0B], BIT_TXCIE0));
-            putchar(mcu.data[REG_UDR0]);
+    // an interrupt woken in that time may transmit or change the clock like any other run
+    const uint64_t end = mcu.clk + cycles;
+    while (mcu.clk < end) {
+        if (avr_run(&mcu, end - mcu.clk, NULL) == AVR_EXIT_IO) {
+            io();
+            pace_clock(p);
         }
-        // link rx to stdin
-        else if (iters % 10000 == 0 && read(stdin_fd, &c, 1) > 0) {
-            // set rx bit if rx interrupts ARE enabled
-            PUT_BIT(mcu.data[REG_UCSR0A], BIT_RXC0);
-            mcu.data[REG_UDR0] = (char)c;
+    }
+
+    while (input && read(hk.wake[0], &c, 1) > 0) {
+    }
+    take();
+}
+
+// run one quantum of cycles as fast as possible
+static inline void pace_run(Pace *p) {
+    const uint64_t end = mcu.clk + p->quantum;
+
+    if (mcu.clk >= p->take) {
+        take();
+        p->take = mcu.clk + p->rx;
+    }
+
+    while (mcu.clk < end) {
+        if (avr_run(&mcu, end - mcu.clk, NULL) == AVR_EXIT_IO) {
+            io();
+            pace_clock(p);
         }
+    }
+}
 
-#ifndef AVR_NO_PI
-        update_ddr(REG_DDRB, &ddrb_state, 0);
-        update_ddr(REG_DDRC, &ddrc_state, 8);
-        update_ddr(REG_DDRD, &ddrd_state, 16);
-
-        // TODO optimize, too slow
-        // update_pin(REG_PINB, REG_DDRB, 0);
-        // update_pin(REG_PINC, REG_DDRC, 8);
-        // update_pin(REG_PIND, REG_DDRD, 16);
-
-        update_port(REG_PORTB, REG_DDRB, &portb_state, 0);
-        update_port(REG_PORTC, REG_DDRC, &portc_state, 8);
-        update_port(REG_PORTD, REG_DDRD, &portd_state, 16);
-#endif
+// report pacing accuracy, on SIGUSR1 and at exit
+static void timing_dump(const AVR_Timing *timing) {
+    uint64_t count = 0;
+
+    (void)fprintf(stderr,
+                  "avr-pi: %llu quanta, %llu missed deadlines, longest overrun %lld ns, drift %lld ns\n",
+                  (unsigned long long)timing->quanta,
+                  (unsigned long long)timing->missed,
+                  (long long)timing->overrun,
+                  (long long)timing->drift);
+    (void)fprintf(stderr,
+                  "avr-pi: error p50 %llu ns, p90 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\n",
+                  (unsigned long long)avr_timing_percentile(timing, 50.0),
+                  (unsigned long long)avr_timing_percentile(timing, 90.0),
+                  (unsigned long long)avr_timing_percentile(timing, 99.0),
+                  (unsigned long long)avr_timing_percentile(timing, 99.9),
+                  (unsigned long long)avr_timing_percentile(timing, 100.0));
+
+    // buckets folded by power of two
+    for (uint32_t i = 0; i < AVR_TIMING_BUCKETS; i++) {
+        count += timing->error[i];
+        if (count != 0 && ((i + 1) % (1u << AVR_TIMING_SUB_BITS) == 0 || i + 1 == AVR_TIMING_BUCKETS)) {
+            (void)fprintf(stderr,
+                          "avr-pi: error <= %llu ns %llu\n",
+                          (unsigned long long)avr_timing_value(i),
+                          (unsigned long long)count);
+            count = 0;
+        }
+    }
+}
 
-        // spend approximately one clk period on each cycle
-        // errors are tracked and accounted for
-        while (cycles) {
-            do {
-                (void)clock_gettime(CLOCK_MONOTONIC, &t1);
-            } while (diff_timespec(t0, t1) - (AVR_MCU_CLK_PERIOD - err) < ERR_RANGE_2);
-            err = diff_timespec(t0, t1) - (AVR_MCU_CLK_PERIOD - err);
+static inline void loop(void) {
+    pace = (Pace){
+        .base   = now(),
+        .anchor = mcu.clk,
+        .ahead  = ahead_ms * 1000000,
+        .margin = ahead_ms ? 0 : PACE_SPIN,
+    };
+    pace.start = pace.base;
+    pace_clock(&pace);
 
-            avr_cycle(&mcu);
+    // playback starts once the edges of its first chunk could have been made
+    __atomic_store_n(&play.horizon, pace.base + pace.ahead, __ATOMIC_RELEASE);
+    __atomic_store_n(&play.start, pace.base + pace.ahead, __ATOMIC_RELEASE);
 
-            cycles += avr_interrupt(&mcu);
+    while (!sigint && avr_ns(&mcu) < limit) {
+        if (usr1) {
+            usr1 = 0;
+            timing_dump(&pace.timing);
+        }
 
-            cycles--;
-            if (cycles) {
-                (void)clock_gettime(CLOCK_MONOTONIC, &t0);
-            }
+        if (jit.started) {
+            jit_poll();
+        }
+
+        // unpaced, time is only the cycles run
+        if (pace.hz == 0) {
+            pace_run(&pace);
+            continue;
+        }
+
+        // an interrupt run while dozing may have changed the system clock
+        pace_clock(&pace);
+
+        // asleep past the quantum there is nothing to run until the mcu could wake
+        const uint64_t sleep = avr_sleep_cycles(&mcu);
+        if (sleep > pace.quantum) {
+            pace_doze(&pace, sleep);
+        } else {
+            pace_run(&pace);
+            pace_wait(&pace);
+        }
+
+        if (pace.ahead) {
+            __atomic_store_n(&play.horizon, pace_deadline(&pace, mcu.clk) + pace.ahead, __ATOMIC_RELEASE);
         }
+    }
+
+    const double wall = (double)(now() - pace.start) / NSEC_PER_SEC;
+    (void)fprintf(stderr,
+                  "avr-pi: %llu cycles in %.3f s, %.2f MHz, %.2fx real time\n",
+                  (unsigned long long)mcu.clk,
+                  wall,
+                  (double)mcu.clk / wall / 1000000.0,
+                  (double)avr_ns(&mcu) / NSEC_PER_SEC / wall);
 
-        iters = (iters + 1) % 1000000;
+    if (pace.timing.quanta != 0) {
+        timing_dump(&pace.timing);
     }
 }
 
@@ -253,23 +1487,28 @@ int main(int argc, char *argv[]) {
     int ret   = 0;
     struct stat st;
 
-    if (argc != 2) {
+    const int arg = options(argc, argv);
+
+    if (arg < 0 || (argc - arg != 1 && argc - arg != 2)) {
         goto error;
-    } else if (strncmp(argv[1], "--help", 6) == 0) {
+    } else if (strncmp(argv[arg], "--help", 6) == 0) {
         print_help();
         return 0;
-    } else if (strncmp(argv[1], "--version", 9) == 0) {
+    } else if (strncmp(argv[arg], "--version", 9) == 0) {
         print_version();
         return 0;
-    } else if (strnlen(argv[1], MAX_PATH) <= 4 || strcasecmp(strrchr(argv[1], '.'), ".hex") != 0) {
+    } else if (strncmp(argv[arg], "--bench-clock", 13) == 0) {
+        bench_clock();
+        return 0;
+    } else if (strnlen(argv[arg], MAX_PATH) <= 4 || strcasecmp(strrchr(argv[arg], '.'), ".hex") != 0) {
         LOG_ERROR("invalid hex file");
         print_help();
         goto error;
     }
 
-    fd = open(argv[1], O_RDONLY);
+    fd = open(argv[arg], O_RDONLY);
     if (fd < 0) {
-        LOG_ERROR("could not read file %s", argv[1]);
+        LOG_ERROR("could not read file %s", argv[arg]);
         goto error;
     }
 
@@ -286,10 +1525,10 @@ int main(int argc, char *argv[]) {
 
     switch (read(fd, buf, st.st_size)) {
     case -1:
-        LOG_ERROR("could not read file %s", argv[1]);
+        LOG_ERROR("could not read file %s", argv[arg]);
         goto error;
     case 0:
-        LOG_ERROR("file is empty %s", argv[1]);
+        LOG_ERROR("file is empty %s", argv[arg]);
         goto error;
     default:
         buf[st.st_size] = '\0';
@@ -302,6 +1541,7 @@ int main(int argc, char *argv[]) {
     assert((stderr = fopen(LOG_NAME, "w"))); // NOLINT
 
     avr_mcu_init(&mcu);
+    avr_set_clock(&mcu, (uint32_t)f_cpu);
 
     if (avr_program(&mcu, buf) != AVR_OK) {
         LOG_ERROR("failed to write program to flash");
@@ -311,17 +1551,38 @@ int main(int argc, char *argv[]) {
     free(buf);
     buf = NULL;
 
+    if (argc - arg == 2 && jit.state != JIT_OFF) {
+        LOG_ERROR("--jit compiles blocks itself, it takes no shared object");
+        goto error;
+    }
+    jit.hex = argv[arg];
+
+    if (argc - arg == 2 && attach(argv[arg + 1]) != AVR_OK) {
+        goto error;
+    }
+
 #ifndef AVR_NO_PI
     if (gpioInitialise() == PI_INIT_FAILED) {
         LOG_ERROR("failed to initialize GPIO interface");
         goto error;
     } else {
 #endif
-        if (signal(SIGINT, signal_handler) != SIG_ERR) {
+        if (play.player != NULL && !play.player->open()) {
+            LOG_ERROR("could not open output playback");
+            ret = -1;
+        } else if (signal(SIGINT, signal_handler) != SIG_ERR && signal(SIGUSR1, signal_handler) != SIG_ERR) {
             setup();
-            loop();
+            if (harden()) {
+                loop();
+                teardown();
+            } else {
+                if (play.player != NULL) {
+                    play.player->close();
+                }
+                ret = -1;
+            }
         } else {
-            LOG_ERROR("failed to setup SIGINT handler");
+            LOG_ERROR("failed to setup signal handlers");
             ret = -1; // don't goto error because gpio needs to be terminated
         }
 #ifndef AVR_NO_PI
@@ -0,0 +1,198 @@
+/**
+ * avr-pi
+ * Copyright (C) 2024 Jonathan Forhan <jonathan.forhan@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// avr-pi-aot-test {file}.hex {file}.so [avr-pi-aot], compares a program compiled by avr-pi-aot with the interpreter.
+// Given avr-pi-aot, the blocks that turned hot are compiled partway through instead, as avr-pi --jit does.
+//
+// Kept apart from test.c, whose extra event kinds change the layout of AVR_MCU the shared object was compiled against.
+
+#define _POSIX_C_SOURCE 200809L // posix_spawnp
+
+#include <avr.h>
+#include <dlfcn.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#include <avr.c> // NOLINT(bugprone-suspicious-include)
+
+extern char **environ;
+
+static AVR_MCU interp, native;
+
+// read a whole file into a NULL terminated buffer
+static char *read_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+
+    (void)fseek(f, 0, SEEK_END);
+    const long size = ftell(f);
+    (void)fseek(f, 0, SEEK_SET);
+
+    char *buf = size > 0 ? malloc(size + 1) : NULL; // +1 NULL byte
+    if (buf == NULL || fread(buf, 1, size, f) != (size_t)size) {
+        free(buf);
+        (void)fclose(f);
+        return NULL;
+    }
+    buf[size] = '\0';
+
+    (void)fclose(f);
+    return buf;
+}
+
+// write the program to both mcus
+static AVR_Result program(const char *hex_path) {
+    char *hex = read_file(hex_path);
+    if (hex == NULL) {
+        LOG_ERROR("test failed aot: could not read %s", hex_path);
+        return AVR_ERROR;
+    }
+
+    avr_mcu_init(&interp);
+    avr_mcu_init(&native);
+
+    const bool programmed = avr_program(&interp, hex) == AVR_OK && avr_program(&native, hex) == AVR_OK;
+    free(hex);
+
+    return programmed ? AVR_OK : AVR_ERROR;
+}
+
+// load a shared object and attach it to the native mcu
+static AVR_Result attach(const char *so_path, AVR_Result (**aot_attach)(AVR_MCU *restrict)) {
+    const AVR_AotStamp stamp = AVR_AOT_STAMP;
+
+    void *so = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+    if (so == NULL) {
+        LOG_ERROR("test failed aot: could not load %s", so_path);
+        return AVR_ERROR;
+    }
+
+    const AVR_AotStamp *so_stamp = dlsym(so, "avr_aot_stamp");
+    *(void **)aot_attach         = dlsym(so, "avr_aot_attach");
+
+    if (so_stamp == NULL || memcmp(so_stamp, &stamp, sizeof(stamp)) != 0 || *aot_attach == NULL ||
+        (*aot_attach)(&native) != AVR_OK || native.native == NULL) {
+        LOG_ERROR("test failed aot: could not attach %s", so_path);
+        return AVR_ERROR;
+    }
+
+    return AVR_OK;
+}
+
+// run both mcus side by side up to clk end, in quanta that end at different points of the program, and compare them
+// after every one
+static AVR_Result lockstep(u64 end) {
+    for (u32 quantum = 0; interp.clk < end; quantum++) {
+        const u64 budget = 500 + quantum % 1000;
+
+        const AVR_Exit interp_exit = avr_run(&interp, budget, NULL);
+        const AVR_Exit native_exit = avr_run(&native, budget, NULL);
+
+        if (interp_exit != native_exit || interp.clk != native.clk || interp.pc != native.pc ||
+            memcmp(interp.data, native.data, sizeof(interp.data)) != 0) {
+            LOG_ERROR("test failed aot: quantum %u, clk %lu and %lu, pc %#x and %#x", quantum,
+                      (unsigned long)interp.clk, (unsigned long)native.clk, interp.pc, native.pc);
+            return AVR_ERROR;
+        }
+    }
+
+    return AVR_OK;
+}
+
+// a program compiled ahead of time runs as interpreted for one emulated second
+static AVR_Result test_aot(const char *hex_path, const char *so_path) {
+    AVR_Result (*aot_attach)(AVR_MCU *restrict);
+
+    if (program(hex_path) != AVR_OK || attach(so_path, &aot_attach) != AVR_OK) {
+        return AVR_ERROR;
+    }
+
+    // a program with another flash is refused
+    interp.flash[0] ^= 1;
+    if (aot_attach(&interp) != AVR_ERROR || interp.native != NULL) {
+        LOG_ERROR("test failed aot: attached to another program");
+        return AVR_ERROR;
+    }
+    interp.flash[0] ^= 1;
+
+    return lockstep(AVR_MCU_CLK_SPEED);
+}
+
+// blocks that turned hot in the first eighth of a second, compiled then and attached, run as interpreted for the rest
+// of the second
+static AVR_Result test_jit(const char *hex_path, const char *so_path, const char *aot) {
+    static char names[AVR_MCU_FLASH_SIZE / 2][8];
+    static char *args[AVR_MCU_FLASH_SIZE / 2 + 4];
+    AVR_Result (*aot_attach)(AVR_MCU *restrict);
+    pid_t pid;
+    int status;
+
+    if (program(hex_path) != AVR_OK || lockstep(AVR_MCU_CLK_SPEED / 8) != AVR_OK) {
+        return AVR_ERROR;
+    }
+
+    u32 count = 0;
+    args[0]   = (char *)aot;
+    args[1]   = (char *)hex_path;
+    args[2]   = (char *)so_path;
+    for (u32 pc = 0; pc < AVR_MCU_FLASH_SIZE / 2; pc++) {
+        if (native.blocks[pc].heat == AVR_JIT_HOT) {
+            (void)snprintf(names[count], sizeof(names[count]), "%#x", pc);
+            args[3 + count] = names[count];
+            count += 1;
+        }
+    }
+    args[3 + count] = NULL;
+
+    if (count == 0 || count != native.hot_blocks) {
+        LOG_ERROR("test failed jit: %u hot blocks, %u counted", count, native.hot_blocks);
+        return AVR_ERROR;
+    }
+
+    if (posix_spawnp(&pid, aot, NULL, NULL, args, environ) != 0 || waitpid(pid, &status, 0) != pid ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        LOG_ERROR("test failed jit: %s could not compile %u hot blocks", aot, count);
+        return AVR_ERROR;
+    }
+
+    if (attach(so_path, &aot_attach) != AVR_OK) {
+        return AVR_ERROR;
+    }
+
+    return lockstep(AVR_MCU_CLK_SPEED);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3 && argc != 4) {
+        LOG_ERROR("usage: %s {file}.hex {file}.so [avr-pi-aot]", argv[0]);
+        return -1;
+    }
+
+    if ((argc == 3 ? test_aot(argv[1], argv[2]) : test_jit(argv[1], argv[2], argv[3])) != AVR_OK) {
+        printf("tests failed\n");
+        return -1;
+    }
+
+    printf("tests ran successfully\n");
+    return 0;
+}
@@ -16,6 +16,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+// extra event kinds to exercise the schedule heap with
+#define AVR_TEST_EVENTS
+
 #include <avr.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -47,6 +50,7 @@ static AVR_Result test_arithmetic_and_logic_instructions(void) {
     // adc
     for (u16 i = 0; i < 256; i++) {
         for (u16 j = 0; j < 256; j++) {
+            sreg_sync(&mcu);
             PUT_BIT(*mcu.sreg, SREG_C);
             mcu.reg[0] = i, mcu.reg[1] = j;
 
@@ -120,6 +124,7 @@ static AVR_Result test_arithmetic_and_logic_instructions(void) {
     // sbc
     for (u16 i = 0; i < 256; i++) {
         for (u16 j = 0; j < 256; j++) {
+            sreg_sync(&mcu);
             PUT_BIT(*mcu.sreg, SREG_C);
             mcu.reg[0] = i, mcu.reg[1] = j;
 
@@ -139,6 +144,7 @@ static AVR_Result test_arithmetic_and_logic_instructions(void) {
     // sbci
     for (u16 i = 0; i < 256; i++) {
         for (u16 j = 0; j < 256; j++) {
+            sreg_sync(&mcu);
             PUT_BIT(*mcu.sreg, SREG_C);
             mcu.reg[16] = i;
 
@@ -614,6 +620,7 @@ static AVR_Result test_branch_instructions(void) {
         u8 expected = mcu.reg[0] == mcu.reg[1];
 
         cp(&mcu, 0, 1);
+        sreg_sync(&mcu);
 
         u8 real = GET_BIT(*mcu.sreg, SREG_Z);
 
@@ -625,6 +632,7 @@ static AVR_Result test_branch_instructions(void) {
 
     // cpc
     for (int i = 0; i < 2; i++) {
+        sreg_sync(&mcu);
         PUT_BIT(*mcu.sreg, SREG_C);
         PUT_BIT(*mcu.sreg, SREG_Z);
 
@@ -634,6 +642,7 @@ static AVR_Result test_branch_instructions(void) {
         u8 expected = mcu.reg[0] == mcu.reg[1] + 1;
 
         cpc(&mcu, 0, 1);
+        sreg_sync(&mcu);
 
         u8 real = GET_BIT(*mcu.sreg, SREG_Z);
 
@@ -650,6 +659,7 @@ static AVR_Result test_branch_instructions(void) {
         u8 expected = mcu.reg[16] == i;
 
         cpi(&mcu, 16, i);
+        sreg_sync(&mcu);
 
         u8 real = GET_BIT(*mcu.sreg, SREG_Z);
 
@@ -673,6 +683,7 @@ static AVR_Result test_branch_instructions(void) {
 
     // brbs
     for (int i = 0; i < 8; i++) {
+        sreg_sync(&mcu);
         *mcu.sreg = 0b11110000;
         mcu.pc    = 0;
         i8 k      = 42;
@@ -691,6 +702,7 @@ static AVR_Result test_branch_instructions(void) {
 
     // brbc
     for (int i = 0; i < 8; i++) {
+        sreg_sync(&mcu);
         *mcu.sreg = 0b11110000;
         mcu.pc    = 0;
         i8 k      = 42;
@@ -812,6 +824,7 @@ static AVR_Result test_bit_and_bit_test_instructions(void) {
 
     // bset
     for (int i = 0; i < 8; i++) {
+        sreg_sync(&mcu);
         u8 expected = *mcu.sreg | (1 << i);
 
         bset(&mcu, i);
@@ -954,6 +967,24 @@ static AVR_Result test_data_transfer_instructions(void) {
     // lpm
     // TODO tests
 
+    // spm
+    {
+        *(u16 *)&mcu.reg[REG_Z] = 0x100;
+        *(u16 *)&mcu.reg[0]     = OP_JMP;
+        spm(&mcu);
+
+        *(u16 *)&mcu.reg[REG_Z] = 0x101;
+        *(u16 *)&mcu.reg[0]     = 0x1234;
+        spm(&mcu);
+
+        const AVR_Instr *real = &mcu.decoded[0x100];
+
+        if (real->op != OP_ID_JMP || real->len != 2 || real->k != 0x1234) {
+            LOG_ERROR("test failed spm: real op %d len %d k %#x, expected jmp", real->op, real->len, real->k);
+            return AVR_ERROR;
+        }
+    }
+
     // in
     {
         mcu.io_reg[63] = 42;
@@ -971,7 +1002,21 @@ static AVR_Result test_data_transfer_instructions(void) {
     }
 
     // out
-    // TODO tests
+    {
+        // timer flags clear when a one is written, read only bits keep their value
+        mcu.data[REG_TIFR0]  = 0x07;
+        mcu.data[REG_UCSR0A] = 0x20;
+        mcu.reg[0]           = 0x05;
+        mcu.reg[1]           = 0x00;
+
+        out(&mcu, REG_TIFR0 - AVR_MCU_IO_REG_OFFSET, 0);
+        sts(&mcu, REG_UCSR0A, 1);
+
+        if (mcu.data[REG_TIFR0] != 0x02 || mcu.data[REG_UCSR0A] != 0x20) {
+            LOG_ERROR("test failed out: tifr0 %#x, ucsr0a %#x", mcu.data[REG_TIFR0], mcu.data[REG_UCSR0A]);
+            return AVR_ERROR;
+        }
+    }
 
     // push
     {
@@ -1007,6 +1052,738 @@ static AVR_Result test_data_transfer_instructions(void) {
     return AVR_OK;
 }
 
+static u8 callback_port;
+
+static void on_port(void *user, AVR_Port port, uint8_t old, uint8_t val) {
+    (void)old;
+    *(int *)user += 1;
+    callback_port = port == AVR_PORT_B ? val : 0;
+}
+
+static u8 callback_ddr;
+static u8 callback_outputs;
+static u8 callback_tx;
+
+static void on_ddr(void *user, AVR_Port port, uint8_t old, uint8_t val) {
+    (void)old;
+    *(int *)user += 1;
+    callback_ddr = port == AVR_PORT_B ? val : 0;
+}
+
+static void on_pin_mode(void *user, AVR_Port port, uint8_t bit, AVR_PinMode mode) {
+    *(int *)user += 1;
+    if (port == AVR_PORT_B && mode == AVR_PIN_OUTPUT) {
+        callback_outputs |= 1 << bit;
+    }
+}
+
+static void on_uart_tx(void *user, uint8_t byte) {
+    *(int *)user += 1;
+    callback_tx = byte;
+}
+
+static u8 callback_sreg;
+static u8 callback_tcnt;
+
+static void on_port_state(void *user, AVR_Port port, uint8_t old, uint8_t val) {
+    const AVR_MCU *mcu = user;
+    (void)port, (void)old, (void)val;
+    callback_sreg = *mcu->sreg;
+    callback_tcnt = mcu->data[REG_TCNT0];
+}
+
+// runtime routines as avr-gcc links them, from their entry to their ret
+static const u16 udivmodsi4[] = {
+    0xE2A1, 0x2E1A, 0x1BAA, 0x1BBB, 0x01FD, 0xC00D, 0x1FAA, 0x1FBB, 0x1FEE, 0x1FFF, 0x17A2, 0x07B3,
+    0x07E4, 0x07F5, 0xF020, 0x1BA2, 0x0BB3, 0x0BE4, 0x0BF5, 0x1F66, 0x1F77, 0x1F88, 0x1F99, 0x941A,
+    0xF769, 0x9560, 0x9570, 0x9580, 0x9590, 0x019B, 0x01AC, 0x01BD, 0x01CF, 0x9508,
+};
+static const u16 udivmodhi4[] = {
+    0x1BAA, 0x1BBB, 0xE151, 0xC007, 0x1FAA, 0x1FBB, 0x17A6, 0x07B7, 0xF010, 0x1BA6,
+    0x0BB7, 0x1F88, 0x1F99, 0x955A, 0xF7A9, 0x9580, 0x9590, 0x01BC, 0x01CD, 0x9508,
+};
+static const u16 memcpy_words[] = {0x01FB, 0x01DC, 0xC002, 0x9001, 0x920D, 0x5041, 0x4050, 0xF7D8, 0x9508};
+
+// start a test_run case from reset, with program in flash from address 0 and predecoded
+static void run_init(AVR_MCU *restrict mcu, const u16 *restrict program, size_t words) {
+    avr_mcu_init(mcu);
+    memcpy(mcu->flash, program, words * sizeof(*program));
+    predecode(mcu);
+}
+
+// call the routine placed at 0x100 with args in r18 through r25 up to the break after the call, through avr_run or
+// instruction by instruction, returns the cycles taken
+static u64 run_routine(AVR_MCU *restrict mcu, const u16 *restrict routine, size_t words, const u8 *restrict args,
+                       bool interpret) {
+    static const u16 program[] = {
+        0x940E, // call 0x100
+        0x0100,
+        0x9598, // break
+    };
+    run_init(mcu, program, sizeof(program) / sizeof(program[0]));
+    memcpy(&mcu->flash[0x100], routine, words * sizeof(*routine));
+    predecode(mcu);
+    memcpy(&mcu->reg[18], args, 8);
+
+    u64 cycles = 0;
+    if (interpret) {
+        while (mcu->decoded[mcu->pc].op != OP_ID_BREAK) {
+            cycles += avr_execute(mcu);
+        }
+    } else {
+        (void)avr_run(mcu, 10000, &cycles);
+    }
+
+    return cycles;
+}
+
+static AVR_Result test_run(void) {
+    AVR_MCU mcu;
+    u64 cycles;
+
+    // ldi is a block and out must be stepped, io exits before out is clocked and break after it
+    {
+        static const u16 program[] = {
+            0xEF0F, // ldi r16, 0xFF
+            0xB904, // out DDRB, r16
+            0x9598, // break
+        };
+        run_init(&mcu, program, sizeof(program) / sizeof(program[0]));
+
+        const AVR_Block *blocks = mcu.blocks;
+
+        if (blocks[0].count != 1 || blocks[0].cycles != 1 || blocks[1].count != 0 || blocks[2].count != 0) {
+            LOG_ERROR("test failed blocks: real %u %u %u", blocks[0].count, blocks[1].count, blocks[2].count);
+            return AVR_ERROR;
+        }
+
+        AVR_Exit real = avr_run(&mcu, 100, &cycles);
+
+        if (real != AVR_EXIT_IO || cycles != 1 || mcu.stall != 1 || mcu.data[REG_DDRB] != 0xFF) {
+            LOG_ERROR("test failed run io: real %d, cycles %lu, stall %u", real, (unsigned long)cycles, mcu.stall);
+            return AVR_ERROR;
+        }
+
+        real = avr_run(&mcu, 100, &cycles);
+
+        if (real != AVR_EXIT_BREAK || cycles != 1 || mcu.pc != 3) {
+            LOG_ERROR("test failed run break: real %d, cycles %lu, pc %u", real, (unsigned long)cycles, mcu.pc);
+            return AVR_ERROR;
+        }
+
+        real = avr_run(&mcu, 1, &cycles);
+
+        if (real != AVR_EXIT_BUDGET || cycles != 1) {
+            LOG_ERROR("test failed run budget: real %d, cycles %lu", real, (unsigned long)cycles);
+            return AVR_ERROR;
+        }
+    }
+
+    // blocks chain through the branch ending them
+    {
+        static const u16 program[] = {
+            0xEF0F, // ldi r16, 0xFF
+            0xCFFE, // rjmp .-4
+            0x9598, // break
+        };
+        run_init(&mcu, program, sizeof(program) / sizeof(program[0]));
+
+        AVR_Exit real = avr_run(&mcu, 30, &cycles);
+
+        if (mcu.blocks[0].span != 3 || real != AVR_EXIT_BUDGET || cycles != 30 || mcu.pc != 0) {
+            LOG_ERROR("test failed run chain: span %u, cycles %lu, pc %u", mcu.blocks[0].span, (unsigned long)cycles,
+                      mcu.pc);
+            return AVR_ERROR;
+        }
+    }
+
+    // interpreted blocks turn hot once, natively compiled ones are no longer counted
+    {
+        static const u16 program[] = {
+            0x9503, // inc r16
+            0xCFFE, // rjmp .-4
+        };
+        run_init(&mcu, program, sizeof(program) / sizeof(program[0]));
+
+        (void)avr_run(&mcu, 3 * 100, &cycles);
+
+        if (mcu.blocks[0].heat != AVR_JIT_HOT || mcu.hot_blocks != 1 || mcu.reg[16] != 100) {
+            LOG_ERROR("test failed run heat: heat %u, hot %u, r16 %u", mcu.blocks[0].heat, mcu.hot_blocks,
+                      mcu.reg[16]);
+            return AVR_ERROR;
+        }
+    }
+
+    // fused sequences run as one handler
+    {
+        static const u16 program[] = {
+            0xEF0F, // ldi r16, 0xFF
+            0xE010, // ldi r17, 0x00
+            0xCFFD, // rjmp .-6
+        };
+        run_init(&mcu, program, sizeof(program) / sizeof(program[0]));
+        mcu.reg[17] = 0xFF;
+
+        AVR_Exit real = avr_run(&mcu, 40, &cycles);
+
+        if (mcu.decoded[0].fused != FUSE_LDI_LDI || mcu.fused_sites != 1 || real != AVR_EXIT_BUDGET || cycles != 40 ||
+            mcu.pc != 0 || mcu.reg[16] != 0xFF || mcu.reg[17] != 0) {
+            LOG_ERROR("test failed run fused: sites %u, cycles %lu, pc %u", mcu.fused_sites, (unsigned long)cycles,
+                      mcu.pc);
+            return AVR_ERROR;
+        }
+    }
+
+    // deferred flags are written to sreg when it is read and on return
+    {
+        static const u16 program[] = {
+            0xE800, // ldi r16, 0x80
+            0xE011, // ldi r17, 0x01
+            0x0F01, // add r16, r17
+            0xB72F, // in r18, SREG
+            0x9598, // break
+        };
+        run_init(&mcu, program, sizeof(program) / sizeof(program[0]));
+
+        AVR_Exit real = avr_run(&mcu, 100, &cycles);
+
+        // N = 1, V = 0, S = N ^ V
+        const u8 expected = (1 << SREG_S) | (1 << SREG_N);
+
+        if (real != AVR_EXIT_BREAK || mcu.reg[18] != expected || *mcu.sreg != expected) {
+            LOG_ERROR("test failed run flags: in %#x, sreg %#x, expected %#x", mcu.reg[18], *mcu.sreg, expected);
+            return AVR_ERROR;
+        }
+    }
+
+    // runtime routines run natively in the cycles their instructions take
+    {
+        static const u16 program[] = {
+            0x940E, // call memcpy
+            0x0100,
+            0x9598, // break
+        };
+        run_init(&mcu, program, sizeof(program) / sizeof(program[0]));
+        memcpy(&mcu.flash[0x100], memcpy_words, sizeof(memcpy_words));
+        predecode(&mcu);
+
+        memcpy(&mcu.data[0x200], "avr", 4);
+        *(u16 *)&mcu.reg[24] = 0x300; // dst
+        *(u16 *)&mcu.reg[22] = 0x200; // src
+        *(u16 *)&mcu.reg[20] = 4;     // len
+
+        AVR_Exit real = avr_run(&mcu, 100, &cycles);
+
+#ifndef AVR_NO_HLE
+        if (mcu.blocks[0x100].hle != HLE_MEMCPY || mcu.hle_sites != 1) {
+            LOG_ERROR("test failed run hle: sites %u", mcu.hle_sites);
+            return AVR_ERROR;
+        }
+#endif
+
+        // call, 11 + 7 per byte, the break is clocked by the next run
+        if (real != AVR_EXIT_BREAK || cycles != 43 || memcmp(&mcu.data[0x300], "avr", 4) != 0 ||
+            *(u16 *)&mcu.reg[REG_X] != 0x304) {
+            LOG_ERROR("test failed run hle: cycles %lu, dst %s", (unsigned long)cycles, (const char *)&mcu.data[0x300]);
+            return AVR_ERROR;
+        }
+    }
+
+    // divisions run natively leave registers, sreg, the stack, and the cycles as the interpreted routine does
+    {
+        static AVR_MCU interpreted;
+        static const struct {
+            const u16 *routine;
+            size_t words;
+            u8 args[8]; // r18 through r25
+        } cases[] = {
+            // 0xDEADBEEF / 0x1234, divisor in r18:r21 and dividend in r22:r25
+            {udivmodsi4, sizeof(udivmodsi4) / sizeof(u16), {0x34, 0x12, 0x00, 0x00, 0xEF, 0xBE, 0xAD, 0xDE}},
+            // 1000000 / 0
+            {udivmodsi4, sizeof(udivmodsi4) / sizeof(u16), {0x00, 0x00, 0x00, 0x00, 0x40, 0x42, 0x0F, 0x00}},
+            // 60000 / 7, divisor in r22:r23 and dividend in r24:r25
+            {udivmodhi4, sizeof(udivmodhi4) / sizeof(u16), {0x00, 0x00, 0x00, 0x00, 0x07, 0x00, 0x60, 0xEA}},
+            // 7 / 60000
+            {udivmodhi4, sizeof(udivmodhi4) / sizeof(u16), {0x00, 0x00, 0x00, 0x00, 0x60, 0xEA, 0x07, 0x00}},
+        };
+
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+            const u64 native = run_routine(&mcu, cases[i].routine, cases[i].words, cases[i].args, false);
+            const u64 real   = run_routine(&interpreted, cases[i].routine, cases[i].words, cases[i].args, true);
+
+            if (native != real || memcmp(mcu.reg, interpreted.reg, 32) != 0 || *mcu.sreg != *interpreted.sreg ||
+                *mcu.sp != *interpreted.sp) {
+                LOG_ERROR("test failed run division %zu: cycles %lu, expected %lu", i, (unsigned long)native,
+                          (unsigned long)real);
+                return AVR_ERROR;
+            }
+        }
+
+#ifndef AVR_NO_HLE
+        if (mcu.hle_sites != 1 || mcu.blocks[0x100].hle != HLE_UDIVMODHI4) {
+            LOG_ERROR("test failed run division: sites %u", mcu.hle_sites);
+            return AVR_ERROR;
+        }
+#endif
+    }
+
+    // delay loops count down in closed form
+    {
+        static const u16 program[] = {
+            0xEE88, // ldi r24, 0xE8
+            0xE093, // ldi r25, 0x03
+            0x9701, // sbiw r24, 1
+            0xF7F1, // brne .-4
+            0x9598, // break
+        };
+        run_init(&mcu, program, sizeof(program) / sizeof(program[0]));
+
+        AVR_Exit real = avr_run(&mcu, 10000, &cycles);
+
+        // ldi twice, 4 per iteration and 3 for the last
+        if (mcu.blocks[2].delay != DELAY_SBIW || real != AVR_EXIT_BREAK || cycles != 2 + 999 * 4 + 3 ||
+            mcu.pc != 5 || *(u16 *)&mcu.reg[24] != 0 || GET_BIT(*mcu.sreg, SREG_Z) == 0) {
+            LOG_ERROR("test failed run delay: cycles %lu, pc %u, counter %u", (unsigned long)cycles, mcu.pc,
+                      *(u16 *)&mcu.reg[24]);
+            return AVR_ERROR;
+        }
+    }
+
+    // an idle loop, the timer clocked at clk / 8
+    static const u16 idle[] = {
+        0x0000, // nop
+        0xCFFE, // rjmp .-4
+    };
+
+    // idle loops skip their passes while timers keep ticking
+    {
+        run_init(&mcu, idle, sizeof(idle) / sizeof(idle[0]));
+        mcu.data[REG_TCCR0B] = 0x02;
+
+        AVR_Exit real = avr_run(&mcu, 3000, &cycles);
+
+        // 375 ticks, one overflow
+        if (!mcu.blocks[0].head || real != AVR_EXIT_BUDGET || cycles != 3000 || mcu.pc != 0 ||
+            mcu.data[REG_TCNT0] != 119 || GET_BIT(mcu.data[REG_TIFR0], BIT_TOV0) == 0 || mcu.clk != 3000 ||
+            mcu.sched_clk != mcu.clk) {
+            LOG_ERROR("test failed run idle: cycles %lu, pc %u, tcnt %u", (unsigned long)cycles, mcu.pc,
+                      mcu.data[REG_TCNT0]);
+            return AVR_ERROR;
+        }
+    }
+
+    // the clock counts on past 16 bits and a prescaler reset restarts the ticks it clocks
+    {
+        run_init(&mcu, idle, sizeof(idle) / sizeof(idle[0]));
+        mcu.data[REG_TCCR0B] = 0x02;
+
+        AVR_Exit real = avr_run(&mcu, 70000, &cycles);
+        const u64 clk = mcu.clk;
+
+        if (real != AVR_EXIT_BUDGET || clk != 70000 || mcu.data[REG_TCNT0] != (u8)(70000 / 8) ||
+            avr_ns(&mcu) != 4375000 || avr_ns_to_cycles(&mcu, 4375000) != clk) {
+            LOG_ERROR("test failed run clk: clk %lu, tcnt %u", (unsigned long)clk, mcu.data[REG_TCNT0]);
+            return AVR_ERROR;
+        }
+
+        // 3 cycles into a tick, the reset puts the next one 8 cycles away rather than 5
+        (void)avr_run(&mcu, 3, NULL);
+        const u8 tcnt = mcu.data[REG_TCNT0];
+        data_store(&mcu, REG_GTCCR, 1 << BIT_PSRSYNC);
+        (void)avr_run(&mcu, 7, NULL);
+        const u8 early = mcu.data[REG_TCNT0];
+        (void)avr_run(&mcu, 1, NULL);
+
+        if (early != tcnt || mcu.data[REG_TCNT0] != (u8)(tcnt + 1) || mcu.psr_sync != clk + 3 ||
+            GET_BIT(mcu.data[REG_GTCCR], BIT_PSRSYNC)) {
+            LOG_ERROR("test failed prescaler reset: tcnt %u, early %u, was %u", mcu.data[REG_TCNT0], early, tcnt);
+            return AVR_ERROR;
+        }
+    }
+
+    // CLKPR takes a prescaler only right after CLKPCE, emulated time then runs at the divided clock
+    {
+        run_init(&mcu, idle, sizeof(idle) / sizeof(idle[0]));
+
+        data_store(&mcu, REG_CLKPR, 0x01);
+        const u32 ignored = avr_clock(&mcu);
+
+        data_store(&mcu, REG_CLKPR, 1 << BIT_CLKPCE);
+        (void)avr_run(&mcu, 2, NULL);
+        data_store(&mcu, REG_CLKPR, 0x01);
+        (void)avr_run(&mcu, 16, NULL);
+
+        if (ignored != AVR_MCU_CLK_SPEED || avr_clock(&mcu) != AVR_MCU_CLK_SPEED / 2 ||
+            avr_ns(&mcu) != 2 * 1000 / 16 + 16 * 1000 / 8 || avr_cycles_to_ns(&mcu, 8) != 1000) {
+            LOG_ERROR("test failed clkpr: clock %lu, ns %lu", (unsigned long)avr_clock(&mcu),
+                      (unsigned long)avr_ns(&mcu));
+            return AVR_ERROR;
+        }
+    }
+
+    // a clock source too slow for the largest prescaler is raised so the system clock never stops
+    {
+        run_init(&mcu, idle, sizeof(idle) / sizeof(idle[0]));
+
+        avr_set_clock(&mcu, 0);
+        data_store(&mcu, REG_CLKPR, 1 << BIT_CLKPCE);
+        data_store(&mcu, REG_CLKPR, CLKPS_MAX);
+
+        if (avr_clock(&mcu) != 1 || avr_cycles_to_ns(&mcu, 1) != NS_PER_S) {
+            LOG_ERROR("test failed slow clock: clock %lu", (unsigned long)avr_clock(&mcu));
+            return AVR_ERROR;
+        }
+    }
+
+    // port callbacks fire only on stores that change the port
+    {
+        run_init(&mcu, idle, sizeof(idle) / sizeof(idle[0]));
+
+        int calls               = 0;
+        AVR_Callbacks callbacks = {.port = on_port, .user = &calls};
+        avr_set_callbacks(&mcu, &callbacks);
+
+        mcu.reg[0] = 0x20;
+        out(&mcu, REG_PORTB - AVR_MCU_IO_REG_OFFSET, 0);
+        out(&mcu, REG_PORTB - AVR_MCU_IO_REG_OFFSET, 0);
+
+        if (calls != 1 || callback_port != 0x20) {
+            LOG_ERROR("test failed callbacks: calls %d, port %#x", calls, callback_port);
+            return AVR_ERROR;
+        }
+    }
+
+    // ddr, pin mode, and uart tx callbacks fire once per change, a pullup turning on is a pin mode change too
+    {
+        run_init(&mcu, idle, sizeof(idle) / sizeof(idle[0]));
+
+        int calls               = 0;
+        AVR_Callbacks callbacks = {.ddr = on_ddr, .pin_mode = on_pin_mode, .uart_tx = on_uart_tx, .user = &calls};
+        avr_set_callbacks(&mcu, &callbacks);
+
+        data_store(&mcu, REG_DDRB, 0x21);
+        data_store(&mcu, REG_DDRB, 0x21);
+        const int ddr_calls = calls;
+        data_store(&mcu, REG_PORTB, 0x02);
+        const int pullup_calls = calls;
+        data_store(&mcu, REG_UDR0, 'A');
+
+        if (ddr_calls != 3 || pullup_calls != 4 || calls != 5 || callback_ddr != 0x21 || callback_outputs != 0x21 ||
+            callback_tx != 'A') {
+            LOG_ERROR("test failed callbacks: calls %d, ddr %#x, outputs %#x, tx %#x", calls, callback_ddr,
+                      callback_outputs, callback_tx);
+            return AVR_ERROR;
+        }
+    }
+
+    // callbacks see sreg and the timer counters as the program would at the store
+    {
+        static const u16 program[] = {
+            0xE800, // ldi r16, 0x80
+            0xE011, // ldi r17, 0x01
+            0x0F01, // add r16, r17
+            0xB915, // out PORTB, r17
+            0xB526, // in r18, TCNT0
+            0x9598, // break
+        };
+        run_init(&mcu, program, sizeof(program) / sizeof(program[0]));
+        mcu.data[REG_TCCR0B] = 0x01; // clk / 1
+
+        AVR_Callbacks callbacks = {.port = on_port_state, .user = &mcu};
+        avr_set_callbacks(&mcu, &callbacks);
+
+        while (avr_run(&mcu, 100, NULL) == AVR_EXIT_IO) {
+        }
+
+        // N = 1, V = 0, S = N ^ V, out takes a cycle before in reads the counter
+        if (callback_sreg != ((1 << SREG_S) | (1 << SREG_N)) || callback_tcnt + 1 != mcu.reg[18]) {
+            LOG_ERROR("test failed callback state: sreg %#x, tcnt %u, in %u", callback_sreg, callback_tcnt,
+                      mcu.reg[18]);
+            return AVR_ERROR;
+        }
+    }
+
+    // setting TXC0 exits for io once, a flag the host leaves set does not exit again
+    {
+        static const u16 program[] = {
+            0x9300, // sts UCSR0A, r16
+            REG_UCSR0A,
+            0x9300, // sts UCSR0A, r16
+            REG_UCSR0A,
+            0x9598, // break
+        };
+        run_init(&mcu, program, sizeof(program) / sizeof(program[0]));
+        mcu.reg[16] = 1 << BIT_TXC0;
+
+        AVR_Exit set  = avr_run(&mcu, 100, &cycles);
+        AVR_Exit left = avr_run(&mcu, 100, &cycles);
+
+        if (set != AVR_EXIT_IO || left != AVR_EXIT_BREAK || mcu.pc != 5) {
+            LOG_ERROR("test failed txc0 exit: exits %d, %d, pc %#x", set, left, mcu.pc);
+            return AVR_ERROR;
+        }
+    }
+
+    // the lowest pending vector is taken and only its flag is cleared
+    {
+        run_init(&mcu, idle, sizeof(idle) / sizeof(idle[0]));
+        mcu.pc               = 0x100;
+        mcu.data[REG_TIMSK0] = 0x07;
+        mcu.data[REG_TIFR0]  = 0x03; // ovf, compa
+        mcu.data[REG_TIMSK2] = 0x07;
+        PUT_BIT(*mcu.sreg, SREG_I);
+
+        int real = avr_interrupt(&mcu);
+
+        if (real != 4 || mcu.pc != IV_TIMER0_COMPA || mcu.data[REG_TIFR0] != 0x01 || GET_BIT(*mcu.sreg, SREG_I) ||
+            avr_interrupt(&mcu) != 0) {
+            LOG_ERROR("test failed interrupt: cycles %d, pc %#x, tifr0 %#x", real, mcu.pc, mcu.data[REG_TIFR0]);
+            return AVR_ERROR;
+        }
+    }
+
+    // sleep lasts until an interrupt the mode wakes on is flagged, even with interrupts disabled
+    {
+        static const u16 program[] = {
+            0x9588, // sleep
+            0x9598, // break
+        };
+        run_init(&mcu, program, sizeof(program) / sizeof(program[0]));
+        mcu.data[REG_SMCR]   = SLEEP_IDLE;
+        mcu.data[REG_TCCR0B] = 0x01; // clk / 1
+        mcu.data[REG_TIMSK0] = 0x01;
+
+        AVR_Exit slept = avr_run(&mcu, 1000, &cycles);
+        u64 total      = cycles;
+        AVR_Exit woke  = avr_run(&mcu, 1000, &cycles);
+        total         += cycles;
+
+        // the overflow 256 cycles in wakes it, then 4 cycles halted and break
+        if (slept != AVR_EXIT_SLEEP || woke != AVR_EXIT_BREAK || mcu.sleep || mcu.pc != 2 || total != 256 + 4) {
+            LOG_ERROR("test failed sleep: exits %d %d, cycles %lu, pc %u", slept, woke, (unsigned long)total, mcu.pc);
+            return AVR_ERROR;
+        }
+    }
+
+    return AVR_OK;
+}
+
+// configure a test_timers case, every mcu it is run on starts from the same registers
+static void timers_init(AVR_MCU *restrict mcu, const u8 (*regs)[2], size_t count) {
+    static const u16 idle[] = {
+        0x0000, // nop
+        0xCFFE, // rjmp .-4
+    };
+    run_init(mcu, idle, sizeof(idle) / sizeof(idle[0]));
+
+    // every compare output pin an output
+    data_store(mcu, REG_DDRB, 0x0E);
+    data_store(mcu, REG_DDRD, 0x68);
+
+    for (size_t i = 0; i < count; i++) {
+        data_store(mcu, regs[i][0], regs[i][1]);
+    }
+}
+
+// timers advanced by avr_run and by avr_cycle count, flag, and drive their pins as ticking them every cycle does
+static AVR_Result test_timers(void) {
+    static AVR_MCU run, stepped, ticked;
+
+    static const struct {
+        const char *name;
+        u8 regs[8][2];
+    } cases[] = {
+        {"timer0 normal", {{REG_OCR0A, 0x80}, {REG_OCR0B, 0x40}, {REG_TCCR0A, 0x60}, {REG_TCCR0B, 0x01}}},
+        {"timer0 ctc", {{REG_OCR0A, 99}, {REG_OCR0B, 20}, {REG_TCCR0A, 0x52}, {REG_TCCR0B, 0x02}}},
+        {"timer0 fast pwm", {{REG_OCR0A, 0x40}, {REG_OCR0B, 0xF0}, {REG_TCCR0A, 0xB3}, {REG_TCCR0B, 0x01}}},
+        {"timer0 fast pwm ocr0a top", {{REG_OCR0A, 200}, {REG_OCR0B, 50}, {REG_TCCR0A, 0x63}, {REG_TCCR0B, 0x09}}},
+        {"timer0 phase correct", {{REG_OCR0A, 0x30}, {REG_OCR0B, 0xC0}, {REG_TCCR0A, 0xB1}, {REG_TCCR0B, 0x01}}},
+        {"timer0 phase correct ocr0a top",
+         {{REG_OCR0A, 150}, {REG_OCR0B, 60}, {REG_TCCR0A, 0x71}, {REG_TCCR0B, 0x0A}}},
+        {"timer1 normal",
+         {{REG_OCR1AL, 0x34}, {REG_OCR1AL + 1, 0x12}, {REG_OCR1BL, 0x00}, {REG_OCR1BL + 1, 0xC0}, {REG_TCCR1A, 0x50},
+          {REG_TCCR1B, 0x01}}},
+        {"timer1 ctc", {{REG_OCR1AL, 0xE7}, {REG_OCR1AL + 1, 0x03}, {REG_TCCR1A, 0x40}, {REG_TCCR1B, 0x09}}},
+        {"timer1 ctc icr1 top",
+         {{REG_ICR1L, 0xF4}, {REG_ICR1L + 1, 0x01}, {REG_OCR1AL, 100}, {REG_TCCR1A, 0x50}, {REG_TCCR1B, 0x19}}},
+        {"timer1 fast pwm 8 bit", {{REG_OCR1AL, 0x20}, {REG_OCR1BL, 0xE0}, {REG_TCCR1A, 0xB1}, {REG_TCCR1B, 0x09}}},
+        {"timer1 fast pwm icr1 top",
+         {{REG_ICR1L, 0xE8}, {REG_ICR1L + 1, 0x03}, {REG_OCR1AL, 0x2C}, {REG_OCR1AL + 1, 0x01}, {REG_OCR1BL, 0xBC},
+          {REG_OCR1BL + 1, 0x02}, {REG_TCCR1A, 0xA2}, {REG_TCCR1B, 0x19}}},
+        {"timer1 phase correct 8 bit",
+         {{REG_OCR1AL, 0x10}, {REG_OCR1BL, 0x80}, {REG_TCCR1A, 0xF1}, {REG_TCCR1B, 0x01}}},
+        {"timer1 phase and frequency correct icr1 top",
+         {{REG_ICR1L, 0x20}, {REG_ICR1L + 1, 0x03}, {REG_OCR1AL, 200}, {REG_TCCR1A, 0xA0}, {REG_TCCR1B, 0x11}}},
+        {"timer2 ctc", {{REG_OCR2A, 77}, {REG_OCR2B, 30}, {REG_TCCR2A, 0x42}, {REG_TCCR2B, 0x01}}},
+        {"timer2 fast pwm", {{REG_OCR2A, 10}, {REG_OCR2B, 250}, {REG_TCCR2A, 0xA3}, {REG_TCCR2B, 0x02}}},
+        {"timer2 phase correct", {{REG_OCR2A, 0x90}, {REG_OCR2B, 0x08}, {REG_TCCR2A, 0xE1}, {REG_TCCR2B, 0x01}}},
+    };
+
+    // registers compared after every chunk of cycles
+    static const u16 observed[] = {REG_TCNT0, REG_TCNT1L, REG_TCNT1H, REG_TCNT2, REG_TIFR0,
+                                   REG_TIFR1, REG_TIFR2,  REG_PORTB,  REG_PORTD};
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        size_t count = 0;
+        while (count < 8 && cases[i].regs[count][0]) {
+            count += 1;
+        }
+
+        timers_init(&run, cases[i].regs, count);
+        timers_init(&stepped, cases[i].regs, count);
+        timers_init(&ticked, cases[i].regs, count);
+
+        // chunks of a prime number of cycles end at every phase of the prescalers
+        for (u32 chunk = 0; chunk < 150; chunk++) {
+            const u64 end = run.clk + 997;
+
+            while (run.clk < end) {
+                (void)avr_run(&run, end - run.clk, NULL);
+            }
+            while (stepped.clk < end) {
+                avr_cycle(&stepped);
+            }
+            while (ticked.clk < end) {
+                ticked.clk       += 1;
+                ticked.sched_clk  = ticked.clk;
+                timer0_tick(&ticked);
+                timer1_tick(&ticked);
+                timer2_tick(&ticked);
+            }
+
+            for (size_t j = 0; j < sizeof(observed) / sizeof(observed[0]); j++) {
+                const u16 reg = observed[j];
+
+                if (run.data[reg] != ticked.data[reg] || stepped.data[reg] != ticked.data[reg] ||
+                    run.pwm_invert != ticked.pwm_invert || stepped.pwm_invert != ticked.pwm_invert) {
+                    LOG_ERROR("test failed %s: clk %lu, reg %#x, run %#x, stepped %#x, ticked %#x", cases[i].name,
+                              (unsigned long)end, reg, run.data[reg], stepped.data[reg], ticked.data[reg]);
+                    return AVR_ERROR;
+                }
+            }
+        }
+    }
+
+    return AVR_OK;
+}
+
+// every pending event sits at its recorded index and no later than its children
+static bool schedule_valid(const AVR_Schedule *restrict s) {
+    u8 pending = 0;
+
+    for (u8 ev = 0; ev < AVR_EVENT_COUNT; ev++) {
+        if (s->pos[ev] != AVR_EVENT_COUNT) {
+            pending += 1;
+            if (s->pos[ev] >= s->count || s->heap[s->pos[ev]] != ev) {
+                return false;
+            }
+        }
+    }
+    for (u8 i = 1; i < s->count; i++) {
+        if (s->at[s->heap[(i - 1) / 2]] > s->at[s->heap[i]]) {
+            return false;
+        }
+    }
+
+    return pending == s->count;
+}
+
+static AVR_Result test_schedule(void) {
+    static AVR_MCU mcu;
+    avr_mcu_init(&mcu);
+    AVR_Schedule *const s = &mcu.schedule;
+
+    // rescheduling moves events up and down the heap, cancelling takes them out from anywhere
+    {
+        sched_at(&mcu, AVR_EVENT_TIMER, 50);
+        sched_at(&mcu, AVR_EVENT_TEST_A, 30);
+        sched_at(&mcu, AVR_EVENT_TEST_B, 70);
+        sched_at(&mcu, AVR_EVENT_TEST_C, 10);
+        sched_at(&mcu, AVR_EVENT_TEST_D, 40);
+        sched_at(&mcu, AVR_EVENT_TEST_B, 5);
+        sched_at(&mcu, AVR_EVENT_TEST_C, 90);
+        sched_cancel(&mcu, AVR_EVENT_TEST_D);
+        sched_cancel(&mcu, AVR_EVENT_TEST_D);
+
+        static const u8 expected[] = {AVR_EVENT_TEST_B, AVR_EVENT_TEST_A, AVR_EVENT_TIMER, AVR_EVENT_TEST_C};
+
+        for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+            const u8 ev = s->heap[0];
+
+            if (!schedule_valid(s) || s->count != sizeof(expected) / sizeof(expected[0]) - i || ev != expected[i]) {
+                LOG_ERROR("test failed schedule order: event %u, expected %u, count %u", ev, expected[i], s->count);
+                return AVR_ERROR;
+            }
+
+            sched_cancel(&mcu, ev);
+        }
+    }
+
+    // the heap keeps its shape and its earliest event first through any mix of schedules and cancels
+    {
+        u32 seed = 1;
+
+        for (u32 i = 0; i < 10000; i++) {
+            seed          = seed * 1103515245 + 12345;
+            const u8 ev   = (seed >> 16) % AVR_EVENT_COUNT;
+            const u64 at  = (seed >> 8) % 64;
+            const bool in = (seed >> 24) % 4 != 0;
+
+            if (in) {
+                sched_at(&mcu, ev, at);
+            } else {
+                sched_cancel(&mcu, ev);
+            }
+
+            u64 first = UINT64_MAX;
+            for (u8 e = 0; e < AVR_EVENT_COUNT; e++) {
+                if (s->pos[e] != AVR_EVENT_COUNT) {
+                    first = MIN(first, s->at[e]);
+                }
+            }
+
+            if (!schedule_valid(s) || (s->count && s->at[s->heap[0]] != first)) {
+                LOG_ERROR("test failed schedule heap: step %u, count %u", i, s->count);
+                return AVR_ERROR;
+            }
+        }
+    }
+
+    return AVR_OK;
+}
+
+static AVR_Result test_timing(void) {
+    static AVR_Timing timing;
+
+    // 90 quanta on time to within 10ns, 9 about 1us late, one 1ms overrun
+    for (int i = 0; i < 90; i++) {
+        avr_timing_record(&timing, -1000, i % 2 ? 10 : -10);
+    }
+    for (int i = 0; i < 9; i++) {
+        avr_timing_record(&timing, 0, 1000);
+    }
+    avr_timing_record(&timing, 1000000, 1000000);
+
+    if (timing.quanta != 100 || timing.missed != 1 || timing.overrun != 1000000) {
+        LOG_ERROR("test failed timing counters: quanta %lu, missed %lu", (unsigned long)timing.quanta,
+                  (unsigned long)timing.missed);
+        return AVR_ERROR;
+    }
+
+    // buckets hold their value exactly below 16 and to within 1/16 above
+    const u64 p50 = avr_timing_percentile(&timing, 50);
+    const u64 p99 = avr_timing_percentile(&timing, 99);
+    const u64 max = avr_timing_percentile(&timing, 100);
+
+    if (p50 != 10 || p99 < 1000 || p99 > 1000 + 1000 / 16 || max < 1000000 || max > 1000000 + 1000000 / 16) {
+        LOG_ERROR("test failed timing percentiles: %lu %lu %lu", (unsigned long)p50, (unsigned long)p99,
+                  (unsigned long)max);
+        return AVR_ERROR;
+    }
+
+    return AVR_OK;
+}
+
 int main(void) {
     if (test_arithmetic_and_logic_instructions() != AVR_OK) {
         printf("tests failed\n");
@@ -1028,6 +1805,26 @@ int main(void) {
         return -1;
     }
 
+    if (test_run() != AVR_OK) {
+        printf("tests failed\n");
+        return -1;
+    }
+
+    if (test_timers() != AVR_OK) {
+        printf("tests failed\n");
+        return -1;
+    }
+
+    if (test_schedule() != AVR_OK) {
+        printf("tests failed\n");
+        return -1;
+    }
+
+    if (test_timing() != AVR_OK) {
+        printf("tests failed\n");
+        return -1;
+    }
+
     printf("tests ran successfully\n");
     return 0;
 }